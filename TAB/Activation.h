@@ -1,27 +1,36 @@
 #pragma once
 
 #include "common.h"
+#include "ThreadPool.h"
+#include "Allocator.h"
 
-// The simple Parameterized leaky ReLU function
-// The tensor shape doesn't matter, because it apply PReLU on each value of the Conv Result
+// Values per PReLU tile
+#define PRELU_CHUNK 16384
+
+// The simple Parameterized leaky ReLU function, into a caller-provided y of total values
 template <typename T>
-std::vector<float> PReLU(T* x, int N, int C, int H, int W, float alpha) {
+void PReLU(const T* x, float* y, int64_t total, float alpha) {
+    // Flat chunks of PRELU_CHUNK values
+    TAB_ParallelFor((int)((total + PRELU_CHUNK - 1) / PRELU_CHUNK), [&](int tile, int tid) {
+        const int64_t begin = (int64_t)tile * PRELU_CHUNK;
+        const int64_t end = (total - begin < PRELU_CHUNK) ? total : (begin + PRELU_CHUNK);
+        for (int64_t i = begin; i < end; i++) {
+            T current = x[i];
+            if (current > 0)
+                y[i] = current;
+            else
+                y[i] = current * alpha;
+        }
+    });
+}
 
-    std::vector<float> y = std::vector<float>(N * C * H * W);
+// The tensor shape doesn't matter, because it apply PReLU on each value of the Conv Result
+template <typename T>
+TabTensor<float> PReLU(T* x, int N, int C, int H, int W, float alpha) {
 
-    for (int n = 0; n < N; n++) {
-        for (int c = 0; c < C; c++) {
-            for (int h = 0; h < H; h++) {
-                for (int w = 0; w < W; w++) {
-                        T current=x[((n * C + c) * H + h) * W + w];
-                        if (current > 0)
-                            y[((n * C + c) * H + h) * W + w] = current;
-                        else
-                            y[((n * C + c) * H + h) * W + w] = current * alpha;
-                }
-            }
-        }
-    }
+    const int64_t total = (int64_t)N * C * H * W;
+    TabTensor<float> y = TabTensor<float>(total);
+    PReLU(x, y.data(), total, alpha);
 
     return y;
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "Allocator.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static std::atomic<bool>& HugePages() {
+    static std::atomic<bool> enabled([] {
+        const char* env = std::getenv("TAB_HUGEPAGES");
+        return !env || (std::atoi(env) > 0);
+    }());
+    return enabled;
+}
+
+static std::atomic<bool>& FirstTouch() {
+    static std::atomic<bool> enabled([] {
+        const char* env = std::getenv("TAB_FIRST_TOUCH");
+        return env && (std::atoi(env) > 0);
+    }());
+    return enabled;
+}
+
+void TAB_SetHugePages(bool Enable) {
+    HugePages() = Enable;
+}
+
+bool TAB_GetHugePages() {
+    return HugePages();
+}
+
+void TAB_SetFirstTouch(bool Enable) {
+    FirstTouch() = Enable;
+}
+
+bool TAB_GetFirstTouch() {
+    return FirstTouch();
+}
+
+
+// Zero the pages from the threads of the pool, one contiguous chunk of whole huge pages per thread
+// A call from inside a task of the pool runs serially, the pages then land on the node of that thread.
+static void TouchPages(void* p, size_t Bytes) {
+    const int threads = TAB_GetNumThreads();
+    const size_t pages = (Bytes + TAB_HUGEPAGE_BYTES - 1) / TAB_HUGEPAGE_BYTES;
+    const size_t chunk = (pages + threads - 1) / threads * TAB_HUGEPAGE_BYTES;
+    TAB_ParallelFor(threads, [&](int tile, int tid) {
+        const size_t begin = (size_t)tile * chunk;
+        if (begin < Bytes)
+            std::memset((char*)p + begin, 0, (Bytes - begin < chunk) ? (Bytes - begin) : chunk);
+    });
+}
+
+
+void* TAB_AlignedAlloc(size_t Bytes) {
+    const bool huge = (Bytes >= TAB_HUGEPAGE_BYTES);
+    void* p = NULL;
+#if defined(_MSC_VER)
+    // Large pages on Windows need the SeLockMemoryPrivilege, only the alignment applies
+    p = _aligned_malloc(Bytes ? Bytes : 1, TAB_ALIGN);
+#else
+    // Whole huge pages, so the advice covers the last one too
+    const size_t align = (huge && HugePages()) ? TAB_HUGEPAGE_BYTES : TAB_ALIGN;
+    const size_t size = (Bytes + align - 1) / align * align;
+    if (posix_memalign(&p, align, size ? size : align) != 0)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    if (align == TAB_HUGEPAGE_BYTES)
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+#endif
+    if (p && huge && FirstTouch())
+        TouchPages(p, Bytes);
+    return p;
+}
+
+void TAB_AlignedFree(void* p) {
+#if defined(_MSC_VER)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "common.h"
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Tensor memory
+// The buffers of TAB (quantized activations, Img2Row rows, packed weights, GEMM results and scratch, the plan and network
+// arenas) are TabTensors, allocated by TAB_AlignedAlloc():
+// - 64-byte aligned, so rows that start on a multiple of 8 words start on a cache line and a ZMM boundary
+// - buffers of TAB_HUGEPAGE_BYTES or more are aligned to 2 MB and advised for transparent huge pages (Linux
+//   madvise(MADV_HUGEPAGE)): the large inputs and Img2Row rows then take one TLB entry per 2 MB instead of 512.
+//   The TAB_HUGEPAGES environment variable (0) or TAB_SetHugePages(false) turns this off.
+// - first-touch placement (off by default, the TAB_FIRST_TOUCH environment variable (1) or TAB_SetFirstTouch(true)):
+//   the pages of large buffers are zeroed by the threads of the pool right after the allocation, one contiguous chunk
+//   per thread, so on NUMA machines they spread over the nodes of the threads that later work on them instead of all
+//   landing on the node of the allocating thread.
+
+#define TAB_ALIGN 64
+#define TAB_HUGEPAGE_BYTES ((size_t)2 << 20)
+
+// Bytes of memory aligned to TAB_ALIGN (2 MB when huge pages apply), NULL when out of memory. Free with TAB_AlignedFree().
+void* TAB_AlignedAlloc(size_t Bytes);
+void TAB_AlignedFree(void* p);
+
+void TAB_SetHugePages(bool HugePages);
+bool TAB_GetHugePages();
+void TAB_SetFirstTouch(bool FirstTouch);
+bool TAB_GetFirstTouch();
+
+// The allocator of TabTensor: TAB_AlignedAlloc() memory, and default initialization of the elements.
+// TabTensor<T>(n) leaves int and float elements uninitialized, for the buffers that a kernel overwrites completely,
+// TabTensor<T>(n, 0) zero fills the ones that rely on zeros (padding borders, accumulators).
+template <typename T>
+struct TabAllocator {
+    typedef T value_type;
+
+    TabAllocator() noexcept {}
+    template <typename U>
+    TabAllocator(const TabAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        void* p = TAB_AlignedAlloc(n * sizeof(T));
+        if (!p)
+            throw std::bad_alloc();
+        return (T*)p;
+    }
+    void deallocate(T* p, size_t) noexcept {
+        TAB_AlignedFree(p);
+    }
+
+    // Default initialization instead of value initialization (zeros)
+    template <typename U>
+    void construct(U* p) noexcept(std::is_nothrow_default_constructible<U>::value) {
+        ::new ((void*)p) U;
+    }
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new ((void*)p) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const TabAllocator<T>&, const TabAllocator<U>&) {
+    return true;
+}
+template <typename T, typename U>
+bool operator!=(const TabAllocator<T>&, const TabAllocator<U>&) {
+    return false;
+}
+
+template <typename T>
+using TabTensor = std::vector<T, TabAllocator<T>>;
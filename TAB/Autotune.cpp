@@ -0,0 +1,284 @@
+#include "common.h"
+#include "Autotune.h"
+#include "CPUFeatures.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+
+// The cache: key -> config, and the file it is written back to
+struct TuneCache {
+    std::mutex Lock;
+    std::map<std::string, TabTuneConfig> Entries;
+    std::string Path;
+    bool Loaded;
+    bool Enabled;
+};
+
+static bool LoadTuneCache(TuneCache& Cache, const char* Path);
+
+// Function-local, loaded from the environment at the first use
+static TuneCache& Cache() {
+    static TuneCache cache;
+    static bool ready = [] {
+        const char* env = std::getenv("TAB_AUTOTUNE");
+        cache.Enabled = env && (std::atoi(env) > 0);
+        cache.Loaded = false;
+        return true;
+    }();
+    (void)ready;
+    return cache;
+}
+
+
+// The cache file: one entry per line, "key : config", '#' starts a comment
+// key:    TYPE Batch_Size C H W KN KH KW PaddingH PaddingW StrideH StrideW Groups PaddingFree ISA Threads
+// config: Algo MC NC KC DotM PipelineDepth
+// Adds the entries of the file to Entries, without replacing the entries of the same key when Replace is false
+static bool ReadTuneEntries(const char* Path, bool Replace, std::map<std::string, TabTuneConfig>& Entries) {
+    FILE* f = Path ? std::fopen(Path, "r") : NULL;
+    if (!f)
+        return false;
+    char line[512];
+    while (std::fgets(line, sizeof(line), f)) {
+        char* sep = std::strchr(line, ':');
+        if ((line[0] == '#') || !sep)
+            continue;
+        *sep = 0;
+        int algo;
+        TabTuneConfig Config;
+        Config.Blocking = GEMM_DefaultBlocking();
+        if (std::sscanf(sep + 1, "%d %d %d %d %d %d", &algo, &Config.Blocking.MC, &Config.Blocking.NC, &Config.Blocking.KC, &Config.Blocking.DotM, &Config.PipelineDepth) != 6)
+            continue;
+        if ((algo != Algo_Blocked) && (algo != Algo_Implicit))
+            continue;
+        Config.Algo = (ConvAlgo)algo;
+        // The key without trailing spaces
+        std::string key = line;
+        while (!key.empty() && (key.back() == ' '))
+            key.pop_back();
+        if (Replace || !Entries.count(key))
+            Entries[key] = Config;
+    }
+    std::fclose(f);
+    return true;
+}
+
+static bool LoadTuneCache(TuneCache& Cache, const char* Path) {
+    Cache.Entries.clear();
+    Cache.Path = Path ? Path : "";
+    Cache.Loaded = true;
+    return ReadTuneEntries(Path, true, Cache.Entries);
+}
+
+// Merges the entries other processes wrote to the file since it was loaded, then replaces the file by a complete
+// temporary one, so a crash never leaves a truncated cache
+static void SaveTuneCache(TuneCache& Cache) {
+    if (Cache.Path.empty())
+        return;
+    ReadTuneEntries(Cache.Path.c_str(), false, Cache.Entries);
+    const std::string tmp = Cache.Path + ".tmp";
+    FILE* f = std::fopen(tmp.c_str(), "w");
+    if (!f)
+        return;
+    std::fprintf(f, "# TAB tuning cache\n");
+    std::fprintf(f, "# TYPE Batch_Size C H W KN KH KW PaddingH PaddingW StrideH StrideW Groups PaddingFree ISA Threads : Algo MC NC KC DotM PipelineDepth\n");
+    for (const auto& e : Cache.Entries) {
+        const TabTuneConfig& c = e.second;
+        std::fprintf(f, "%s : %d %d %d %d %d %d\n", e.first.c_str(), (int)c.Algo, c.Blocking.MC, c.Blocking.NC, c.Blocking.KC, c.Blocking.DotM, c.PipelineDepth);
+    }
+    const bool ok = (std::fflush(f) == 0) && !std::ferror(f);
+    std::fclose(f);
+    if (!ok) {
+        std::remove(tmp.c_str());
+        return;
+    }
+    // rename() does not replace an existing file on Windows
+    if (std::rename(tmp.c_str(), Cache.Path.c_str()) != 0) {
+        std::remove(Cache.Path.c_str());
+        if (std::rename(tmp.c_str(), Cache.Path.c_str()) != 0)
+            std::remove(tmp.c_str());
+    }
+}
+
+
+void TAB_SetAutotune(bool Enable) {
+    TuneCache& cache = Cache();
+    std::lock_guard<std::mutex> lk(cache.Lock);
+    cache.Enabled = Enable;
+}
+
+
+bool TAB_GetAutotune() {
+    TuneCache& cache = Cache();
+    std::lock_guard<std::mutex> lk(cache.Lock);
+    return cache.Enabled;
+}
+
+
+bool TAB_SetTuneCache(const char* Path) {
+    TuneCache& cache = Cache();
+    std::lock_guard<std::mutex> lk(cache.Lock);
+    return LoadTuneCache(cache, Path);
+}
+
+
+static std::string TuneKey(const TabConvPlan& Plan) {
+    char key[256];
+    std::snprintf(key, sizeof(key), "%d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d", (int)Plan.TYPE, Plan.Batch_Size, Plan.C, Plan.H, Plan.W,
+        Plan.KN, Plan.KH, Plan.KW, Plan.PaddingH, Plan.PaddingW, Plan.StrideH, Plan.StrideW, Plan.Groups, Plan.PaddingFree ? 1 : 0,
+        (int)TAB_GetISA(), TAB_GetNumThreads());
+    return key;
+}
+
+
+static void ApplyTuneConfig(TabConvPlan& Plan, const TabTuneConfig& Config) {
+    TAB_SetConvPlanBlocking(Plan, Config.Algo, Config.Blocking);
+    if (Config.PipelineDepth != Plan.PipelineDepth)
+        TAB_SetConvPlanPipeline(Plan, Config.PipelineDepth);
+}
+
+
+// The random layer data of a benchmark, in tensor memory like the data of the layer (see Allocator.h)
+struct TuneData {
+    TabTensor<float> X;
+    std::vector<float> Q_Threshold;
+    TabPackedWeights Weights;
+    TabTensor<float> y;
+};
+
+static TuneData TuneLayerData(const TabConvPlan& Plan) {
+    TuneData Data;
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    Data.X = TabTensor<float>((size_t)Plan.Batch_Size * Plan.C * Plan.H * Plan.W);
+    for (float& v : Data.X)
+        v = uniform(rng);
+    Data.Q_Threshold = std::vector<float>(Plan.Batch_Size, 0.3f);
+    // Random bits of the quantized filters: the timing does not depend on their values
+    const int PB = ((Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::BTN)) ? BITS : 1;
+    std::vector<int64_t> QW((size_t)Plan.KN * Plan.KH * Plan.KW * Plan.PackedC * PB);
+    for (int64_t& v : QW)
+        v = (int64_t)rng();
+    Data.Weights = TAB_PackWeights(Plan.TYPE, QW.data(), Plan.KN, Plan.C, Plan.KH, Plan.KW, Plan.Groups);
+    Data.y = TabTensor<float>(TAB_ConvPlanOutputSize(Plan));
+    return Data;
+}
+
+
+// The seconds of one run of the layer in Config: the best of a few runs after a warm-up run
+#define TUNE_RUNS 3
+#define TUNE_SECONDS 0.25
+
+static double TimeTuneConfig(const TabConvPlan& Layer, const TabTuneConfig& Config, TuneData& Data) {
+    TabConvPlan Plan = TAB_CreateConvPlan(Layer.TYPE, Layer.PaddingH, Layer.PaddingW, Layer.StrideH, Layer.StrideW, Layer.Batch_Size, Layer.C, Layer.H, Layer.W,
+        Layer.KN, Layer.KH, Layer.KW, Config.Algo, Layer.Groups);
+    if (Layer.PaddingFree)
+        TAB_SetConvPlanPaddingFree(Plan, true);
+    ApplyTuneConfig(Plan, Config);
+
+    TAB_RunConvPlan(Plan, Data.X.data(), Data.Q_Threshold.data(), Data.Weights, 0.1f, Data.y.data());
+    double best = 0, total = 0;
+    for (int r = 0; (r < TUNE_RUNS) && (total < TUNE_SECONDS); r++) {
+        const auto start = std::chrono::steady_clock::now();
+        TAB_RunConvPlan(Plan, Data.X.data(), Data.Q_Threshold.data(), Data.Weights, 0.1f, Data.y.data());
+        const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = ((r == 0) || (t < best)) ? t : best;
+        total += t;
+    }
+    return best;
+}
+
+
+TabTuneConfig TAB_BenchmarkConvPlan(const TabConvPlan& Plan) {
+    TuneData Data = TuneLayerData(Plan);
+    TabTuneConfig best;
+    best.Algo = Plan.Algo;
+    best.Blocking = Plan.Blocking;
+    best.PipelineDepth = Plan.PipelineDepth;
+    double bestTime = TimeTuneConfig(Plan, best, Data);
+
+    // Keep c when it beats the best so far
+    auto Try = [&](const TabTuneConfig& c) {
+        const double t = TimeTuneConfig(Plan, c, Data);
+        if (t < bestTime) {
+            bestTime = t;
+            best = c;
+        }
+    };
+
+    TabTuneConfig c = best;
+    c.Algo = (best.Algo == Algo_Implicit) ? Algo_Blocked : Algo_Implicit;
+    Try(c);
+
+    // GEMV or GEMM: the few-row GEMMs of small batches and small outputs
+    const int M = Plan.Batch_Size * Plan.OH * Plan.OW;
+    if (M <= 64) {
+        c = best;
+        c.Blocking.DotM = (best.Blocking.DotM > M) ? 0 : (M + 1);
+        Try(c);
+    }
+
+    const int MCs[] = { 16, 32, 64, 128, 256 };
+    const int NCs[] = { 64, 128, 256, 512 };
+    const int KCs[] = { 64, 128, 256, 512, 1024 };
+    for (int mc : MCs) {
+        c = best;
+        c.Blocking.MC = mc;
+        if (mc != best.Blocking.MC)
+            Try(c);
+    }
+    for (int nc : NCs) {
+        c = best;
+        c.Blocking.NC = nc;
+        if (nc != best.Blocking.NC)
+            Try(c);
+    }
+    for (int kc : KCs) {
+        c = best;
+        c.Blocking.KC = kc;
+        if (kc != best.Blocking.KC)
+            Try(c);
+    }
+
+    if ((Plan.Batch_Size > 1) && (Plan.Groups == 1)) {
+        c = best;
+        c.PipelineDepth = best.PipelineDepth ? 0 : 2;
+        Try(c);
+    }
+    return best;
+}
+
+
+bool TAB_TuneConvPlan(TabConvPlan& Plan) {
+    if ((Plan.Algo == Algo_Baseline) || ((Plan.Groups > 1) && (Plan.Groups == Plan.C)))
+        return false;
+    TuneCache& cache = Cache();
+    const std::string key = TuneKey(Plan);
+    {
+        std::lock_guard<std::mutex> lk(cache.Lock);
+        if (!cache.Loaded)
+            LoadTuneCache(cache, std::getenv("TAB_TUNE_CACHE"));
+        auto it = cache.Entries.find(key);
+        if ((it == cache.Entries.end()) && !cache.Enabled)
+            return false;
+        if (it != cache.Entries.end()) {
+            ApplyTuneConfig(Plan, it->second);
+            return true;
+        }
+    }
+
+    // Tune outside the lock, the benchmark runs on the pool
+    const TabTuneConfig Config = TAB_BenchmarkConvPlan(Plan);
+    {
+        std::lock_guard<std::mutex> lk(cache.Lock);
+        cache.Entries[key] = Config;
+        SaveTuneCache(cache);
+    }
+    ApplyTuneConfig(Plan, Config);
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "common.h"
+#include "GEMM.h"
+#include "TAB_CPU.h"
+
+// Shape-aware autotuning with a persistent tuning cache
+// No single configuration wins on every layer: an FC layer of K = 16000 at batch 1 wants the dot kernels, a large
+// conv wants big row blocks and the implicit GEMM, a small one the fused Img2Row. The tuner benchmarks the candidate
+// configurations of a layer the first time it is seen, and keeps the fastest in the tuning cache, so the plans of the
+// same layer on the same machine start with it.
+//
+// The key of a layer: ConvType, Batch_Size, C, H, W, KN, KH, KW, the padding, the stride, Groups, PaddingFree, and the
+// ISA and the thread count it was tuned with.
+// The cache file is a text file of one entry per line ("key : config"), loaded at the first lookup from the path in
+// the TAB_TUNE_CACHE environment variable (or TAB_SetTuneCache()) and rewritten after every new entry: the entries other
+// processes added to the file in the meantime are merged in, and a temporary file Path.tmp is renamed over it.
+// Tuning is off by default, only the cached configurations are applied. The TAB_AUTOTUNE environment variable (1) or
+// TAB_SetAutotune() turns it on.
+
+// A configuration of one layer
+struct TabTuneConfig {
+    ConvAlgo Algo;          // Algo_Blocked or Algo_Implicit
+    GEMMBlocking Blocking;  // MC, NC, KC and DotM (GEMV or GEMM), the container follows the packed weights
+    int PipelineDepth;      // see TAB_SetConvPlanPipeline()
+};
+
+void TAB_SetAutotune(bool Enable);
+bool TAB_GetAutotune();
+
+// Load the cache file Path, replacing the cache in memory. New entries are written back to it.
+// Returns false when the file can not be read, the cache then starts empty.
+bool TAB_SetTuneCache(const char* Path);
+
+// Apply the cached configuration of the layer of Plan, after tuning it when it is not in the cache and tuning is on.
+// Returns true when a configuration was applied. Baseline and depthwise plans are left as they are.
+// Call it on a new plan (after TAB_SetConvPlanPaddingFree()), before its arena is shared.
+bool TAB_TuneConvPlan(TabConvPlan& Plan);
+
+// Benchmark the candidates on the layer of Plan with random data and return the fastest, without the cache
+// Starting from the configuration of Plan, the algorithm, DotM, MC, NC, KC and the pipeline depth are tuned one after
+// the other, each keeping the best of the ones before.
+TabTuneConfig TAB_BenchmarkConvPlan(const TabConvPlan& Plan);
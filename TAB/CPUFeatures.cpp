@@ -0,0 +1,101 @@
+#include "common.h"
+#include "CPUFeatures.h"
+#include <cstdlib>
+#include <cstring>
+
+#ifdef TAB_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+static void CPUID(int leaf, int subleaf, unsigned int regs[4]) {
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for (int i = 0; i < 4; i++)
+        regs[i] = (unsigned int)r[i];
+}
+static uint64_t XGETBV0() {
+    return _xgetbv(0);
+}
+#else
+#include <cpuid.h>
+static void CPUID(int leaf, int subleaf, unsigned int regs[4]) {
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+}
+static uint64_t XGETBV0() {
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+}
+#endif
+#endif // TAB_X86
+
+
+TAB_ISA TAB_DetectISA() {
+#ifdef TAB_X86
+    unsigned int r[4];
+    CPUID(0, 0, r);
+    const unsigned int maxLeaf = r[0];
+    CPUID(1, 0, r);
+    const bool popcnt = (r[2] >> 23) & 1;
+    const bool osxsave = (r[2] >> 27) & 1;
+    const bool f16c = (r[2] >> 29) & 1;
+    if (!popcnt || !osxsave || (maxLeaf < 7))
+        return ISA_Scalar;
+
+    // The OS must save the YMM (bits 1, 2) and ZMM (bits 5, 6, 7) states
+    const uint64_t xcr0 = XGETBV0();
+    const bool ymm = (xcr0 & 0x6) == 0x6;
+    const bool zmm = (xcr0 & 0xE6) == 0xE6;
+
+    CPUID(7, 0, r);
+    const bool avx2 = (r[1] >> 5) & 1;
+    const bool avx512f = (r[1] >> 16) & 1;
+    const bool avx512bw = (r[1] >> 30) & 1;
+    const bool avx512vl = (r[1] >> 31) & 1;
+    const bool vpopcntdq = (r[2] >> 14) & 1;
+
+    if (zmm && avx512f && avx512bw && avx512vl && vpopcntdq)
+        return ISA_AVX512;
+    if (ymm && avx2 && f16c)
+        return ISA_AVX2;
+#endif
+    return ISA_Scalar;
+}
+
+
+static TAB_ISA InitialISA() {
+    TAB_ISA isa = TAB_DetectISA();
+    const char* env = std::getenv("TAB_ISA");
+    if (env) {
+        for (int i = 0; i < TAB_ISAs; i++) {
+            if ((std::strcmp(env, TAB_ISAName((TAB_ISA)i)) == 0) && (i < isa))
+                isa = (TAB_ISA)i;
+        }
+    }
+    return isa;
+}
+
+// Function-local, so kernels selected during static initialization of other files see it too
+static TAB_ISA& CurrentISA() {
+    static TAB_ISA isa = InitialISA();
+    return isa;
+}
+
+
+TAB_ISA TAB_GetISA() {
+    return CurrentISA();
+}
+
+
+TAB_ISA TAB_SetISA(TAB_ISA isa) {
+    const TAB_ISA best = TAB_DetectISA();
+    CurrentISA() = (isa < best) ? isa : best;
+    return CurrentISA();
+}
+
+
+const char* TAB_ISAName(TAB_ISA isa) {
+    switch (isa) {
+    case ISA_AVX2:   return "avx2";
+    case ISA_AVX512: return "avx512";
+    default:         return "scalar";
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "common.h"
+
+// Runtime instruction set selection
+// The SIMD kernels are compiled for their own instruction set (TAB_TARGET) and picked at startup via cpuid,
+// so one binary runs the best kernels on every x86_64 CPU and the scalar kernels everywhere else.
+
+enum TAB_ISA {
+    ISA_Scalar = 0, ISA_AVX2 = 1, ISA_AVX512 = 2, TAB_ISAs = 3
+};
+
+// The best instruction set supported by this CPU and OS
+// AVX2 needs AVX2 + POPCNT + F16C, AVX512 needs AVX512F/BW/VL + VPOPCNTDQ
+TAB_ISA TAB_DetectISA();
+
+// The instruction set used by the kernels. Defaults to TAB_DetectISA(), or to the TAB_ISA environment
+// variable (scalar, avx2, avx512) when it is set and supported.
+TAB_ISA TAB_GetISA();
+
+// Force an instruction set, e.g. to compare kernels. Requests above TAB_DetectISA() are clamped.
+// Returns the instruction set actually selected.
+TAB_ISA TAB_SetISA(TAB_ISA isa);
+
+const char* TAB_ISAName(TAB_ISA isa);
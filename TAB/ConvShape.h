@@ -0,0 +1,46 @@
+#pragma once
+#include "common.h"
+
+// Compile-time conv shapes
+// The window loops of the conv kernels (Img2Row, the fused quantize + Img2Row, the a packing of the implicit GEMM and
+// the depthwise rows) are templates on a ConvShape. A dimension of 0 stands for the runtime value, so
+// ConvShape<0, 0, 0, 0> is the generic fallback, and the common shapes get window loops with constant trip counts
+// and constant index math, which the compiler unrolls and folds.
+template <int KH_, int KW_, int StrideH_, int StrideW_>
+struct ConvShape {
+    static constexpr int KH = KH_;
+    static constexpr int KW = KW_;
+    static constexpr int StrideH = StrideH_;
+    static constexpr int StrideW = StrideW_;
+};
+
+// A dimension of a shape: the constant N, or the runtime value when N is 0
+template <int N>
+inline int ShapeDim(int Runtime) {
+    if constexpr (N > 0)
+        return N;
+    else
+        return Runtime;
+}
+
+// The registry of the specialized shapes: calls f(ConvShape<...>()) with the shape of (KH, KW, StrideH, StrideW),
+// 1x1/s1, 1x1/s2, 3x3/s1, 3x3/s2, 5x5/s1 and 7x7/s2, or with the generic shape for any other.
+// The kernels pick their instance once per call through it.
+template <typename F>
+inline void TAB_DispatchConvShape(int KH, int KW, int StrideH, int StrideW, F&& f) {
+    const bool square = (KH == KW) && (StrideH == StrideW);
+    if (square && (KH == 1) && (StrideH == 1))
+        f(ConvShape<1, 1, 1, 1>());
+    else if (square && (KH == 1) && (StrideH == 2))
+        f(ConvShape<1, 1, 2, 2>());
+    else if (square && (KH == 3) && (StrideH == 1))
+        f(ConvShape<3, 3, 1, 1>());
+    else if (square && (KH == 3) && (StrideH == 2))
+        f(ConvShape<3, 3, 2, 2>());
+    else if (square && (KH == 5) && (StrideH == 1))
+        f(ConvShape<5, 5, 1, 1>());
+    else if (square && (KH == 7) && (StrideH == 2))
+        f(ConvShape<7, 7, 2, 2>());
+    else
+        f(ConvShape<0, 0, 0, 0>());
+}
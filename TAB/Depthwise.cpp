@@ -0,0 +1,292 @@
+#include "common.h"
+#include "ThreadPool.h"
+#include "GEMM.h"
+#include "Depthwise.h"
+#include "ConvShape.h"
+#include <algorithm>
+
+// Bit-sliced counters: plane p holds bit p of the 64 lane counts, so one word of taps is added to 64 counts at once.
+// 8 planes count up to 255 taps per pass.
+#define DW_PLANES 8
+#define DW_TAPS 255
+
+
+int64_t Depthwise_PackedWords(bool Ternary, int N, int C, int PackedH, int PackedW, int KW, int StrideW) {
+    const int P = Ternary ? BITS : 1;
+    const int OW = (PackedW - KW) / StrideW + 1;
+    const int OWW = (OW + cntbits - 1) / cntbits;
+    return (int64_t)N * C * PackedH * KW * OWW * P;
+}
+
+
+// One padded input row as bit planes r1 (and r2) of its PackedW pixels, RowWords(PackedW) words each, into the
+// packed rows of every kw. Stride 1 shifts whole words, other strides gather the bits.
+static inline int RowWords(int PackedW) {
+    return (PackedW + cntbits - 1) / cntbits + 1;  // + 1: the funnel shift reads one word past the row
+}
+
+static void PackRow(const uint64_t* r1, const uint64_t* r2, int P, int KW, int StrideW, int OW, int64_t* row) {
+    const int OWW = (OW + cntbits - 1) / cntbits;
+    for (int kw = 0; kw < KW; kw++) {
+        for (int w = 0; w < OWW; w++) {
+            const int lanes = (OW - w * cntbits < cntbits) ? (OW - w * cntbits) : cntbits;
+            const uint64_t mask = (lanes < cntbits) ? ((((uint64_t)1) << lanes) - 1) : ~(uint64_t)0;
+            for (int p = 0; p < P; p++) {
+                const uint64_t* r = p ? r2 : r1;
+                uint64_t bits = 0;
+                if (StrideW == 1) {
+                    const int b = w * cntbits + kw;
+                    const int sh = b % cntbits;
+                    bits = r[b / cntbits] >> sh;
+                    if (sh)
+                        bits = bits | (r[b / cntbits + 1] << (cntbits - sh));
+                }
+                else {
+                    for (int bit = 0; bit < lanes; bit++) {
+                        const int pw = (w * cntbits + bit) * StrideW + kw;
+                        bits = bits | (((r[pw / cntbits] >> (pw % cntbits)) & 1) << bit);
+                    }
+                }
+                row[(kw * OWW + w) * P + p] = (int64_t)(bits & mask);
+            }
+        }
+    }
+}
+
+
+void Depthwise_Quantize_NCHW(const float* X, bool Ternary, int PaddingH, int PaddingW, const float* Q_Threshold, int N, int C, int H, int W, int KW, int StrideW, int64_t* qx) {
+    const int P = Ternary ? BITS : 1;
+    const int packH = H + 2 * PaddingH;
+    const int packW = W + 2 * PaddingW;
+    const int OW = (packW - KW) / StrideW + 1;
+    const int OWW = (OW + cntbits - 1) / cntbits;
+    const int words = RowWords(packW);
+
+    // One tile per input plane, each row is quantized once into its bit planes
+    TAB_ParallelFor(N * C, [&](int tile, int tid) {
+        const int in = tile / C;
+        const float Threshold = Q_Threshold ? Q_Threshold[in] : 0;
+        const float* plane = X + (int64_t)tile * H * W;
+        static thread_local std::vector<uint64_t> bits;
+        bits.assign(2 * (size_t)words, 0);
+        uint64_t* r1 = bits.data();
+        uint64_t* r2 = bits.data() + words;
+        for (int ph = 0; ph < packH; ph++) {
+            const int ih = ph - PaddingH;
+            // Padding: 0 in both planes, as in Ternarize_NCHW_to_NHWCB() / Binarize_NCHW_to_NHWC()
+            std::fill(bits.begin(), bits.end(), (uint64_t)0);
+            if ((ih >= 0) && (ih < H)) {
+                for (int iw = 0; iw < W; iw++) {
+                    const float currentx = plane[ih * W + iw];
+                    const int pw = iw + PaddingW;
+                    if (Ternary) {
+                        const uint64_t pos = currentx > Threshold;
+                        const uint64_t neg = currentx < (-Threshold);
+                        r1[pw / cntbits] |= neg << (pw % cntbits);
+                        r2[pw / cntbits] |= (pos | neg) << (pw % cntbits);
+                    }
+                    else {
+                        r1[pw / cntbits] |= ((uint64_t)(currentx < Threshold)) << (pw % cntbits);
+                    }
+                }
+            }
+            PackRow(r1, r2, P, KW, StrideW, OW, qx + ((int64_t)tile * packH + ph) * KW * OWW * P);
+        }
+    });
+}
+
+
+void Depthwise_Pack_NHWC(const int64_t* QX, bool Ternary, int N, int C, int H, int W, int PaddingH, int PaddingW, int KW, int StrideW, int64_t* qx) {
+    const int P = Ternary ? BITS : 1;
+    const int packC = (C + cntbits - 1) / cntbits;
+    const int packH = H + 2 * PaddingH;
+    const int packW = W + 2 * PaddingW;
+    const int OW = (packW - KW) / StrideW + 1;
+    const int OWW = (OW + cntbits - 1) / cntbits;
+    const int words = RowWords(packW);
+
+    // One tile per padded input row: the bit planes of every channel along the row, then its packed rows
+    TAB_ParallelFor(N * packH, [&](int tile, int tid) {
+        const int in = tile / packH;
+        const int ph = tile % packH;
+        const int ih = ph - PaddingH;
+        const int64_t* src = QX + ((int64_t)in * H + ih) * W * packC * P;
+        static thread_local std::vector<uint64_t> bits;
+        bits.assign(2 * (size_t)words, 0);
+        uint64_t* r1 = bits.data();
+        uint64_t* r2 = bits.data() + words;
+        for (int c = 0; c < C; c++) {
+            std::fill(bits.begin(), bits.end(), (uint64_t)0);
+            for (int iw = 0; (ih >= 0) && (ih < H) && (iw < W); iw++) {
+                const int pw = iw + PaddingW;
+                const int64_t* pixel = src + ((int64_t)iw * packC + c / cntbits) * P;
+                r1[pw / cntbits] |= (((uint64_t)pixel[0] >> (c % cntbits)) & 1) << (pw % cntbits);
+                if (Ternary)
+                    r2[pw / cntbits] |= (((uint64_t)pixel[1] >> (c % cntbits)) & 1) << (pw % cntbits);
+            }
+            PackRow(r1, r2, P, KW, StrideW, OW, qx + (((int64_t)in * C + c) * packH + ph) * KW * OWW * P);
+        }
+    });
+}
+
+
+// Spread the 8 bits of a byte into the 8 bytes of a word
+static const uint64_t* SpreadBytes() {
+    static uint64_t table[256];
+    static bool ready = [] {
+        for (int v = 0; v < 256; v++) {
+            table[v] = 0;
+            for (int bit = 0; bit < 8; bit++)
+                table[v] |= (uint64_t)((v >> bit) & 1) << (8 * bit);
+        }
+        return true;
+    }();
+    (void)ready;
+    return table;
+}
+
+
+// counts += v, per lane
+static inline void CounterAdd(uint64_t* planes, uint64_t v) {
+    for (int p = 0; (p < DW_PLANES) && v; p++) {
+        const uint64_t carry = planes[p] & v;
+        planes[p] = planes[p] ^ v;
+        v = carry;
+    }
+}
+
+
+// out[lane] += scale * count of lane, lanes [0, lanes), from the low used planes
+static inline void CounterExtract(const uint64_t* planes, int used, int scale, int lanes, int* out) {
+    const uint64_t* spread = SpreadBytes();
+    for (int g = 0; g * 8 < lanes; g++) {
+        // 8 lane counts, one per byte (at most 255)
+        uint64_t bytes = 0;
+        for (int p = 0; p < used; p++)
+            bytes += spread[(planes[p] >> (8 * g)) & 0xFF] << p;
+        for (int i = 0; (i < 8) && (g * 8 + i < lanes); i++)
+            out[g * 8 + i] += scale * (int)((bytes >> (8 * i)) & 0xFF);
+    }
+}
+
+
+// The conv of one output row oh of filter k against the packed rows of its channel, conv[ow] for ow in [0, OW)
+// Per tap and lane: nz = the product is not 0, neg = it is -1. The result is sum(nz) - 2 * sum(neg), where the
+// weights are scalars per tap and binary activations are never 0 (so sum(nz) is the count of non-zero weights).
+// The windows of the shape S (see ConvShape.h) unroll the taps, and never flush when they have less than DW_TAPS taps.
+template <ConvType TYPE, class S>
+static void Depthwise_Row(const int64_t* rows, const int64_t* w, int KH_, int KW_, int OWW, int OW, int* conv) {
+    constexpr int PA = ((TYPE == ConvType::TNN) || (TYPE == ConvType::TBN)) ? BITS : 1;
+    constexpr int PB = ((TYPE == ConvType::TNN) || (TYPE == ConvType::BTN)) ? BITS : 1;
+    constexpr bool flush = (S::KH == 0) || (S::KW == 0) || (S::KH * S::KW >= DW_TAPS);
+    const int KH = ShapeDim<S::KH>(KH_);
+    const int KW = ShapeDim<S::KW>(KW_);
+    const int64_t rowWords = (int64_t)KW * OWW * PA;   // one padded input row
+    const int taps = (KH * KW < DW_TAPS) ? (KH * KW) : DW_TAPS;
+    int used = 0;  // the planes that can hold a count of taps
+    while ((used < DW_PLANES) && ((1 << used) <= taps))
+        used++;
+    for (int ow = 0; ow < OW; ow++)
+        conv[ow] = 0;
+
+    for (int ww = 0; ww < OWW; ww++) {
+        const int lanes = (OW - ww * cntbits < cntbits) ? (OW - ww * cntbits) : cntbits;
+        uint64_t nz[DW_PLANES] = { 0 };
+        uint64_t neg[DW_PLANES] = { 0 };
+        int nzw = 0;   // binary activations: the non-zero taps
+        int count = 0;
+        for (int kh = 0; kh < KH; kh++) {
+            for (int kw = 0; kw < KW; kw++) {
+                const int t = kh * KW + kw;
+                const bool wnz = (PB == 1) || (w[t * PB + 1] & 1);
+                if (!wnz)
+                    continue;
+                const uint64_t sign = (w[t * PB] & 1) ? ~(uint64_t)0 : 0;
+                const int64_t* x = rows + kh * rowWords + ((int64_t)kw * OWW + ww) * PA;
+                if constexpr (PA == BITS) {
+                    CounterAdd(nz, (uint64_t)x[1]);
+                    CounterAdd(neg, ((uint64_t)x[0] ^ sign) & (uint64_t)x[1]);
+                }
+                else {
+                    nzw++;
+                    CounterAdd(neg, (uint64_t)x[0] ^ sign);
+                }
+                // Flush before a lane count can pass 255
+                if (flush && (++count == DW_TAPS)) {
+                    if (PA == BITS)
+                        CounterExtract(nz, used, 1, lanes, conv + ww * cntbits);
+                    CounterExtract(neg, used, -2, lanes, conv + ww * cntbits);
+                    for (int p = 0; p < DW_PLANES; p++)
+                        nz[p] = neg[p] = 0;
+                    count = 0;
+                }
+            }
+        }
+        if (PA == BITS)
+            CounterExtract(nz, used, 1, lanes, conv + ww * cntbits);
+        CounterExtract(neg, used, -2, lanes, conv + ww * cntbits);
+        for (int i = 0; i < lanes; i++)
+            conv[ww * cntbits + i] += nzw;
+    }
+}
+
+
+template <ConvType TYPE, class S>
+static void Depthwise_Conv_T(const int64_t* qx, const int64_t* QWeights, int N, int C, int PackedH, int PackedW, int KN, int KH_, int KW_, int StrideH_, int StrideW,
+    const GEMMEpilogue& Epilogue, void* y) {
+    const int KH = ShapeDim<S::KH>(KH_);
+    const int KW = ShapeDim<S::KW>(KW_);
+    const int StrideH = ShapeDim<S::StrideH>(StrideH_);
+    const int PA = ((TYPE == ConvType::TNN) || (TYPE == ConvType::TBN)) ? BITS : 1;
+    const int PB = ((TYPE == ConvType::TNN) || (TYPE == ConvType::BTN)) ? BITS : 1;
+    const int OH = (PackedH - KH) / StrideH + 1;
+    const int OW = (PackedW - KW) / StrideW + 1;
+    const int OWW = (OW + cntbits - 1) / cntbits;
+    const int Multiplier = KN / C;
+    const int64_t rowWords = (int64_t)KW * OWW * PA;
+
+    TABGEMM_ZeroOutputBorder(Epilogue, N * OH * OW, KN, y);
+
+    // One tile per output row: the results of all filters, then the epilogue of its OW rows of y
+    TAB_ParallelFor(N * OH, [&](int tile, int tid) {
+        const int in = tile / OH;
+        const int oh = tile % OH;
+        static thread_local std::vector<int> results;
+        static thread_local std::vector<int> row;
+        if (results.size() < (size_t)OW * KN)
+            results.resize((size_t)OW * KN);
+        if (row.size() < (size_t)OWW * cntbits)
+            row.resize((size_t)OWW * cntbits);
+        for (int k = 0; k < KN; k++) {
+            const int c = k / Multiplier;
+            const int64_t* rows = qx + (((int64_t)in * C + c) * PackedH + oh * StrideH) * rowWords;
+            Depthwise_Row<TYPE, S>(rows, QWeights + (int64_t)k * KH * KW * PB, KH, KW, OWW, OW, row.data());
+            for (int ow = 0; ow < OW; ow++)
+                results[(size_t)ow * KN + k] = row[ow];
+        }
+        TABGEMM_EpilogueRows(Epilogue, results.data(), tile * OW, OW, KN, y);
+    });
+}
+
+
+// The registry of the depthwise kernels, on (TYPE, KH, KW, stride)
+void Depthwise_Conv(ConvType TYPE, const int64_t* qx, const int64_t* QWeights, int N, int C, int PackedH, int PackedW, int KN, int KH, int KW, int StrideH, int StrideW,
+    const GEMMEpilogue& Epilogue, void* y) {
+    TAB_DispatchConvShape(KH, KW, StrideH, StrideW, [&](auto shape) {
+        typedef decltype(shape) S;
+        switch (TYPE) {
+        case ConvType::TNN:
+            Depthwise_Conv_T<ConvType::TNN, S>(qx, QWeights, N, C, PackedH, PackedW, KN, KH, KW, StrideH, StrideW, Epilogue, y);
+            break;
+        case ConvType::TBN:
+            Depthwise_Conv_T<ConvType::TBN, S>(qx, QWeights, N, C, PackedH, PackedW, KN, KH, KW, StrideH, StrideW, Epilogue, y);
+            break;
+        case ConvType::BTN:
+            Depthwise_Conv_T<ConvType::BTN, S>(qx, QWeights, N, C, PackedH, PackedW, KN, KH, KW, StrideH, StrideW, Epilogue, y);
+            break;
+        default:
+            Depthwise_Conv_T<ConvType::BNN, S>(qx, QWeights, N, C, PackedH, PackedW, KN, KH, KW, StrideH, StrideW, Epilogue, y);
+            break;
+        }
+    });
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "common.h"
+#include "GEMM.h"
+
+// Depthwise TAB convolution (groups == C)
+// With one input channel per group, 64-channel bit packing would leave 63 of 64 bits empty. The depthwise path
+// packs along the spatial axis instead: one word holds 64 output columns. For every input channel c, padded input
+// row ph and kernel column kw, the packed row holds the input pixels read by the output columns ow = 0 .. OW - 1:
+//   qx[n, c, ph, kw, ow / 64, B] bit ow % 64 = x[n, c, ph, ow * StrideW + kw]
+// so every kernel tap is one word per 64 outputs for any stride, and the taps are summed by bit-sliced counters.
+
+// The words of the spatially packed input
+int64_t Depthwise_PackedWords(bool Ternary, int N, int C, int PackedH, int PackedW, int KW, int StrideW);
+
+// Quantize the NCHW input into the spatially packed input, Q_Threshold per image (NULL: 0)
+void Depthwise_Quantize_NCHW(const float* X, bool Ternary, int PaddingH, int PaddingW, const float* Q_Threshold, int N, int C, int H, int W, int KW, int StrideW, int64_t* qx);
+
+// The same from a quantized input QX of H x W pixels (N_H_W_C(_B), see Ternarize_NCHW_to_NHWCB()), with a zero border
+// of PaddingH / PaddingW pixels around it that QX does not store (0 when QX is already padded)
+void Depthwise_Pack_NHWC(const int64_t* QX, bool Ternary, int N, int C, int H, int W, int PaddingH, int PaddingW, int KW, int StrideW, int64_t* qx);
+
+// The conv of the spatially packed input with KN = C * multiplier filters of one channel each (filter k reads
+// channel k / (KN / C)), quantized as KN_KH_KW_C_B with C = 1. Any ConvType, the results are the same as the
+// dense GEMMs with one channel. The epilogue writes y as N_OH_OW_KN, its OH and OW must be set.
+void Depthwise_Conv(ConvType TYPE, const int64_t* qx, const int64_t* QWeights, int N, int C, int PackedH, int PackedW, int KN, int KH, int KW, int StrideH, int StrideW,
+    const GEMMEpilogue& Epilogue, void* y);
@@ -7,8 +7,8 @@
 // a is activation  in MK: N * OH * OW, KH * kW * C * BITS. (This C has been quantized)
 // b is weights     in NK: KN,          KH * KW * C * BITS 
 // y is conv result in MN: N * OH * OW, KN (the same as N, OH, OW, KN)
-std::vector<int> TNNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K) {
-    std::vector<int> y = std::vector<int>(M * N, 0);
+TabTensor<int> TNNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K) {
+    TabTensor<int> y = TabTensor<int>((size_t)M * N);
     const int KB = K * BITS;
     for (int oh = 0; oh < M; oh++) {
         for (int ow = 0; ow < N; ow++) {
@@ -29,8 +29,8 @@ std::vector<int> TNNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K) {
 
 
 // In M-K, N-K order, TBN, Ternary-Activation Binary-Weight
-std::vector<int> TBNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K) {
-    std::vector<int> y = std::vector<int>(M * N);
+TabTensor<int> TBNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K) {
+    TabTensor<int> y = TabTensor<int>((size_t)M * N);
     for (int oh = 0; oh < M; oh++) {
         for (int ow = 0; ow < N; ow++) {
             int cntp1 = 0;
@@ -50,8 +50,8 @@ std::vector<int> TBNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K) {
 
 
 // In M-K, N-K order, BTN, Binary-Activation Ternary-Weight
-std::vector<int> BTNGEMM_baseline(int64_t* a, int64_t* b, int* cnt1, int M, int N, int K) {
-    std::vector<int> y = std::vector<int>(M * N);
+TabTensor<int> BTNGEMM_baseline(int64_t* a, int64_t* b, int* cnt1, int M, int N, int K) {
+    TabTensor<int> y = TabTensor<int>((size_t)M * N);
     for (int oh = 0; oh < M; oh++) {
         for (int ow = 0; ow < N; ow++) {
             int cntp2 = 0;
@@ -68,8 +68,8 @@ std::vector<int> BTNGEMM_baseline(int64_t* a, int64_t* b, int* cnt1, int M, int
 
 
 // In M-K, N-K order, BNN, Binary-Activation Binary-Weight
-std::vector<int> BNNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K, int NUM) {
-    std::vector<int> y = std::vector<int>(M * N);
+TabTensor<int> BNNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K, int NUM) {
+    TabTensor<int> y = TabTensor<int>((size_t)M * N);
     for (int oh = 0; oh < M; oh++) {
         for (int ow = 0; ow < N; ow++) {
             int cntp1 = 0;
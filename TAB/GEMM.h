@@ -1,15 +1,195 @@
 #pragma once
+#include <cstring>
+#include "Allocator.h"
 
 // TABGEMM: TNN
 // In M-K, N-K order, M-N, 
 // K is the absolute K, it should *BITS to get the real memory boundary
-std::vector<int> TNNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K);
+TabTensor<int> TNNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K);
 
 // In M-K, N-K order, TBN, Ternary-Activation Binary-Weight
-std::vector<int> TBNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K);
+TabTensor<int> TBNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K);
 
 // In M-K, N-K order, BTN, Binary-Activation Ternary-Weight
-std::vector<int> BTNGEMM_baseline(int64_t* a, int64_t* b, int* cnt1, int M, int N, int K);
+TabTensor<int> BTNGEMM_baseline(int64_t* a, int64_t* b, int* cnt1, int M, int N, int K);
 
 // In M-K, N-K order, BNN, Binary-Activation Binary-Weight
-std::vector<int> BNNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K, int NUM);
+TabTensor<int> BNNGEMM_baseline(int64_t* a, int64_t* b, int M, int N, int K, int NUM);
+
+
+// Blocked bitwise GEMM
+// a is packed into MR-row panels, b into NR-row panels. The micro-kernel keeps MR x NR accumulators live,
+// and the MC x NC x KC cache blocks keep the panels in L1/L2.
+
+// Register blocking: MR rows of a (chosen by the micro-kernel) x NR rows of b per micro-kernel call
+#define GEMM_NR 4
+
+// Cache blocking in rows of a (MC), rows of b (NC) and packed words of K (KC)
+// Container: the words of K per container of the packed panels, 1 (int64_t), 2, 4 or 8 (128/256/512 bits).
+// The micro-kernel takes one container per step of its K loop, see TABGEMM_ContainerWords().
+// DotM: GEMMs of fewer rows of a than DotM run the dot kernels (the GEMV engine) instead, 0: fewer than MR.
+struct GEMMBlocking {
+    int MC;
+    int NC;
+    int KC;
+    int Container;
+    int DotM;
+};
+GEMMBlocking GEMM_DefaultBlocking();
+
+// The container for GEMMs of K words (KH * KW * PackedC for a conv) on the instruction set selected by TAB_GetISA()
+// The 512-bit containers of AVX-512 take K >= 128 (e.g. 3x3 convs of C >= 1024), where the longer K steps pay for
+// the 4-row micro-kernel. The others run on the int64_t words.
+int TABGEMM_ContainerWords(int K);
+
+// The epilogue of the write-back: y = PReLU(Scale[n] * conv + Bias[n]), stored as Output
+enum GEMMOutputType {
+    Output_Int32 = 0,   // rounded to the nearest int
+    Output_Float = 1,
+    Output_Ternary = 2, // packed for the next layer: N_H_W_C_B as Ternarize_NCHW_to_NHWCB()
+    Output_Binary = 3,  // packed for the next layer: N_H_W_C as Binarize_NCHW_to_NHWC()
+    // The 16-bit outputs halve the bytes written by the shallow layers (1x1, small C), where the write-back dominates
+    Output_Int16 = 4,   // rounded to the nearest int and saturated, exact for |conv| <= C * KH * KW <= 32767 without scale
+    Output_Half = 5,    // IEEE fp16 (TAB_HalfToFloat()), rounded to the nearest even, exact for |conv| <= 2048
+    Output_BFloat16 = 6 // bfloat16 (TAB_BFloat16ToFloat()), the upper half of the float rounded to the nearest even
+};
+struct GEMMEpilogue {
+    const float* Scale;    // per output channel, NULL: 1
+    const float* Bias;     // per output channel, NULL: 0
+    bool Activation;       // apply PReLU
+    float Alpha;           // the PReLU slope
+    const float* Alphas;   // per output channel PReLU slopes, NULL: Alpha for all
+    GEMMOutputType Output;
+
+    // Output_Ternary / Output_Binary only: the rows m = (n, oh, ow) of y are written into the padded tensor of the next
+    // layer, with a zero border. y = PReLU(...) is quantized against the threshold of its channel:
+    // ternary +1: y > th, -1: y < -th, binary -1: y < th
+    int OH, OW;            // the output image
+    int PaddingH, PaddingW; // the padding of the next layer
+    float Threshold;
+    const float* Thresholds; // per output channel, NULL: Threshold for all
+
+    // Grouped convs: the GEMM writes channels [ChannelOffset, ChannelOffset + N) of the Channels channels of each row
+    // of y (0: N). The per channel pointers above start at channel ChannelOffset. The packed outputs need
+    // ChannelOffset to be a multiple of 64.
+    int Channels, ChannelOffset;
+
+    // Padding-free convs: the conv result of row m is corrected before the epilogue by -Border[c * Channels + j] when
+    // its pixel class c = BorderClass[m % (OH * OW)] is >= 0 (a border pixel), NULL: no correction.
+    // Border starts at channel ChannelOffset, like the per channel pointers above.
+    const int* Border;
+    const int* BorderClass;
+
+    // Residual add ahead of the epilogue: a shortcut is added to the int conv results of row m, before the scale, so
+    // the sum is requantized once (e.g. by a packed output). Both are indexed like y: row m, channel ChannelOffset + j.
+    // Residual: int values (N_OH_OW_Channels), e.g. the Output_Int32 result of a shortcut conv, NULL: none.
+    // ResidualBits: the -1 / 0 / +1 values of a packed tensor, N_(OH + 2 * ResidualPaddingH)_(OW + 2 * ResidualPaddingW)_Channels
+    // as ternary (_B) or binary bits, e.g. the packed input of the block, times ResidualScale. NULL: none.
+    const int* Residual;
+    const int64_t* ResidualBits;
+    bool ResidualTernary;
+    int ResidualPaddingH, ResidualPaddingW;
+    int ResidualScale;
+};
+
+// The conversions of the 16-bit float outputs, round to nearest even
+inline uint16_t TAB_FloatToHalf(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const uint32_t sign = (x >> 16) & 0x8000;
+    x = x & 0x7FFFFFFF;
+    if (x >= 0x7F800000)  // inf, NaN
+        return (uint16_t)(sign | 0x7C00 | ((x > 0x7F800000) ? 0x200 : 0));
+    if (x >= 0x477FF000)  // rounds above 65504
+        return (uint16_t)(sign | 0x7C00);
+    if (x < 0x38800000) {
+        // Subnormal: the FPU rounds |f| + 0.5 to the 2^-24 steps of the half subnormals
+        float a;
+        std::memcpy(&a, &x, sizeof(a));
+        a = a + 0.5f;
+        std::memcpy(&x, &a, sizeof(x));
+        return (uint16_t)(sign | (x - 0x3F000000));
+    }
+    // Rebias the exponent (127 -> 15) and round the mantissa to 10 bits
+    x = x + 0xC8000FFF + ((x >> 13) & 1);
+    return (uint16_t)(sign | (x >> 13));
+}
+
+inline float TAB_HalfToFloat(uint16_t h) {
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t e = (h >> 10) & 0x1F;
+    const uint32_t m = h & 0x3FF;
+    if (e == 0) {
+        const float f = (float)m * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    }
+    const uint32_t x = sign | ((e == 0x1F) ? (0x7F800000 | (m << 13)) : (((e + 112) << 23) | (m << 13)));
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+inline uint16_t TAB_FloatToBFloat16(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7FFFFFFF) > 0x7F800000)  // NaN stays a (quiet) NaN
+        return (uint16_t)((x >> 16) | 0x40);
+    return (uint16_t)((x + 0x7FFF + ((x >> 16) & 1)) >> 16);
+}
+
+inline float TAB_BFloat16ToFloat(uint16_t h) {
+    const uint32_t x = (uint32_t)h << 16;
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// The bytes of y for an M x N GEMM with the epilogue (NULL: int results)
+size_t TABGEMM_OutputBytes(const GEMMEpilogue* Epilogue, int M, int N);
+
+// Apply the epilogue to the int conv results (M, N) of any GEMM
+void TABGEMM_Epilogue(const GEMMEpilogue& Epilogue, const int* conv, int M, int N, void* y);
+
+// The same for the rows [m0, m0 + rows) in conv, on the calling thread. The padding border of a packed output is
+// left to TABGEMM_ZeroOutputBorder().
+void TABGEMM_EpilogueRows(const GEMMEpilogue& Epilogue, const int* conv, int m0, int rows, int N, void* y);
+void TABGEMM_ZeroOutputBorder(const GEMMEpilogue& Epilogue, int M, int N, void* y);
+
+// The epilogue of a GEMM whose row 0 is row oh of image n of an OH x OW output of N channels (the Channels of a grouped
+// conv), e.g. one image of a batch: the residual pointers advanced to that row, as the GEMM indexes them from its row 0
+GEMMEpilogue TABGEMM_ResidualFrom(const GEMMEpilogue& Epilogue, int OH, int OW, int N, int n, int oh);
+
+// Blocked GEMM of any ConvType, y must hold M * N values
+// Epilogue: applied to each tile at the write-back, NULL stores the int conv results
+// cnt1 is only used by BTN, NUM is only used by BNN
+// Workspace: 64-byte aligned scratch memory of TABGEMM_Blocked_WorkspaceSize() bytes, or NULL to allocate it per call.
+// The size depends on the thread count and the ISA at the time of the call.
+// bp: b prepacked by TABGEMM_PackB_Into(), or NULL to pack it per call (PackedB = false)
+void TABGEMM_Blocked(ConvType TYPE, const int64_t* a, const int64_t* b, const int* cnt1, void* y, int M, int N, int K, int NUM, GEMMBlocking Blocking, void* Workspace = NULL, const int64_t* bp = NULL, const GEMMEpilogue* Epilogue = NULL);
+size_t TABGEMM_Blocked_WorkspaceSize(ConvType TYPE, int M, int N, int K, GEMMBlocking Blocking, bool PackedB = false);
+
+// Prepack b (the weights) into the NR-row panels of the micro-kernels, bp must hold TABGEMM_PackedBWords() words
+// The GEMMs that read bp must use the same Container in their blocking.
+size_t TABGEMM_PackedBWords(ConvType TYPE, int N, int K, int Container = 1);
+void TABGEMM_PackB_Into(ConvType TYPE, const int64_t* b, int N, int K, int64_t* bp, int Container = 1);
+
+// Implicit GEMM: the rows of a are read from the padded NHWC(B) activations, no Img2Row matrix is built.
+// Row m = (n, oh, ow) and word k = (kh, kw, c) of a is x[n, oh * StrideH + kh, ow * StrideW + kw, c],
+// so M = N * OH * OW and K = KH * KW * PackedC, as in Img2Row_NHWCB_to_N_OHOW_KHKWC().
+struct GEMMConvShape {
+    int N;                // batch size
+    int PackedH, PackedW; // the padded input
+    int PaddingH, PaddingW; // the border of the padded input that x does not store (read as 0 words), 0: all stored
+    int PackedC;          // the packed channels, in words per plane
+    int KH, KW;
+    int StrideH, StrideW;
+    int OH, OW;
+};
+void TABGEMM_Implicit(ConvType TYPE, const int64_t* x, const GEMMConvShape& Shape, const int64_t* b, const int* cnt1, void* y, int N, int NUM, GEMMBlocking Blocking, void* Workspace = NULL, const int64_t* bp = NULL, const GEMMEpilogue* Epilogue = NULL);
+size_t TABGEMM_Implicit_WorkspaceSize(ConvType TYPE, const GEMMConvShape& Shape, int N, GEMMBlocking Blocking, bool PackedB = false);
+
+// Same interfaces as the baselines
+TabTensor<int> TNNGEMM_blocked(int64_t* a, int64_t* b, int M, int N, int K);
+TabTensor<int> TBNGEMM_blocked(int64_t* a, int64_t* b, int M, int N, int K);
+TabTensor<int> BTNGEMM_blocked(int64_t* a, int64_t* b, int* cnt1, int M, int N, int K);
+TabTensor<int> BNNGEMM_blocked(int64_t* a, int64_t* b, int M, int N, int K, int NUM);
@@ -0,0 +1,811 @@
+#include "common.h"
+#include "GEMM.h"
+#include "GEMM_Kernels.h"
+#include "ThreadPool.h"
+#include "CPUFeatures.h"
+#include "ConvShape.h"
+#include <cmath>
+
+// Blocked bitwise GEMM
+// Loop nest (BLIS style):
+//   b is packed once into NR-row panels over the full K
+//   for each MC x NC tile of y:
+//     for each KC block of K:  pack MC rows of a into MR-row panels
+//       for each NR panel:     (stays in L1)
+//         for each MR panel:   micro-kernel, MR x NR raw counts accumulated in the tile buffer
+//     write-back: raw counts -> conv results -> epilogue (scale, bias, PReLU, output type) -> y
+// The MC x NC tiles are independent and run on the thread pool, each thread with its own a block and tile buffer.
+// GEMMs with fewer rows than MR run the dot kernels instead, on the unpacked rows, split into column chunks.
+// The implicit GEMM runs the same loop nest, its a blocks are packed straight from the conv input.
+
+GEMMBlocking GEMM_DefaultBlocking() {
+    GEMMBlocking Blocking;
+    Blocking.MC = 64;   // a block: 64 rows x 256 words x 2 planes = 256 KB, L2
+    Blocking.NC = 256;  // accumulator tile: 64 x 256 ints = 64 KB, L2
+    Blocking.KC = 256;  // a and b micro-panels: (4 + 4) x 256 words x 2 planes = 32 KB, L1
+    Blocking.Container = 1;
+    Blocking.DotM = 0;
+    return Blocking;
+}
+
+
+int TABGEMM_ContainerWords(int K) {
+    if ((TAB_GetISA() == ISA_AVX512) && (K >= 128))
+        return 8;
+    return 1;
+}
+
+// The most columns of y per dot kernel tile
+#define GEMM_DOT_NC 256
+// Columns per pass of the border correction of a padding-free conv and of the residual add, a multiple of 64
+#define GEMM_BORDER_NC 256
+// Columns per conversion of the int and 16-bit outputs
+#define GEMM_CONVERT_NC 64
+// Weight rows per dot kernel call when several rows of a share them
+#define GEMM_DOT_NB 8
+// NR panels of b per packing tile
+#define GEMM_PACK_PANELS 16
+
+
+static inline int RoundUp(int x, int r) {
+    return (x + r - 1) / r * r;
+}
+
+
+// The offset of word k of plane p of a row in a panel of PR rows and containers of V words, from word 0 of the row
+static inline int64_t PanelWord(int k, int p, int P, int PR, int V) {
+    return ((int64_t)(k / V * P + p) * PR) * V + k % V;
+}
+
+
+// Copy the words [k, k + len) of P planes of one row into its panel of PR rows and V-word containers:
+// s[(i * P + p)] -> d[PanelWord(k + i, p)], with V = 1: d[((k + i) * P + p) * PR]
+// cnt (optional) accumulates the popcount of plane 1. PT: the planes as a constant (0: P)
+template <int PT = 0>
+static inline void PackRow(const int64_t* s, int k, int len, int P_, int PR, int V, int64_t* d, int* cnt) {
+    const int P = ShapeDim<PT>(P_);
+    if (V == 1) {
+        d += (int64_t)k * P * PR;
+        for (int i = 0; i < len * P; i++)
+            d[i * PR] = s[i];
+    }
+    else {
+        // Container by container: the words of a plane are contiguous within one
+        for (int i = 0; i < len;) {
+            const int w = (k + i) % V;
+            const int n = (V - w < len - i) ? (V - w) : (len - i);
+            int64_t* dk = d + PanelWord(k + i, 0, P, PR, V);
+            for (int p = 0; p < P; p++)
+                for (int j = 0; j < n; j++)
+                    dk[(int64_t)p * PR * V + j] = s[(i + j) * P + p];
+            i += n;
+        }
+    }
+    if (cnt) {
+        for (int i = 0; i < len; i++)
+            *cnt += (int)popcnt64(s[i * P + 1]);
+    }
+}
+
+
+// Zero the words [k0, k1) of P planes of one row in its panel
+static inline void ZeroRow(int k0, int k1, int P, int PR, int V, int64_t* d) {
+    for (int k = k0; k < k1; k++)
+        for (int p = 0; p < P; p++)
+            d[PanelWord(k, p, P, PR, V)] = 0;
+}
+
+
+// Pack the rows [r0, r0 + rows) and words [k0, k0 + kc) of a row-major (R, K, P) matrix into panels of PR rows
+// and V-word containers, kc padded to kcp = RoundUp(kc, V) with 0 words:
+// src[(r * K + k) * P + p] -> dst[(r - r0) / PR * kcp * P * PR + (r - r0) % PR * V + PanelWord(k - k0, p)]
+// Rows beyond `rows` up to the next panel boundary are zero filled.
+// rowcnt (optional) accumulates the popcount of plane 1 of each row, which is the TBN base.
+static void PackPanels(const int64_t* src, int K, int P, int r0, int rows, int k0, int kc, int PR, int V, int64_t* dst, int* rowcnt) {
+    const int paddedRows = RoundUp(rows, PR);
+    const int kcp = RoundUp(kc, V);
+    for (int r = 0; r < paddedRows; r++) {
+        int64_t* d = dst + (int64_t)(r / PR) * kcp * P * PR + r % PR * V;
+        if (r >= rows) {
+            ZeroRow(0, kcp, P, PR, V, d);
+            continue;
+        }
+        PackRow(src + ((int64_t)(r0 + r) * K + k0) * P, 0, kc, P, PR, V, d, rowcnt ? (rowcnt + r) : NULL);
+        ZeroRow(kc, kcp, P, PR, V, d);
+    }
+}
+
+
+// The words [k0, k0 + kc) of a row at input pixel (ih, iw) of a padding-free input, word by word: the taps outside
+// the stored xh x xw image are 0 words
+static void PackRowBorder(const int64_t* x, const GEMMConvShape& s, int P, int xh, int xw, int n, int ih, int iw, int k0, int kc, int PR, int V, int64_t* d, int* cnt) {
+    for (int k = 0; k < kc; k++) {
+        const int tap = (k0 + k) / s.PackedC;
+        const int c = (k0 + k) % s.PackedC;
+        const int h = ih + tap / s.KW;
+        const int w = iw + tap % s.KW;
+        const bool inside = (h >= 0) && (h < xh) && (w >= 0) && (w < xw);
+        const int64_t* src = x + ((((int64_t)n * xh + h) * xw + w) * s.PackedC + c) * P;
+        for (int p = 0; p < P; p++)
+            d[PanelWord(k, p, P, PR, V)] = inside ? src[p] : 0;
+        if (cnt && inside)
+            *cnt += (int)popcnt64(src[1]);
+    }
+}
+
+
+// Same as PackPanels(), with the rows read from the padded NHWC(B) activations x of the implicit GEMM
+// For each kh, the words (kw, c) of a row are KW * PackedC contiguous words of x.
+// A padding-free x (s.PaddingH / s.PaddingW) only stores the image: the rows of the border pixels read their taps
+// one word at a time.
+// P planes, the window of the shape S (see ConvShape.h): the common shapes copy whole rows in KH constant segments.
+template <int P, class S>
+static void PackPanelsConv(const int64_t* x, const GEMMConvShape& s, int r0, int rows, int k0, int kc, int PR, int V, int64_t* dst, int* rowcnt) {
+    const int KH = ShapeDim<S::KH>(s.KH);
+    const int KW = ShapeDim<S::KW>(s.KW);
+    const int StrideH = ShapeDim<S::StrideH>(s.StrideH);
+    const int StrideW = ShapeDim<S::StrideW>(s.StrideW);
+    const int segment = KW * s.PackedC;
+    const bool whole = (k0 == 0) && (kc == KH * segment);
+    const int xh = s.PackedH - 2 * s.PaddingH;  // the stored image
+    const int xw = s.PackedW - 2 * s.PaddingW;
+    const int paddedRows = RoundUp(rows, PR);
+    const int kcp = RoundUp(kc, V);
+    // The pixel of row r0, then stepped row by row
+    int n = r0 / (s.OH * s.OW);
+    int oh = r0 / s.OW % s.OH;
+    int ow = r0 % s.OW;
+    for (int r = 0; r < paddedRows; r++) {
+        int64_t* d = dst + (int64_t)(r / PR) * kcp * P * PR + r % PR * V;
+        if (r >= rows) {
+            ZeroRow(0, kcp, P, PR, V, d);
+            continue;
+        }
+        ZeroRow(kc, kcp, P, PR, V, d);
+        const int ih = oh * StrideH - s.PaddingH;
+        const int iw = ow * StrideW - s.PaddingW;
+        int* cnt = rowcnt ? (rowcnt + r) : NULL;
+        if ((ih < 0) || (ih + KH > xh) || (iw < 0) || (iw + KW > xw)) {
+            PackRowBorder(x, s, P, xh, xw, n, ih, iw, k0, kc, PR, V, d, cnt);
+        }
+        else {
+            // x[n, ih, iw, 0]
+            const int64_t* base = x + (((int64_t)n * xh + ih) * xw + iw) * s.PackedC * P;
+            if (whole) {
+                for (int kh = 0; kh < KH; kh++)
+                    PackRow<P>(base + (int64_t)kh * xw * s.PackedC * P, kh * segment, segment, P, PR, V, d, cnt);
+            }
+            else {
+                int kh = k0 / segment;
+                int j = k0 % segment;
+                for (int k = 0; k < kc; kh++, j = 0) {
+                    const int len = (segment - j < kc - k) ? (segment - j) : (kc - k);
+                    PackRow<P>(base + ((int64_t)kh * xw * s.PackedC + j) * P, k, len, P, PR, V, d, cnt);
+                    k += len;
+                }
+            }
+        }
+        if (++ow == s.OW) {
+            ow = 0;
+            if (++oh == s.OH) {
+                oh = 0;
+                n++;
+            }
+        }
+    }
+}
+
+typedef void (*GEMMConvPackFn)(const int64_t* x, const GEMMConvShape& s, int r0, int rows, int k0, int kc, int PR, int V, int64_t* dst, int* rowcnt);
+
+// The PackPanelsConv() instance of P planes and the window of s
+static GEMMConvPackFn GEMM_GetConvPacker(int P, const GEMMConvShape& s) {
+    GEMMConvPackFn fn = NULL;
+    TAB_DispatchConvShape(s.KH, s.KW, s.StrideH, s.StrideW, [&](auto shape) {
+        typedef decltype(shape) S;
+        fn = (P > 1) ? PackPanelsConv<2, S> : PackPanelsConv<1, S>;
+    });
+    return fn;
+}
+
+
+struct GEMMContext {
+    ConvType TYPE;
+    const int64_t* a;
+    const GEMMConvShape* conv;  // not NULL: a is the activations of an implicit GEMM
+    GEMMConvPackFn packConv;    // its a packing, specialized on the window
+    const int64_t* bp;  // packed b
+    bool packB;         // b is packed by the call (not prepacked)
+    const int* cnt1;
+    void* y;
+    const GEMMEpilogue* ep;  // NULL: int conv results
+    int M, N, K, NUM;
+    int PA, PB;
+    int MC, NC, KC;
+    int dotM;           // fewer rows run the dot kernels
+    int V;              // the words of a panel container
+    int KP;             // K padded to whole containers
+    GEMMMicroKernel uk;
+};
+
+
+static inline bool GEMM_PackedOutput(const GEMMEpilogue* ep) {
+    return ep && ((ep->Output == Output_Ternary) || (ep->Output == Output_Binary));
+}
+
+
+// The epilogue value of conv result c of output channel j (the scale, bias and slope pointers start at channel 0)
+static inline float GEMM_EpilogueValue(const GEMMEpilogue& ep, int c, int j) {
+    float v = (float)c;
+    if (ep.Scale)
+        v = v * ep.Scale[j];
+    if (ep.Bias)
+        v = v + ep.Bias[j];
+    if (ep.Activation && !(v > 0))
+        v = v * (ep.Alphas ? ep.Alphas[j] : ep.Alpha);
+    return v;
+}
+
+
+// The epilogue values of the conv results conv[0 : n] of the output channels jc : jc + n into v
+// One pass per step, so every loop vectorizes. The same values as GEMM_EpilogueValue().
+static inline void GEMM_EpilogueValues(const GEMMEpilogue& ep, const int* conv, int jc, int n, float* v) {
+    for (int j = 0; j < n; j++)
+        v[j] = (float)conv[j];
+    if (ep.Scale) {
+        const float* scale = ep.Scale + jc;
+        for (int j = 0; j < n; j++)
+            v[j] = v[j] * scale[j];
+    }
+    if (ep.Bias) {
+        const float* bias = ep.Bias + jc;
+        for (int j = 0; j < n; j++)
+            v[j] = v[j] + bias[j];
+    }
+    if (ep.Activation && ep.Alphas) {
+        const float* alphas = ep.Alphas + jc;
+        for (int j = 0; j < n; j++)
+            v[j] = (v[j] > 0) ? v[j] : (v[j] * alphas[j]);
+    }
+    else if (ep.Activation) {
+        const float alpha = ep.Alpha;
+        for (int j = 0; j < n; j++)
+            v[j] = (v[j] > 0) ? v[j] : (v[j] * alpha);
+    }
+}
+
+
+// The epilogue values v[0 : n] in the int or 16-bit Output type
+static inline void GEMM_ConvertValues(GEMMOutputType Output, const float* v, int n, void* out) {
+    switch (Output) {
+    case Output_Int32:
+        for (int j = 0; j < n; j++)
+            ((int*)out)[j] = (int)std::lrintf(v[j]);
+        break;
+    case Output_Int16:
+        // Saturate, then round to the nearest even
+        for (int j = 0; j < n; j++) {
+            const float x = (v[j] < -32768.0f) ? -32768.0f : ((v[j] > 32767.0f) ? 32767.0f : v[j]);
+            ((int16_t*)out)[j] = (int16_t)std::lrintf(x);
+        }
+        break;
+    case Output_Half:
+        GEMM_GetFloatToHalf()(v, (uint16_t*)out, n);
+        break;
+    default:
+        for (int j = 0; j < n; j++)
+            ((uint16_t*)out)[j] = TAB_FloatToBFloat16(v[j]);
+        break;
+    }
+}
+
+
+// The channels of a row of y: N, or the Channels of a grouped conv
+static inline int GEMM_OutputChannels(const GEMMEpilogue* ep, int N) {
+    return (ep && ep->Channels) ? ep->Channels : N;
+}
+
+
+// The border correction of row m of a padding-free conv (indexed by the channel of the GEMM), NULL: none
+static inline const int* GEMM_Border(const GEMMEpilogue* ep, int m, int YN) {
+    if (!ep || !ep->Border)
+        return NULL;
+    const int c = ep->BorderClass[m % (ep->OH * ep->OW)];
+    return (c < 0) ? NULL : (ep->Border + (int64_t)c * YN);
+}
+
+
+// The residual of row m, output channels c0 : c0 + n of the row (ChannelOffset included), added to v
+static inline void GEMM_AddResidual(const GEMMEpilogue& ep, int m, int c0, int n, int YN, int* v) {
+    if (ep.Residual) {
+        const int* r = ep.Residual + (int64_t)m * YN + c0;
+        for (int j = 0; j < n; j++)
+            v[j] += r[j];
+    }
+    if (ep.ResidualBits) {
+        const int P = ep.ResidualTernary ? BITS : 1;
+        const int packN = (YN + cntbits - 1) / cntbits;
+        const int image = m / (ep.OH * ep.OW);
+        const int oh = m / ep.OW % ep.OH;
+        const int ow = m % ep.OW;
+        const int64_t* x = ep.ResidualBits + (((int64_t)image * (ep.OH + 2 * ep.ResidualPaddingH) + oh + ep.ResidualPaddingH) * (ep.OW + 2 * ep.ResidualPaddingW) + ow + ep.ResidualPaddingW) * packN * P;
+        for (int j = 0; j < n; j++) {
+            const int c = c0 + j;
+            const int64_t* w = x + (c / cntbits) * P;
+            const int bit = c % cntbits;
+            int value;
+            if (ep.ResidualTernary)
+                value = ((w[1] >> bit) & 1) ? (((w[0] >> bit) & 1) ? -1 : 1) : 0;
+            else
+                value = ((w[0] >> bit) & 1) ? -1 : 1;
+            v[j] += ep.ResidualScale * value;
+        }
+    }
+}
+
+
+// conv results of row m -> epilogue -> y[m, jc : jc + nc], conv[j] is output channel jc + j
+// Without an epilogue y holds the int conv results.
+// The packed outputs need ChannelOffset + jc to be a multiple of cntbits (see GEMM_Init()), so every word is written
+// by one tile.
+static inline void GEMM_StoreRow(const GEMMEpilogue* ep, const int* conv, int m, int jc, int nc, int N, void* y) {
+    const int YN = GEMM_OutputChannels(ep, N);
+    const int64_t offset = (int64_t)m * YN + (ep ? ep->ChannelOffset : 0) + jc;
+    const int* border = GEMM_Border(ep, m, YN);
+    int corrected[GEMM_BORDER_NC];
+    if (border || (ep && (ep->Residual || ep->ResidualBits))) {
+        // Border pixels of a padding-free conv: without the weights on the out-of-bounds taps, then the residual
+        for (int j0 = 0; j0 < nc; j0 += GEMM_BORDER_NC) {
+            const int len = (nc - j0 < GEMM_BORDER_NC) ? (nc - j0) : GEMM_BORDER_NC;
+            for (int j = 0; j < len; j++)
+                corrected[j] = conv[j0 + j] - (border ? border[jc + j0 + j] : 0);
+            GEMM_AddResidual(*ep, m, ep->ChannelOffset + jc + j0, len, YN, corrected);
+            GEMMEpilogue inner = *ep;
+            inner.Border = NULL;
+            inner.Residual = NULL;
+            inner.ResidualBits = NULL;
+            GEMM_StoreRow(&inner, corrected, m, jc + j0, len, N, y);
+        }
+        return;
+    }
+    if (!ep) {
+        int* out = (int*)y + offset;
+        for (int j = 0; j < nc; j++)
+            out[j] = conv[j];
+        return;
+    }
+    switch (ep->Output) {
+    case Output_Float:
+        GEMM_EpilogueValues(*ep, conv, jc, nc, (float*)y + offset);
+        break;
+    case Output_Int32:
+    case Output_Int16:
+    case Output_Half:
+    case Output_BFloat16: {
+        // The floats of a chunk, converted at once
+        const size_t bytes = (ep->Output == Output_Int32) ? 4 : 2;
+        float v[GEMM_CONVERT_NC];
+        for (int j0 = 0; j0 < nc; j0 += GEMM_CONVERT_NC) {
+            const int len = (nc - j0 < GEMM_CONVERT_NC) ? (nc - j0) : GEMM_CONVERT_NC;
+            GEMM_EpilogueValues(*ep, conv + j0, jc + j0, len, v);
+            GEMM_ConvertValues(ep->Output, v, len, (char*)y + (offset + j0) * bytes);
+        }
+        break;
+    }
+    default: {
+        // Quantize for the next layer, as Ternarize_NCHW_to_NHWCB() / Binarize_NCHW_to_NHWC() would
+        const bool Ternary = (ep->Output == Output_Ternary);
+        const int P = Ternary ? BITS : 1;
+        const int packN = (YN + cntbits - 1) / cntbits;
+        const int n = m / (ep->OH * ep->OW);
+        const int oh = m / ep->OW % ep->OH;
+        const int ow = m % ep->OW;
+        int64_t* out = (int64_t*)y + ((((int64_t)n * (ep->OH + 2 * ep->PaddingH) + oh + ep->PaddingH) * (ep->OW + 2 * ep->PaddingW) + ow + ep->PaddingW) * packN + (ep->ChannelOffset + jc) / cntbits) * P;
+        const int64_t one = 1;
+        for (int w = 0; w * cntbits < nc; w++) {
+            const int bits = (nc - w * cntbits < cntbits) ? (nc - w * cntbits) : cntbits;
+            int64_t p1 = 0;
+            int64_t p2 = 0;
+            for (int bit = 0; bit < bits; bit++) {
+                const int j = jc + w * cntbits + bit;
+                const float v = GEMM_EpilogueValue(*ep, conv[w * cntbits + bit], j);
+                const float th = ep->Thresholds ? ep->Thresholds[j] : ep->Threshold;
+                if (Ternary) {
+                    if (v > th) {
+                        p2 = p2 | (one << bit);
+                    }
+                    else if (v < (-th)) {
+                        p1 = p1 | (one << bit);
+                        p2 = p2 | (one << bit);
+                    }
+                }
+                else if (v < th) {
+                    p1 = p1 | (one << bit);
+                }
+            }
+            out[w * P] = p1;
+            if (Ternary)
+                out[w * P + 1] = p2;
+        }
+        break;
+    }
+    }
+}
+
+
+// Zero the padding border of a packed output, the tiles only write the interior
+static void GEMM_ZeroPackedBorder(const GEMMEpilogue& ep, int M, int N, void* y) {
+    const int P = (ep.Output == Output_Ternary) ? BITS : 1;
+    const int pixel = (GEMM_OutputChannels(&ep, N) + cntbits - 1) / cntbits * P;
+    const int packH = ep.OH + 2 * ep.PaddingH;
+    const int packW = ep.OW + 2 * ep.PaddingW;
+    const int images = M / (ep.OH * ep.OW);
+    if ((ep.PaddingH == 0) && (ep.PaddingW == 0))
+        return;
+    TAB_ParallelFor(images * packH, [&](int tile, int tid) {
+        const int ph = tile % packH;
+        int64_t* row = (int64_t*)y + (int64_t)tile * packW * pixel;
+        if ((ph < ep.PaddingH) || (ph >= ep.PaddingH + ep.OH)) {
+            for (int i = 0; i < packW * pixel; i++)
+                row[i] = 0;
+            return;
+        }
+        for (int i = 0; i < ep.PaddingW * pixel; i++) {
+            row[i] = 0;
+            row[(ep.PaddingW + ep.OW) * pixel + i] = 0;
+        }
+    });
+}
+
+
+// raw counts of row m -> conv results (in place) -> y[m, jc : jc + nc]
+static inline void GEMM_WriteBack(const GEMMContext& ctx, int m, int jc, int nc, int* raw, int rowcnt) {
+    switch (ctx.TYPE) {
+    case ConvType::TNN:
+        break;
+    case ConvType::TBN:
+        for (int j = 0; j < nc; j++)
+            raw[j] = rowcnt - 2 * raw[j];
+        break;
+    case ConvType::BTN:
+        for (int j = 0; j < nc; j++)
+            raw[j] = ctx.cnt1[jc + j] - 2 * raw[j];
+        break;
+    default:
+        for (int j = 0; j < nc; j++)
+            raw[j] = ctx.NUM - 2 * raw[j];
+        break;
+    }
+    GEMM_StoreRow(ctx.ep, raw, m, jc, nc, ctx.N, ctx.y);
+}
+
+
+// Compute the tile y[ic : ic + MC, jc : jc + NC]
+// ap, acc and rowcnt are the scratch buffers of the caller, sized for one MC x NC tile
+static void GEMM_Tile(const GEMMContext& ctx, int ic, int jc, int64_t* ap, int* acc, int* rowcnt) {
+    const int MR = ctx.uk.MR;
+    const int mc = (ctx.M - ic < ctx.MC) ? (ctx.M - ic) : ctx.MC;
+    const int nc = (ctx.N - jc < ctx.NC) ? (ctx.N - jc) : ctx.NC;
+    const int mcp = RoundUp(mc, MR);
+    const int ncp = RoundUp(nc, GEMM_NR);
+    const int LDC = ctx.NC;
+
+    for (int i = 0; i < mcp * LDC; i++)
+        acc[i] = 0;
+    for (int i = 0; i < mcp; i++)
+        rowcnt[i] = 0;
+
+    for (int pc = 0; pc < ctx.K; pc += ctx.KC) {
+        const int kc = (ctx.K - pc < ctx.KC) ? (ctx.K - pc) : ctx.KC;
+        const int kcp = RoundUp(kc, ctx.V);
+        int* cnt = (ctx.TYPE == ConvType::TBN) ? rowcnt : NULL;
+        if (ctx.conv)
+            ctx.packConv(ctx.a, *ctx.conv, ic, mc, pc, kc, MR, ctx.V, ap, cnt);
+        else
+            PackPanels(ctx.a, ctx.K, ctx.PA, ic, mc, pc, kc, MR, ctx.V, ap, cnt);
+
+        for (int jr = 0; jr < ncp; jr += GEMM_NR) {
+            // b panels are packed over the full padded K, the KC block starts at word pc (a whole container)
+            const int64_t* bpanel = ctx.bp + ((int64_t)(jc + jr) * ctx.KP + (int64_t)pc * GEMM_NR) * ctx.PB;
+            for (int ir = 0; ir < mcp; ir += MR) {
+                ctx.uk.Kernel(kcp, ap + ir * ctx.PA * kcp, bpanel, acc + ir * LDC + jr, LDC);
+            }
+        }
+    }
+
+    // Write-back: raw counts -> conv results -> epilogue, while the tile is still in cache
+    for (int i = 0; i < mc; i++)
+        GEMM_WriteBack(ctx, ic + i, jc, nc, acc + i * LDC, rowcnt[i]);
+}
+
+
+// The scratch buffers of one GEMM, carved from the workspace by GEMM_Layout()
+struct GEMMScratch {
+    int64_t* bp;    // packed b
+    int64_t* ap;    // a block of each thread
+    int* acc;       // tile buffer of each thread
+    int* rowcnt;    // TBN row counts of each thread (dot path: of each row)
+    int* raw;       // dot path: raw counts of each thread
+    int64_t* rows;  // implicit dot path: the gathered rows of a
+};
+
+
+// M, N, K and the ISA decide the path and the blocking, T is the number of threads that get scratch buffers
+// bp: the prepacked b, or NULL when the call packs b. PackB tells the same to the size queries, which have no b.
+static void GEMM_Init(GEMMContext& ctx, ConvType TYPE, const int64_t* a, const GEMMConvShape* conv, const int64_t* bp, bool PackB, const int* cnt1, void* y, const GEMMEpilogue* ep, int M, int N, int K, int NUM, GEMMBlocking Blocking, int T) {
+    ctx.TYPE = TYPE;
+    ctx.a = a;
+    ctx.conv = conv;
+    ctx.packConv = conv ? GEMM_GetConvPacker(GEMM_PlanesA(TYPE), *conv) : NULL;
+    ctx.bp = bp;
+    ctx.packB = PackB;
+    ctx.cnt1 = cnt1;
+    ctx.y = y;
+    ctx.ep = ep;
+    ctx.M = M;
+    ctx.N = N;
+    ctx.K = K;
+    ctx.NUM = NUM;
+    ctx.PA = GEMM_PlanesA(TYPE);
+    ctx.PB = GEMM_PlanesB(TYPE);
+    ctx.V = (Blocking.Container > 1) ? Blocking.Container : 1;
+    ctx.KP = RoundUp(K, ctx.V);
+    ctx.uk = GEMM_GetMicroKernel(TYPE, ctx.V);
+    ctx.MC = RoundUp((Blocking.MC > ctx.uk.MR) ? Blocking.MC : ctx.uk.MR, ctx.uk.MR);
+    ctx.NC = RoundUp((Blocking.NC > GEMM_NR) ? Blocking.NC : GEMM_NR, GEMM_PackedOutput(ep) ? cntbits : GEMM_NR);
+    ctx.KC = RoundUp((Blocking.KC > 1) ? Blocking.KC : 1, ctx.V);
+    ctx.dotM = (Blocking.DotM > ctx.uk.MR) ? Blocking.DotM : ctx.uk.MR;
+
+    // Smaller row blocks until every thread gets about two tiles
+    const int ntn = (N + ctx.NC - 1) / ctx.NC;
+    while ((ctx.MC > ctx.uk.MR) && ((M + ctx.MC - 1) / ctx.MC * ntn < 2 * T))
+        ctx.MC = RoundUp(ctx.MC / 2, ctx.uk.MR);
+}
+
+
+// Fewer rows than one micro-panel (FC layers at small batch), or than the tuned DotM: vectorize along K instead
+static inline bool GEMM_IsDot(const GEMMContext& ctx) {
+    return ctx.M < ctx.dotM;
+}
+
+
+// Reserve count elements of size bytes at 64-byte aligned offsets
+static inline void* Carve(char* base, size_t& offset, size_t count, size_t size) {
+    void* p = base ? (void*)(base + offset) : NULL;
+    offset += (count * size + 63) / 64 * 64;
+    return p;
+}
+
+
+// Lay out the scratch buffers of ctx for T threads in the workspace base (NULL: only count), returns the bytes
+// The panels are sized for the largest container, so the same workspace serves every container.
+static size_t GEMM_Layout(const GEMMContext& ctx, int T, char* base, GEMMScratch& s) {
+    size_t offset = 0;
+    s.bp = s.ap = s.rows = NULL;
+    s.acc = s.rowcnt = s.raw = NULL;
+    if (GEMM_IsDot(ctx)) {
+        s.rowcnt = (int*)Carve(base, offset, ctx.M, sizeof(int));
+        s.raw = (int*)Carve(base, offset, (size_t)T * ctx.M * GEMM_DOT_NC, sizeof(int));
+        if (ctx.conv)
+            s.rows = (int64_t*)Carve(base, offset, (size_t)ctx.M * ctx.K * ctx.PA, sizeof(int64_t));
+    }
+    else {
+        if (ctx.packB)
+            s.bp = (int64_t*)Carve(base, offset, (size_t)RoundUp(ctx.N, GEMM_NR) * ctx.PB * RoundUp(ctx.K, GEMM_MAX_CONTAINER), sizeof(int64_t));
+        s.ap = (int64_t*)Carve(base, offset, (size_t)T * ctx.MC * ctx.PA * RoundUp(ctx.KC, GEMM_MAX_CONTAINER), sizeof(int64_t));
+        s.acc = (int*)Carve(base, offset, (size_t)T * ctx.MC * ctx.NC, sizeof(int));
+        s.rowcnt = (int*)Carve(base, offset, (size_t)T * ctx.MC, sizeof(int));
+    }
+    return offset;
+}
+
+
+static void GEMM_RunDot(GEMMContext& ctx, const int64_t* b, const GEMMScratch& s) {
+    const int M = ctx.M, N = ctx.N, K = ctx.K;
+    // The dot kernels read whole rows: gather the few rows of an implicit GEMM (M < MR)
+    if (ctx.conv) {
+        ctx.packConv(ctx.a, *ctx.conv, 0, M, 0, K, 1, 1, s.rows, NULL);
+        ctx.a = s.rows;
+        ctx.conv = NULL;
+    }
+    const int64_t* a = ctx.a;
+    const GEMMDotKernelFn dot = GEMM_GetDotKernel(ctx.TYPE);
+    for (int m = 0; m < M; m++) {
+        s.rowcnt[m] = 0;
+        if (ctx.TYPE == ConvType::TBN) {
+            for (int k = 0; k < K; k++)
+                s.rowcnt[m] += (int)popcnt64(a[((int64_t)m * K + k) * BITS + 1]);
+        }
+    }
+
+    // The GEMV engine: every tile owns a chunk of the output neurons and streams their weight rows from memory once,
+    // in groups of GEMM_DOT_NB rows that stay in cache while each of the M rows of a (in L1) passes over them.
+    // About 4 chunks per thread, in whole words for the packed outputs.
+    const int T = TAB_GetNumThreads();
+    int NCD = RoundUp((N + 4 * T - 1) / (4 * T), cntbits);
+    NCD = (NCD < GEMM_DOT_NC) ? NCD : GEMM_DOT_NC;
+    const int ntn = (N + NCD - 1) / NCD;
+    TAB_ParallelFor(ntn, [&](int tile, int tid) {
+        const int jc = tile * NCD;
+        const int nc = (N - jc < NCD) ? (N - jc) : NCD;
+        int* rawt = s.raw + (int64_t)tid * M * GEMM_DOT_NC;
+        for (int j = 0; j < nc; j += GEMM_DOT_NB) {
+            const int nb = (nc - j < GEMM_DOT_NB) ? (nc - j) : GEMM_DOT_NB;
+            for (int m = 0; m < M; m++)
+                dot(K, a + (int64_t)m * K * ctx.PA, b + (int64_t)(jc + j) * K * ctx.PB, nb, rawt + m * GEMM_DOT_NC + j);
+        }
+        for (int m = 0; m < M; m++)
+            GEMM_WriteBack(ctx, m, jc, nc, rawt + m * GEMM_DOT_NC, s.rowcnt[m]);
+    });
+}
+
+
+static void GEMM_Run(GEMMContext& ctx, const int64_t* b, const GEMMScratch& s) {
+    const int M = ctx.M, N = ctx.N, K = ctx.K;
+
+    // b is small (the weights) and reused by every tile: pack it once over the full K, unless it is prepacked
+    if (ctx.packB) {
+        TABGEMM_PackB_Into(ctx.TYPE, b, N, K, s.bp, ctx.V);
+        ctx.bp = s.bp;
+    }
+
+    const int ntm = (M + ctx.MC - 1) / ctx.MC;
+    const int ntn = (N + ctx.NC - 1) / ctx.NC;
+    TAB_ParallelFor(ntm * ntn, [&](int tile, int tid) {
+        const int ic = tile / ntn * ctx.MC;
+        const int jc = tile % ntn * ctx.NC;
+        GEMM_Tile(ctx, ic, jc, s.ap + (int64_t)tid * ctx.MC * ctx.PA * RoundUp(ctx.KC, GEMM_MAX_CONTAINER), s.acc + (int64_t)tid * ctx.MC * ctx.NC, s.rowcnt + tid * ctx.MC);
+    });
+}
+
+
+// Run ctx in Workspace, or in a temporary one when it is NULL
+static void GEMM_Execute(GEMMContext& ctx, const int64_t* b, void* Workspace) {
+    if (GEMM_PackedOutput(ctx.ep))
+        GEMM_ZeroPackedBorder(*ctx.ep, ctx.M, ctx.N, ctx.y);
+    const int T = TAB_GetNumThreads();
+    GEMMScratch s;
+    TabTensor<int64_t> temp;
+    if (!Workspace) {
+        // The GEMM writes its scratch before reading it, no zero fill
+        temp = TabTensor<int64_t>((GEMM_Layout(ctx, T, NULL, s) + 7) / sizeof(int64_t));
+        Workspace = (void*)temp.data();
+    }
+    GEMM_Layout(ctx, T, (char*)Workspace, s);
+    if (GEMM_IsDot(ctx))
+        GEMM_RunDot(ctx, b, s);
+    else
+        GEMM_Run(ctx, b, s);
+}
+
+
+size_t TABGEMM_PackedBWords(ConvType TYPE, int N, int K, int Container) {
+    return (size_t)RoundUp(N, GEMM_NR) * GEMM_PlanesB(TYPE) * RoundUp(K, (Container > 1) ? Container : 1);
+}
+
+
+// b (N, K) -> NR-row panels over the full K, padded to whole containers of V words:
+// bp[j / NR * KP * PB * NR + j % NR * V + PanelWord(k, p)], with V = 1: bp[((j / NR * K + k) * PB + p) * NR + j % NR]
+void TABGEMM_PackB_Into(ConvType TYPE, const int64_t* b, int N, int K, int64_t* bp, int Container) {
+    const int PB = GEMM_PlanesB(TYPE);
+    const int V = (Container > 1) ? Container : 1;
+    const int KP = RoundUp(K, V);
+    const int npanels = RoundUp(N, GEMM_NR) / GEMM_NR;
+    TAB_ParallelFor((npanels + GEMM_PACK_PANELS - 1) / GEMM_PACK_PANELS, [&](int tile, int tid) {
+        const int j0 = tile * GEMM_PACK_PANELS * GEMM_NR;
+        const int rows = (N - j0 < GEMM_PACK_PANELS * GEMM_NR) ? (N - j0) : (GEMM_PACK_PANELS * GEMM_NR);
+        PackPanels(b, K, PB, j0, rows, 0, K, GEMM_NR, V, bp + (int64_t)j0 * KP * PB, NULL);
+    });
+}
+
+
+// The packed outputs round NC up to whole words, so the sizes cover both blockings
+static size_t GEMM_WorkspaceSize(ConvType TYPE, const GEMMConvShape* conv, bool PackB, int M, int N, int K, GEMMBlocking Blocking) {
+    const int T = TAB_GetNumThreads();
+    GEMMEpilogue Packed = GEMMEpilogue();
+    Packed.Output = Output_Binary;
+    GEMMContext ctx;
+    GEMMScratch s;
+    GEMM_Init(ctx, TYPE, NULL, conv, NULL, PackB, NULL, NULL, NULL, M, N, K, 0, Blocking, T);
+    const size_t Bytes = GEMM_Layout(ctx, T, NULL, s);
+    GEMM_Init(ctx, TYPE, NULL, conv, NULL, PackB, NULL, NULL, &Packed, M, N, K, 0, Blocking, T);
+    const size_t PackedBytes = GEMM_Layout(ctx, T, NULL, s);
+    return (Bytes > PackedBytes) ? Bytes : PackedBytes;
+}
+
+
+size_t TABGEMM_Blocked_WorkspaceSize(ConvType TYPE, int M, int N, int K, GEMMBlocking Blocking, bool PackedB) {
+    return GEMM_WorkspaceSize(TYPE, NULL, !PackedB, M, N, K, Blocking);
+}
+
+
+size_t TABGEMM_Implicit_WorkspaceSize(ConvType TYPE, const GEMMConvShape& Shape, int N, GEMMBlocking Blocking, bool PackedB) {
+    return GEMM_WorkspaceSize(TYPE, &Shape, !PackedB, Shape.N * Shape.OH * Shape.OW, N, Shape.KH * Shape.KW * Shape.PackedC, Blocking);
+}
+
+
+// In M-K, N-K order, any ConvType. a and b use the same H_W_B formats as the baselines.
+// bp (optional): b prepacked by TABGEMM_PackB_Into(), b itself is still read by the dot kernels
+void TABGEMM_Blocked(ConvType TYPE, const int64_t* a, const int64_t* b, const int* cnt1, void* y, int M, int N, int K, int NUM, GEMMBlocking Blocking, void* Workspace, const int64_t* bp, const GEMMEpilogue* Epilogue) {
+    GEMMContext ctx;
+    GEMM_Init(ctx, TYPE, a, NULL, bp, bp == NULL, cnt1, y, Epilogue, M, N, K, NUM, Blocking, TAB_GetNumThreads());
+    GEMM_Execute(ctx, b, Workspace);
+}
+
+
+// x: the padded activations from Ternarize_NCHW_to_NHWCB() / Binarize_NCHW_to_NHWC(), b: the weights (N, K)
+void TABGEMM_Implicit(ConvType TYPE, const int64_t* x, const GEMMConvShape& Shape, const int64_t* b, const int* cnt1, void* y, int N, int NUM, GEMMBlocking Blocking, void* Workspace, const int64_t* bp, const GEMMEpilogue* Epilogue) {
+    GEMMContext ctx;
+    GEMM_Init(ctx, TYPE, x, &Shape, bp, bp == NULL, cnt1, y, Epilogue, Shape.N * Shape.OH * Shape.OW, N, Shape.KH * Shape.KW * Shape.PackedC, NUM, Blocking, TAB_GetNumThreads());
+    GEMM_Execute(ctx, b, Workspace);
+}
+
+
+// The epilogue on the int conv results of any GEMM, conv (M, N) -> y (M, N)
+void TABGEMM_Epilogue(const GEMMEpilogue& Epilogue, const int* conv, int M, int N, void* y) {
+    TABGEMM_ZeroOutputBorder(Epilogue, M, N, y);
+    TAB_ParallelFor(M, [&](int m, int tid) {
+        GEMM_StoreRow(&Epilogue, conv + (int64_t)m * N, m, 0, N, N, y);
+    });
+}
+
+
+void TABGEMM_EpilogueRows(const GEMMEpilogue& Epilogue, const int* conv, int m0, int rows, int N, void* y) {
+    for (int m = 0; m < rows; m++)
+        GEMM_StoreRow(&Epilogue, conv + (int64_t)m * N, m0 + m, 0, N, N, y);
+}
+
+
+void TABGEMM_ZeroOutputBorder(const GEMMEpilogue& Epilogue, int M, int N, void* y) {
+    if (GEMM_PackedOutput(&Epilogue))
+        GEMM_ZeroPackedBorder(Epilogue, M, N, y);
+}
+
+
+GEMMEpilogue TABGEMM_ResidualFrom(const GEMMEpilogue& Epilogue, int OH, int OW, int N, int n, int oh) {
+    GEMMEpilogue ep = Epilogue;
+    N = GEMM_OutputChannels(&Epilogue, N);
+    if (ep.Residual)
+        ep.Residual = ep.Residual + (((int64_t)n * OH + oh) * OW) * N;
+    if (ep.ResidualBits) {
+        const int P = ep.ResidualTernary ? BITS : 1;
+        ep.ResidualBits = ep.ResidualBits + (((int64_t)n * (OH + 2 * ep.ResidualPaddingH) + oh) * (OW + 2 * ep.ResidualPaddingW)) * ((N + cntbits - 1) / cntbits) * P;
+    }
+    return ep;
+}
+
+
+size_t TABGEMM_OutputBytes(const GEMMEpilogue* Epilogue, int M, int N) {
+    N = GEMM_OutputChannels(Epilogue, N);
+    if (Epilogue && ((Epilogue->Output == Output_Int16) || (Epilogue->Output == Output_Half) || (Epilogue->Output == Output_BFloat16)))
+        return (size_t)M * N * 2;
+    if (!GEMM_PackedOutput(Epilogue))
+        return (size_t)M * N * 4;
+    const int P = (Epilogue->Output == Output_Ternary) ? BITS : 1;
+    const size_t images = M / (Epilogue->OH * Epilogue->OW);
+    return images * (Epilogue->OH + 2 * Epilogue->PaddingH) * (Epilogue->OW + 2 * Epilogue->PaddingW) * ((N + cntbits - 1) / cntbits) * P * sizeof(int64_t);
+}
+
+
+TabTensor<int> TNNGEMM_blocked(int64_t* a, int64_t* b, int M, int N, int K) {
+    TabTensor<int> y = TabTensor<int>((size_t)M * N);
+    TABGEMM_Blocked(ConvType::TNN, a, b, NULL, y.data(), M, N, K, 0, GEMM_DefaultBlocking());
+    return y;
+}
+
+TabTensor<int> TBNGEMM_blocked(int64_t* a, int64_t* b, int M, int N, int K) {
+    TabTensor<int> y = TabTensor<int>((size_t)M * N);
+    TABGEMM_Blocked(ConvType::TBN, a, b, NULL, y.data(), M, N, K, 0, GEMM_DefaultBlocking());
+    return y;
+}
+
+TabTensor<int> BTNGEMM_blocked(int64_t* a, int64_t* b, int* cnt1, int M, int N, int K) {
+    TabTensor<int> y = TabTensor<int>((size_t)M * N);
+    TABGEMM_Blocked(ConvType::BTN, a, b, cnt1, y.data(), M, N, K, 0, GEMM_DefaultBlocking());
+    return y;
+}
+
+TabTensor<int> BNNGEMM_blocked(int64_t* a, int64_t* b, int M, int N, int K, int NUM) {
+    TabTensor<int> y = TabTensor<int>((size_t)M * N);
+    TABGEMM_Blocked(ConvType::BNN, a, b, NULL, y.data(), M, N, K, NUM, GEMM_DefaultBlocking());
+    return y;
+}
@@ -0,0 +1,173 @@
+#include "common.h"
+#include "GEMM_Kernels.h"
+#include "CPUFeatures.h"
+
+// Scalar MR x NR micro-kernel on containers of V words. TYPE is a template constant, so the ConvType branches are
+// folded away. Each word of a is reused NR times and each word of b MR times from registers.
+template <ConvType TYPE, int MR, int V>
+static inline void MicroKernel_Scalar(int K, const int64_t* A, const int64_t* B, int* C, int LDC) {
+    const int PA = GEMM_PlanesA(TYPE);
+    const int PB = GEMM_PlanesB(TYPE);
+    int acc[MR][GEMM_NR] = {};
+
+    for (int iq = 0; iq < K / V; iq++) {
+        const int64_t* a = A + iq * PA * MR * V;
+        const int64_t* b = B + iq * PB * GEMM_NR * V;
+        for (int w = 0; w < V; w++) {
+            for (int r = 0; r < MR; r++) {
+                for (int c = 0; c < GEMM_NR; c++) {
+                    const int64_t a0 = a[r * V + w];
+                    const int64_t b0 = b[c * V + w];
+                    if (TYPE == ConvType::TNN) {
+                        int64_t nz = a[(MR + r) * V + w] & b[(GEMM_NR + c) * V + w];
+                        acc[r][c] += (int)popcnt64(nz) - 2 * (int)popcnt64((a0 ^ b0) & nz);
+                    }
+                    else if (TYPE == ConvType::TBN) {
+                        acc[r][c] += (int)popcnt64((a0 ^ b0) & a[(MR + r) * V + w]);
+                    }
+                    else if (TYPE == ConvType::BTN) {
+                        acc[r][c] += (int)popcnt64((a0 ^ b0) & b[(GEMM_NR + c) * V + w]);
+                    }
+                    else {
+                        acc[r][c] += (int)popcnt64(a0 ^ b0);
+                    }
+                }
+            }
+        }
+    }
+
+    for (int r = 0; r < MR; r++) {
+        for (int c = 0; c < GEMM_NR; c++) {
+            C[r * LDC + c] += acc[r][c];
+        }
+    }
+}
+
+
+void TNN_MicroKernel_Scalar(int K, const int64_t* A, const int64_t* B, int* C, int LDC) {
+    MicroKernel_Scalar<ConvType::TNN, 4, 1>(K, A, B, C, LDC);
+}
+
+void TBN_MicroKernel_Scalar(int K, const int64_t* A, const int64_t* B, int* C, int LDC) {
+    MicroKernel_Scalar<ConvType::TBN, 4, 1>(K, A, B, C, LDC);
+}
+
+void BTN_MicroKernel_Scalar(int K, const int64_t* A, const int64_t* B, int* C, int LDC) {
+    MicroKernel_Scalar<ConvType::BTN, 4, 1>(K, A, B, C, LDC);
+}
+
+void BNN_MicroKernel_Scalar(int K, const int64_t* A, const int64_t* B, int* C, int LDC) {
+    MicroKernel_Scalar<ConvType::BNN, 4, 1>(K, A, B, C, LDC);
+}
+
+
+// Scalar dot kernel, one row of a against N rows of b
+template <ConvType TYPE>
+static void DotKernel_Scalar(int K, const int64_t* a, const int64_t* b, int N, int* raw) {
+    const int PA = GEMM_PlanesA(TYPE);
+    const int PB = GEMM_PlanesB(TYPE);
+    for (int n = 0; n < N; n++) {
+        const int64_t* bn = b + (int64_t)n * K * PB;
+        int acc = 0;
+        for (int ik = 0; ik < K; ik++) {
+            const int64_t* ak = a + ik * PA;
+            const int64_t* bk = bn + ik * PB;
+            if (TYPE == ConvType::TNN) {
+                int64_t nz = ak[1] & bk[1];
+                acc += (int)popcnt64(nz) - 2 * (int)popcnt64((ak[0] ^ bk[0]) & nz);
+            }
+            else if (TYPE == ConvType::TBN) {
+                acc += (int)popcnt64((ak[0] ^ bk[0]) & ak[1]);
+            }
+            else if (TYPE == ConvType::BTN) {
+                acc += (int)popcnt64((ak[0] ^ bk[0]) & bk[1]);
+            }
+            else {
+                acc += (int)popcnt64(ak[0] ^ bk[0]);
+            }
+        }
+        raw[n] = acc;
+    }
+}
+
+
+template <int V>
+static GEMMMicroKernelFn GEMM_GetScalarKernel(ConvType TYPE) {
+    switch (TYPE) {
+    case ConvType::TNN: return MicroKernel_Scalar<ConvType::TNN, 4, V>;
+    case ConvType::TBN: return MicroKernel_Scalar<ConvType::TBN, 4, V>;
+    case ConvType::BTN: return MicroKernel_Scalar<ConvType::BTN, 4, V>;
+    default:            return MicroKernel_Scalar<ConvType::BNN, 4, V>;
+    }
+}
+
+
+static GEMMMicroKernel GEMM_GetMicroKernel_Scalar(ConvType TYPE, int Container) {
+    GEMMMicroKernel uk;
+    uk.MR = 4;
+    switch (Container) {
+    case 2:  uk.Kernel = GEMM_GetScalarKernel<2>(TYPE); break;
+    case 4:  uk.Kernel = GEMM_GetScalarKernel<4>(TYPE); break;
+    case 8:  uk.Kernel = GEMM_GetScalarKernel<8>(TYPE); break;
+    default: uk.Kernel = GEMM_GetScalarKernel<1>(TYPE); break;
+    }
+    return uk;
+}
+
+
+GEMMDotKernelFn GEMM_GetDotKernel_Scalar(ConvType TYPE) {
+    switch (TYPE) {
+    case ConvType::TNN: return DotKernel_Scalar<ConvType::TNN>;
+    case ConvType::TBN: return DotKernel_Scalar<ConvType::TBN>;
+    case ConvType::BTN: return DotKernel_Scalar<ConvType::BTN>;
+    default:            return DotKernel_Scalar<ConvType::BNN>;
+    }
+}
+
+
+void GEMM_FloatToHalf_Scalar(const float* x, uint16_t* y, int n) {
+    for (int i = 0; i < n; i++)
+        y[i] = TAB_FloatToHalf(x[i]);
+}
+
+
+GEMMMicroKernel GEMM_GetMicroKernel(ConvType TYPE, int Container) {
+#ifdef TAB_X86
+    switch (TAB_GetISA()) {
+    case ISA_AVX512: {
+        GEMMMicroKernel uk = GEMM_GetMicroKernel_AVX512(TYPE, Container);
+        if (uk.Kernel)
+            return uk;
+        break;
+    }
+    case ISA_AVX2:
+        if (Container == 1)
+            return GEMM_GetMicroKernel_AVX2(TYPE);
+        break;
+    default:
+        break;
+    }
+#endif
+    return GEMM_GetMicroKernel_Scalar(TYPE, Container);
+}
+
+
+GEMMDotKernelFn GEMM_GetDotKernel(ConvType TYPE) {
+#ifdef TAB_X86
+    switch (TAB_GetISA()) {
+    case ISA_AVX512: return GEMM_GetDotKernel_AVX512(TYPE);
+    case ISA_AVX2:   return GEMM_GetDotKernel_AVX2(TYPE);
+    default:         break;
+    }
+#endif
+    return GEMM_GetDotKernel_Scalar(TYPE);
+}
+
+
+GEMMHalfConvertFn GEMM_GetFloatToHalf() {
+#ifdef TAB_X86
+    if (TAB_GetISA() >= ISA_AVX2)
+        return GEMM_FloatToHalf_AVX2;
+#endif
+    return GEMM_FloatToHalf_Scalar;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "common.h"
+#include "GEMM.h"
+
+// Micro-kernels of the blocked bitwise GEMM
+//
+// Packed panel layout, shared by a (R = MR rows) and b (R = NR rows), in containers of V words of K:
+//   panel[((k / V * P + p) * R + r) * V + k % V] = word k of bit plane p of row r
+//   P bit planes: plane 0 holds the sign bits, plane 1 the non-zero bits of ternary values
+// V = 1 (int64_t words): one load of R consecutive words covers R rows at the same k, and there is no K padding.
+// V > 1 (128/256/512-bit containers): one load covers V words of K of one row, and K is padded to a multiple of V
+// with 0 words, which add nothing to any raw count.
+//
+// The kernels accumulate raw counts into C (MR x NR, leading dimension LDC):
+//   TNN: nonzero - 2 * negative, which is already the result
+//   TBN, BTN, BNN: negative, the result is base - 2 * raw with
+//     TBN base = non-zero count of the activation row (computed while packing a)
+//     BTN base = cnt1 of the weight row
+//     BNN base = NUM
+// K is the padded K of the panels, a multiple of V.
+typedef void (*GEMMMicroKernelFn)(int K, const int64_t* A, const int64_t* B, int* C, int LDC);
+
+struct GEMMMicroKernel {
+    GEMMMicroKernelFn Kernel;
+    int MR;  // rows of a per call, NR is always GEMM_NR
+};
+
+// The largest container of the panels in words, the workspaces are sized for it
+#define GEMM_MAX_CONTAINER 8
+
+// Bit planes of a (activation) and b (weights) in each ConvType
+inline int GEMM_PlanesA(ConvType TYPE) {
+    return ((TYPE == ConvType::TNN) || (TYPE == ConvType::TBN)) ? BITS : 1;
+}
+inline int GEMM_PlanesB(ConvType TYPE) {
+    return ((TYPE == ConvType::TNN) || (TYPE == ConvType::BTN)) ? BITS : 1;
+}
+
+// Dot kernels for GEMMs with fewer rows of a than MR (e.g. FC layers at batch 1)
+// They vectorize along K instead, on the unpacked H_W_B rows: raw[n] = raw count of row a against row n of b,
+// b rows are contiguous (K * GEMM_PlanesB(TYPE) words each). Same raw counts as the micro-kernels.
+typedef void (*GEMMDotKernelFn)(int K, const int64_t* a, const int64_t* b, int N, int* raw);
+
+// The software prefetch distance of the dot kernels on the weight rows (bytes)
+// The weights of an FC layer at batch 1 are read once, so the kernels run at the speed of this stream.
+#define GEMM_PREFETCH_BYTES 2048
+
+// Portable scalar kernels, MR = 4, V = 1 (any V through GEMM_GetMicroKernel())
+void TNN_MicroKernel_Scalar(int K, const int64_t* A, const int64_t* B, int* C, int LDC);
+void TBN_MicroKernel_Scalar(int K, const int64_t* A, const int64_t* B, int* C, int LDC);
+void BTN_MicroKernel_Scalar(int K, const int64_t* A, const int64_t* B, int* C, int LDC);
+void BNN_MicroKernel_Scalar(int K, const int64_t* A, const int64_t* B, int* C, int LDC);
+GEMMDotKernelFn GEMM_GetDotKernel_Scalar(ConvType TYPE);
+
+// The fp16 conversion of the Output_Half epilogue: y[i] = TAB_FloatToHalf(x[i])
+typedef void (*GEMMHalfConvertFn)(const float* x, uint16_t* y, int n);
+void GEMM_FloatToHalf_Scalar(const float* x, uint16_t* y, int n);
+
+#ifdef TAB_X86
+// AVX2: nibble-LUT popcount, MR = 4 rows per YMM, V = 1. The dot kernels use Harley-Seal carry-save adders.
+GEMMMicroKernel GEMM_GetMicroKernel_AVX2(ConvType TYPE);
+GEMMDotKernelFn GEMM_GetDotKernel_AVX2(ConvType TYPE);
+// F16C, 8 floats per instruction (ISA_AVX2 requires it)
+void GEMM_FloatToHalf_AVX2(const float* x, uint16_t* y, int n);
+// AVX-512 VPOPCNTDQ: V = 1 with MR = 8 rows per ZMM, V = 2 / 4 / 8 with MR = 4 and one XMM / YMM / ZMM per container.
+// Kernel is NULL for other containers.
+GEMMMicroKernel GEMM_GetMicroKernel_AVX512(ConvType TYPE, int Container);
+GEMMDotKernelFn GEMM_GetDotKernel_AVX512(ConvType TYPE);
+#endif
+
+// The kernels of the instruction set selected by TAB_GetISA(), for panels of Container words (1, 2, 4 or 8)
+// Containers without a kernel of the instruction set run the scalar kernels.
+GEMMMicroKernel GEMM_GetMicroKernel(ConvType TYPE, int Container = 1);
+GEMMDotKernelFn GEMM_GetDotKernel(ConvType TYPE);
+GEMMHalfConvertFn GEMM_GetFloatToHalf();
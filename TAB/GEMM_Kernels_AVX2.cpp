@@ -0,0 +1,248 @@
+#include "common.h"
+#include "GEMM_Kernels.h"
+
+#ifdef TAB_X86
+#include <immintrin.h>
+
+// AVX2 kernels, only called when TAB_GetISA() >= ISA_AVX2
+#define TAB_AVX2 TAB_TARGET("avx2,popcnt")
+
+
+// Per-byte popcount with the nibble lookup table
+TAB_AVX2 static inline __m256i PopcntBytes(__m256i v) {
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low4 = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low4);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low4);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+}
+
+// Per-64-bit-lane popcount
+TAB_AVX2 static inline __m256i Popcnt64(__m256i v) {
+    return _mm256_sad_epu8(PopcntBytes(v), _mm256_setzero_si256());
+}
+
+
+// MR = 4 rows of a per YMM, b words are broadcast. The byte counts are accumulated for up to 31 steps
+// (15 for TNN) before they are widened with SAD, so the popcount costs about 6 instructions per 4 pairs.
+template <ConvType TYPE>
+TAB_AVX2 static void MicroKernel_AVX2(int K, const int64_t* A, const int64_t* B, int* C, int LDC) {
+    const int MR = 4;
+    const int PA = GEMM_PlanesA(TYPE);
+    const int PB = GEMM_PlanesB(TYPE);
+    // TNN adds pos + 8 - neg in [0, 16] per byte, the others add neg in [0, 8]
+    const int STEPS = (TYPE == ConvType::TNN) ? 15 : 31;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i eight = _mm256_set1_epi8(8);
+
+    __m256i acc[GEMM_NR];
+    for (int c = 0; c < GEMM_NR; c++)
+        acc[c] = zero;
+
+    for (int k0 = 0; k0 < K; k0 += STEPS) {
+        const int k1 = (K - k0 < STEPS) ? K : (k0 + STEPS);
+        __m256i accb[GEMM_NR];
+        for (int c = 0; c < GEMM_NR; c++)
+            accb[c] = zero;
+
+        for (int ik = k0; ik < k1; ik++) {
+            const int64_t* a = A + ik * PA * MR;
+            const int64_t* b = B + ik * PB * GEMM_NR;
+            const __m256i a0 = _mm256_loadu_si256((const __m256i*)a);
+            const __m256i a1 = (PA > 1) ? _mm256_loadu_si256((const __m256i*)(a + MR)) : a0;
+            for (int c = 0; c < GEMM_NR; c++) {
+                const __m256i b0 = _mm256_set1_epi64x(b[c]);
+                const __m256i x = _mm256_xor_si256(a0, b0);
+                if (TYPE == ConvType::TNN) {
+                    const __m256i nz = _mm256_and_si256(a1, _mm256_set1_epi64x(b[GEMM_NR + c]));
+                    const __m256i neg = _mm256_and_si256(x, nz);
+                    const __m256i pos = _mm256_andnot_si256(neg, nz);
+                    accb[c] = _mm256_add_epi8(accb[c], _mm256_sub_epi8(_mm256_add_epi8(PopcntBytes(pos), eight), PopcntBytes(neg)));
+                }
+                else if (TYPE == ConvType::TBN) {
+                    accb[c] = _mm256_add_epi8(accb[c], PopcntBytes(_mm256_and_si256(x, a1)));
+                }
+                else if (TYPE == ConvType::BTN) {
+                    accb[c] = _mm256_add_epi8(accb[c], PopcntBytes(_mm256_and_si256(x, _mm256_set1_epi64x(b[GEMM_NR + c]))));
+                }
+                else {
+                    accb[c] = _mm256_add_epi8(accb[c], PopcntBytes(x));
+                }
+            }
+        }
+        for (int c = 0; c < GEMM_NR; c++)
+            acc[c] = _mm256_add_epi64(acc[c], _mm256_sad_epu8(accb[c], zero));
+    }
+
+    // TNN: remove the +8 per byte, 64 per word
+    const int64_t bias = (TYPE == ConvType::TNN) ? (int64_t)64 * K : 0;
+    for (int c = 0; c < GEMM_NR; c++) {
+        int64_t lanes[MR];
+        _mm256_storeu_si256((__m256i*)lanes, acc[c]);
+        for (int r = 0; r < MR; r++)
+            C[r * LDC + c] += (int)(lanes[r] - bias);
+    }
+}
+
+
+// The i-th vector of bits to count in a dot product, on the unpacked H_W_B rows
+// Ternary rows interleave (sign, non-zero) words, so a YMM covers 2 k and binary rows are expanded to match.
+// TNN keeps negative bits in the even lanes and non-zero bits in the odd lanes.
+template <ConvType TYPE>
+TAB_AVX2 static inline __m256i DotBits(const int64_t* a, const int64_t* b, int i) {
+    const __m256i even = _mm256_setr_epi64x(-1, 0, -1, 0);
+    if (TYPE == ConvType::TNN) {
+        const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i * 4));
+        const __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i * 4));
+        const __m256i x = _mm256_xor_si256(va, vb);
+        const __m256i nz = _mm256_and_si256(va, vb);
+        // Swap the words of each pair to line up the non-zero bits with the sign bits
+        const __m256i neg = _mm256_and_si256(x, _mm256_shuffle_epi32(nz, 0x4E));
+        return _mm256_blend_epi32(neg, nz, 0xCC);
+    }
+    else if (TYPE == ConvType::TBN) {
+        const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i * 4));
+        const __m256i vb = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(b + i * 2))), 0x50);
+        const __m256i x = _mm256_xor_si256(va, vb);
+        return _mm256_and_si256(_mm256_and_si256(x, _mm256_shuffle_epi32(va, 0x4E)), even);
+    }
+    else if (TYPE == ConvType::BTN) {
+        const __m256i va = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(a + i * 2))), 0x50);
+        const __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i * 4));
+        const __m256i x = _mm256_xor_si256(va, vb);
+        return _mm256_and_si256(_mm256_and_si256(x, _mm256_shuffle_epi32(vb, 0x4E)), even);
+    }
+    else {
+        const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i * 4));
+        const __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i * 4));
+        return _mm256_xor_si256(va, vb);
+    }
+}
+
+
+// Carry-save adder: h:l = a + b + c
+TAB_AVX2 static inline void CSA(__m256i& h, __m256i& l, __m256i a, __m256i b, __m256i c) {
+    const __m256i u = _mm256_xor_si256(a, b);
+    h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+    l = _mm256_xor_si256(u, c);
+}
+
+
+// Harley-Seal popcount of DotBits over NV vectors, per 64-bit lane
+// 16 vectors are reduced by carry-save adders, so only 1 in 16 vectors pays for a full popcount.
+template <ConvType TYPE>
+TAB_AVX2 static inline __m256i HarleySeal(const int64_t* a, const int64_t* b, int NV) {
+    __m256i total = _mm256_setzero_si256();
+    __m256i ones = _mm256_setzero_si256();
+    __m256i twos = _mm256_setzero_si256();
+    __m256i fours = _mm256_setzero_si256();
+    __m256i eights = _mm256_setzero_si256();
+    __m256i sixteens, twosA, twosB, foursA, foursB, eightsA, eightsB;
+    int i = 0;
+    // Words of b per vector
+    const int WB = (TYPE == ConvType::TBN) ? 2 : 4;
+    for (; i + 16 <= NV; i += 16) {
+        // The weights stream from memory once: prefetch the lines of a later block
+        for (int line = 0; line < 16 * WB; line += 8)
+            _mm_prefetch((const char*)(b + i * WB + line) + GEMM_PREFETCH_BYTES, _MM_HINT_T0);
+        CSA(twosA, ones, ones, DotBits<TYPE>(a, b, i + 0), DotBits<TYPE>(a, b, i + 1));
+        CSA(twosB, ones, ones, DotBits<TYPE>(a, b, i + 2), DotBits<TYPE>(a, b, i + 3));
+        CSA(foursA, twos, twos, twosA, twosB);
+        CSA(twosA, ones, ones, DotBits<TYPE>(a, b, i + 4), DotBits<TYPE>(a, b, i + 5));
+        CSA(twosB, ones, ones, DotBits<TYPE>(a, b, i + 6), DotBits<TYPE>(a, b, i + 7));
+        CSA(foursB, twos, twos, twosA, twosB);
+        CSA(eightsA, fours, fours, foursA, foursB);
+        CSA(twosA, ones, ones, DotBits<TYPE>(a, b, i + 8), DotBits<TYPE>(a, b, i + 9));
+        CSA(twosB, ones, ones, DotBits<TYPE>(a, b, i + 10), DotBits<TYPE>(a, b, i + 11));
+        CSA(foursA, twos, twos, twosA, twosB);
+        CSA(twosA, ones, ones, DotBits<TYPE>(a, b, i + 12), DotBits<TYPE>(a, b, i + 13));
+        CSA(twosB, ones, ones, DotBits<TYPE>(a, b, i + 14), DotBits<TYPE>(a, b, i + 15));
+        CSA(foursB, twos, twos, twosA, twosB);
+        CSA(eightsB, fours, fours, foursA, foursB);
+        CSA(sixteens, eights, eights, eightsA, eightsB);
+        total = _mm256_add_epi64(total, Popcnt64(sixteens));
+    }
+    total = _mm256_slli_epi64(total, 4);
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(Popcnt64(eights), 3));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(Popcnt64(fours), 2));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(Popcnt64(twos), 1));
+    total = _mm256_add_epi64(total, Popcnt64(ones));
+    for (; i < NV; i++)
+        total = _mm256_add_epi64(total, Popcnt64(DotBits<TYPE>(a, b, i)));
+    return total;
+}
+
+
+template <ConvType TYPE>
+TAB_AVX2 static void DotKernel_AVX2(int K, const int64_t* a, const int64_t* b, int N, int* raw) {
+    const int PA = GEMM_PlanesA(TYPE);
+    const int PB = GEMM_PlanesB(TYPE);
+    // k per vector: 2 when a ternary row is involved, 4 for BNN
+    const int KV = ((PA > 1) || (PB > 1)) ? 2 : 4;
+    const int NV = K / KV;
+    for (int n = 0; n < N; n++) {
+        const int64_t* bn = b + (int64_t)n * K * PB;
+        int64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, HarleySeal<TYPE>(a, bn, NV));
+        int acc;
+        if (TYPE == ConvType::TNN)
+            acc = (int)(lanes[1] + lanes[3]) - 2 * (int)(lanes[0] + lanes[2]);
+        else
+            acc = (int)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+
+        // K tail
+        for (int ik = NV * KV; ik < K; ik++) {
+            const int64_t* ak = a + ik * PA;
+            const int64_t* bk = bn + ik * PB;
+            if (TYPE == ConvType::TNN) {
+                int64_t nz = ak[1] & bk[1];
+                acc += (int)popcnt64(nz) - 2 * (int)popcnt64((ak[0] ^ bk[0]) & nz);
+            }
+            else if (TYPE == ConvType::TBN) {
+                acc += (int)popcnt64((ak[0] ^ bk[0]) & ak[1]);
+            }
+            else if (TYPE == ConvType::BTN) {
+                acc += (int)popcnt64((ak[0] ^ bk[0]) & bk[1]);
+            }
+            else {
+                acc += (int)popcnt64(ak[0] ^ bk[0]);
+            }
+        }
+        raw[n] = acc;
+    }
+}
+
+
+TAB_TARGET("avx2,f16c") void GEMM_FloatToHalf_AVX2(const float* x, uint16_t* y, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i*)(y + i), _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT));
+    for (; i < n; i++)
+        y[i] = TAB_FloatToHalf(x[i]);
+}
+
+
+GEMMMicroKernel GEMM_GetMicroKernel_AVX2(ConvType TYPE) {
+    GEMMMicroKernel uk;
+    uk.MR = 4;
+    switch (TYPE) {
+    case ConvType::TNN: uk.Kernel = MicroKernel_AVX2<ConvType::TNN>; break;
+    case ConvType::TBN: uk.Kernel = MicroKernel_AVX2<ConvType::TBN>; break;
+    case ConvType::BTN: uk.Kernel = MicroKernel_AVX2<ConvType::BTN>; break;
+    default:            uk.Kernel = MicroKernel_AVX2<ConvType::BNN>; break;
+    }
+    return uk;
+}
+
+
+GEMMDotKernelFn GEMM_GetDotKernel_AVX2(ConvType TYPE) {
+    switch (TYPE) {
+    case ConvType::TNN: return DotKernel_AVX2<ConvType::TNN>;
+    case ConvType::TBN: return DotKernel_AVX2<ConvType::TBN>;
+    case ConvType::BTN: return DotKernel_AVX2<ConvType::BTN>;
+    default:            return DotKernel_AVX2<ConvType::BNN>;
+    }
+}
+
+#endif // TAB_X86
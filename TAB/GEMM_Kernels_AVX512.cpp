@@ -0,0 +1,278 @@
+#include "common.h"
+#include "GEMM_Kernels.h"
+
+#ifdef TAB_X86
+#include <immintrin.h>
+
+// AVX-512 kernels, only called when TAB_GetISA() >= ISA_AVX512
+#define TAB_AVX512 TAB_TARGET("avx512f,avx512bw,avx512vl,avx512vpopcntdq,avx2,popcnt")
+
+
+// MR = 8 rows of a per ZMM, b words are broadcast, vpopcntq counts each 64-bit lane directly
+template <ConvType TYPE>
+TAB_AVX512 static void MicroKernel_AVX512(int K, const int64_t* A, const int64_t* B, int* C, int LDC) {
+    const int MR = 8;
+    const int PA = GEMM_PlanesA(TYPE);
+    const int PB = GEMM_PlanesB(TYPE);
+
+    __m512i acc[GEMM_NR];
+    for (int c = 0; c < GEMM_NR; c++)
+        acc[c] = _mm512_setzero_si512();
+
+    for (int ik = 0; ik < K; ik++) {
+        const int64_t* a = A + ik * PA * MR;
+        const int64_t* b = B + ik * PB * GEMM_NR;
+        const __m512i a0 = _mm512_loadu_si512((const void*)a);
+        const __m512i a1 = (PA > 1) ? _mm512_loadu_si512((const void*)(a + MR)) : a0;
+        for (int c = 0; c < GEMM_NR; c++) {
+            const __m512i x = _mm512_xor_si512(a0, _mm512_set1_epi64(b[c]));
+            if (TYPE == ConvType::TNN) {
+                const __m512i nz = _mm512_and_si512(a1, _mm512_set1_epi64(b[GEMM_NR + c]));
+                const __m512i neg = _mm512_and_si512(x, nz);
+                const __m512i pos = _mm512_andnot_si512(neg, nz);
+                acc[c] = _mm512_sub_epi64(_mm512_add_epi64(acc[c], _mm512_popcnt_epi64(pos)), _mm512_popcnt_epi64(neg));
+            }
+            else if (TYPE == ConvType::TBN) {
+                acc[c] = _mm512_add_epi64(acc[c], _mm512_popcnt_epi64(_mm512_and_si512(x, a1)));
+            }
+            else if (TYPE == ConvType::BTN) {
+                acc[c] = _mm512_add_epi64(acc[c], _mm512_popcnt_epi64(_mm512_and_si512(x, _mm512_set1_epi64(b[GEMM_NR + c]))));
+            }
+            else {
+                acc[c] = _mm512_add_epi64(acc[c], _mm512_popcnt_epi64(x));
+            }
+        }
+    }
+
+    for (int c = 0; c < GEMM_NR; c++) {
+        int lanes[MR];
+        _mm256_storeu_si256((__m256i*)lanes, _mm512_cvtepi64_epi32(acc[c]));
+        for (int r = 0; r < MR; r++)
+            C[r * LDC + c] += lanes[r];
+    }
+}
+
+
+// The containers of V words of the panels, with the vpopcntq of their width
+template <int V> struct Container;
+
+template <> struct Container<2> {
+    typedef __m128i Vec;
+    TAB_AVX512 static inline Vec Load(const int64_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+    TAB_AVX512 static inline Vec Zero() { return _mm_setzero_si128(); }
+    TAB_AVX512 static inline Vec Xor(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+    TAB_AVX512 static inline Vec And(Vec a, Vec b) { return _mm_and_si128(a, b); }
+    TAB_AVX512 static inline Vec AndNot(Vec a, Vec b) { return _mm_andnot_si128(a, b); }
+    TAB_AVX512 static inline Vec Add(Vec a, Vec b) { return _mm_add_epi64(a, b); }
+    TAB_AVX512 static inline Vec Sub(Vec a, Vec b) { return _mm_sub_epi64(a, b); }
+    TAB_AVX512 static inline Vec Popcnt(Vec a) { return _mm_popcnt_epi64(a); }
+    TAB_AVX512 static inline int64_t Sum(Vec a) { return _mm_cvtsi128_si64(_mm_add_epi64(a, _mm_unpackhi_epi64(a, a))); }
+};
+
+template <> struct Container<4> {
+    typedef __m256i Vec;
+    TAB_AVX512 static inline Vec Load(const int64_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    TAB_AVX512 static inline Vec Zero() { return _mm256_setzero_si256(); }
+    TAB_AVX512 static inline Vec Xor(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+    TAB_AVX512 static inline Vec And(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+    TAB_AVX512 static inline Vec AndNot(Vec a, Vec b) { return _mm256_andnot_si256(a, b); }
+    TAB_AVX512 static inline Vec Add(Vec a, Vec b) { return _mm256_add_epi64(a, b); }
+    TAB_AVX512 static inline Vec Sub(Vec a, Vec b) { return _mm256_sub_epi64(a, b); }
+    TAB_AVX512 static inline Vec Popcnt(Vec a) { return _mm256_popcnt_epi64(a); }
+    TAB_AVX512 static inline int64_t Sum(Vec a) { return Container<2>::Sum(_mm_add_epi64(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1))); }
+};
+
+template <> struct Container<8> {
+    typedef __m512i Vec;
+    TAB_AVX512 static inline Vec Load(const int64_t* p) { return _mm512_loadu_si512((const void*)p); }
+    TAB_AVX512 static inline Vec Zero() { return _mm512_setzero_si512(); }
+    TAB_AVX512 static inline Vec Xor(Vec a, Vec b) { return _mm512_xor_si512(a, b); }
+    TAB_AVX512 static inline Vec And(Vec a, Vec b) { return _mm512_and_si512(a, b); }
+    TAB_AVX512 static inline Vec AndNot(Vec a, Vec b) { return _mm512_andnot_si512(a, b); }
+    TAB_AVX512 static inline Vec Add(Vec a, Vec b) { return _mm512_add_epi64(a, b); }
+    TAB_AVX512 static inline Vec Sub(Vec a, Vec b) { return _mm512_sub_epi64(a, b); }
+    TAB_AVX512 static inline Vec Popcnt(Vec a) { return _mm512_popcnt_epi64(a); }
+    TAB_AVX512 static inline int64_t Sum(Vec a) { return _mm512_reduce_add_epi64(a); }
+};
+
+
+// MR = 4 rows x NR columns on containers of V words of K: one load per row and plane covers V words, the 16
+// accumulators hold V lanes each and are reduced once at the end. The K loop runs K / V steps.
+template <ConvType TYPE, int V>
+TAB_AVX512 static void MicroKernel_AVX512_Wide(int K, const int64_t* A, const int64_t* B, int* C, int LDC) {
+    typedef Container<V> W;
+    typedef typename W::Vec Vec;
+    const int MR = 4;
+    const int PA = GEMM_PlanesA(TYPE);
+    const int PB = GEMM_PlanesB(TYPE);
+
+    Vec acc[MR][GEMM_NR];
+    for (int r = 0; r < MR; r++)
+        for (int c = 0; c < GEMM_NR; c++)
+            acc[r][c] = W::Zero();
+
+    for (int iq = 0; iq < K / V; iq++) {
+        const int64_t* a = A + iq * PA * MR * V;
+        const int64_t* b = B + iq * PB * GEMM_NR * V;
+        Vec a0[MR], a1[MR];
+        for (int r = 0; r < MR; r++) {
+            a0[r] = W::Load(a + r * V);
+            a1[r] = (PA > 1) ? W::Load(a + (MR + r) * V) : a0[r];
+        }
+        for (int c = 0; c < GEMM_NR; c++) {
+            const Vec b0 = W::Load(b + c * V);
+            const Vec b1 = (PB > 1) ? W::Load(b + (GEMM_NR + c) * V) : b0;
+            for (int r = 0; r < MR; r++) {
+                const Vec x = W::Xor(a0[r], b0);
+                if (TYPE == ConvType::TNN) {
+                    const Vec nz = W::And(a1[r], b1);
+                    const Vec neg = W::And(x, nz);
+                    const Vec pos = W::AndNot(neg, nz);
+                    acc[r][c] = W::Sub(W::Add(acc[r][c], W::Popcnt(pos)), W::Popcnt(neg));
+                }
+                else if (TYPE == ConvType::TBN) {
+                    acc[r][c] = W::Add(acc[r][c], W::Popcnt(W::And(x, a1[r])));
+                }
+                else if (TYPE == ConvType::BTN) {
+                    acc[r][c] = W::Add(acc[r][c], W::Popcnt(W::And(x, b1)));
+                }
+                else {
+                    acc[r][c] = W::Add(acc[r][c], W::Popcnt(x));
+                }
+            }
+        }
+    }
+
+    for (int r = 0; r < MR; r++)
+        for (int c = 0; c < GEMM_NR; c++)
+            C[r * LDC + c] += (int)W::Sum(acc[r][c]);
+}
+
+
+// The i-th vector of bits to count in a dot product, on the unpacked H_W_B rows (see the AVX2 version)
+// A ZMM covers 4 k when a ternary row is involved, 8 k for BNN.
+template <ConvType TYPE>
+TAB_AVX512 static inline __m512i DotBits(const int64_t* a, const int64_t* b, int i) {
+    const __m512i expand = _mm512_setr_epi64(0, 0, 1, 1, 2, 2, 3, 3);
+    if (TYPE == ConvType::TNN) {
+        const __m512i va = _mm512_loadu_si512((const void*)(a + i * 8));
+        const __m512i vb = _mm512_loadu_si512((const void*)(b + i * 8));
+        const __m512i x = _mm512_xor_si512(va, vb);
+        const __m512i nz = _mm512_and_si512(va, vb);
+        const __m512i neg = _mm512_and_si512(x, _mm512_shuffle_epi32(nz, _MM_PERM_BADC));
+        return _mm512_mask_blend_epi64(0xAA, neg, nz);
+    }
+    else if (TYPE == ConvType::TBN) {
+        const __m512i va = _mm512_loadu_si512((const void*)(a + i * 8));
+        const __m512i vb = _mm512_permutexvar_epi64(expand, _mm512_castsi256_si512(_mm256_loadu_si256((const __m256i*)(b + i * 4))));
+        const __m512i x = _mm512_xor_si512(va, vb);
+        return _mm512_maskz_and_epi64(0x55, x, _mm512_shuffle_epi32(va, _MM_PERM_BADC));
+    }
+    else if (TYPE == ConvType::BTN) {
+        const __m512i va = _mm512_permutexvar_epi64(expand, _mm512_castsi256_si512(_mm256_loadu_si256((const __m256i*)(a + i * 4))));
+        const __m512i vb = _mm512_loadu_si512((const void*)(b + i * 8));
+        const __m512i x = _mm512_xor_si512(va, vb);
+        return _mm512_maskz_and_epi64(0x55, x, _mm512_shuffle_epi32(vb, _MM_PERM_BADC));
+    }
+    else {
+        const __m512i va = _mm512_loadu_si512((const void*)(a + i * 8));
+        const __m512i vb = _mm512_loadu_si512((const void*)(b + i * 8));
+        return _mm512_xor_si512(va, vb);
+    }
+}
+
+
+template <ConvType TYPE>
+TAB_AVX512 static void DotKernel_AVX512(int K, const int64_t* a, const int64_t* b, int N, int* raw) {
+    const int PA = GEMM_PlanesA(TYPE);
+    const int PB = GEMM_PlanesB(TYPE);
+    const int KV = ((PA > 1) || (PB > 1)) ? 4 : 8;
+    const int NV = K / KV;
+    for (int n = 0; n < N; n++) {
+        const int64_t* bn = b + (int64_t)n * K * PB;
+        // Two accumulators hide the popcount latency
+        __m512i acc0 = _mm512_setzero_si512();
+        __m512i acc1 = _mm512_setzero_si512();
+        int i = 0;
+        for (; i + 2 <= NV; i += 2) {
+            // The weights stream from memory once: one line (2 vectors of b) ahead per step
+            _mm_prefetch((const char*)(bn + i * KV * PB) + GEMM_PREFETCH_BYTES, _MM_HINT_T0);
+            acc0 = _mm512_add_epi64(acc0, _mm512_popcnt_epi64(DotBits<TYPE>(a, bn, i)));
+            acc1 = _mm512_add_epi64(acc1, _mm512_popcnt_epi64(DotBits<TYPE>(a, bn, i + 1)));
+        }
+        if (i < NV)
+            acc0 = _mm512_add_epi64(acc0, _mm512_popcnt_epi64(DotBits<TYPE>(a, bn, i)));
+        acc0 = _mm512_add_epi64(acc0, acc1);
+
+        int acc;
+        if (TYPE == ConvType::TNN)
+            acc = (int)_mm512_mask_reduce_add_epi64(0xAA, acc0) - 2 * (int)_mm512_mask_reduce_add_epi64(0x55, acc0);
+        else
+            acc = (int)_mm512_reduce_add_epi64(acc0);
+
+        // K tail
+        for (int ik = NV * KV; ik < K; ik++) {
+            const int64_t* ak = a + ik * PA;
+            const int64_t* bk = bn + ik * PB;
+            if (TYPE == ConvType::TNN) {
+                int64_t nz = ak[1] & bk[1];
+                acc += (int)popcnt64(nz) - 2 * (int)popcnt64((ak[0] ^ bk[0]) & nz);
+            }
+            else if (TYPE == ConvType::TBN) {
+                acc += (int)popcnt64((ak[0] ^ bk[0]) & ak[1]);
+            }
+            else if (TYPE == ConvType::BTN) {
+                acc += (int)popcnt64((ak[0] ^ bk[0]) & bk[1]);
+            }
+            else {
+                acc += (int)popcnt64(ak[0] ^ bk[0]);
+            }
+        }
+        raw[n] = acc;
+    }
+}
+
+
+template <int V>
+static GEMMMicroKernelFn GEMM_GetWideKernel_AVX512(ConvType TYPE) {
+    switch (TYPE) {
+    case ConvType::TNN: return MicroKernel_AVX512_Wide<ConvType::TNN, V>;
+    case ConvType::TBN: return MicroKernel_AVX512_Wide<ConvType::TBN, V>;
+    case ConvType::BTN: return MicroKernel_AVX512_Wide<ConvType::BTN, V>;
+    default:            return MicroKernel_AVX512_Wide<ConvType::BNN, V>;
+    }
+}
+
+
+GEMMMicroKernel GEMM_GetMicroKernel_AVX512(ConvType TYPE, int Container) {
+    GEMMMicroKernel uk;
+    uk.MR = 4;
+    switch (Container) {
+    case 1:
+        uk.MR = 8;
+        switch (TYPE) {
+        case ConvType::TNN: uk.Kernel = MicroKernel_AVX512<ConvType::TNN>; break;
+        case ConvType::TBN: uk.Kernel = MicroKernel_AVX512<ConvType::TBN>; break;
+        case ConvType::BTN: uk.Kernel = MicroKernel_AVX512<ConvType::BTN>; break;
+        default:            uk.Kernel = MicroKernel_AVX512<ConvType::BNN>; break;
+        }
+        break;
+    case 2:  uk.Kernel = GEMM_GetWideKernel_AVX512<2>(TYPE); break;
+    case 4:  uk.Kernel = GEMM_GetWideKernel_AVX512<4>(TYPE); break;
+    case 8:  uk.Kernel = GEMM_GetWideKernel_AVX512<8>(TYPE); break;
+    default: uk.Kernel = NULL; break;
+    }
+    return uk;
+}
+
+
+GEMMDotKernelFn GEMM_GetDotKernel_AVX512(ConvType TYPE) {
+    switch (TYPE) {
+    case ConvType::TNN: return DotKernel_AVX512<ConvType::TNN>;
+    case ConvType::TBN: return DotKernel_AVX512<ConvType::TBN>;
+    case ConvType::BTN: return DotKernel_AVX512<ConvType::BTN>;
+    default:            return DotKernel_AVX512<ConvType::BNN>;
+    }
+}
+
+#endif // TAB_X86
@@ -1,28 +1,56 @@
 #pragma once
 #include "common.h"
+#include "ThreadPool.h"
+#include "ConvShape.h"
+#include "Allocator.h"
+
+// The KH * KW * C words of each of the OW rows of output row (n, oh), on the window of the shape S (see ConvShape.h)
+template <class S, typename T>
+static void Img2Row_Row(const T* X, T* y, int n, int oh, int C, int H, int W, int KH_, int KW_, int StrideH_, int StrideW_, int OW) {
+    const int KH = ShapeDim<S::KH>(KH_);
+    const int KW = ShapeDim<S::KW>(KW_);
+    const int StrideH = ShapeDim<S::StrideH>(StrideH_);
+    const int StrideW = ShapeDim<S::StrideW>(StrideW_);
+    const int W1 = KH * KW * C;
+    // X[n, oh * StrideH, 0, 0]
+    const T* x = X + ((int64_t)n * H + oh * StrideH) * W * C;
+    if constexpr ((S::KH == 1) && (S::KW == 1) && (S::StrideW == 1)) {
+        // 1x1/s1: the rows are the pixels of the input row
+        for (int i = 0; i < OW * C; i++)
+            y[i] = x[i];
+    }
+    else {
+        for (int ow = 0; ow < OW; ow++) {
+            for (int kh = 0; kh < KH; kh++) {
+                // y[ow, kh, 0 : KW, :] = X[n, oh * StrideH + kh, ow * StrideW : ow * StrideW + KW, :]
+                const T* src = x + ((int64_t)kh * W + ow * StrideW) * C;
+                T* dst = y + (int64_t)ow * W1 + kh * KW * C;
+                for (int i = 0; i < KW * C; i++)
+                    dst[i] = src[i];
+            }
+        }
+    }
+}
 
 template <typename T>
-std::vector<T> Img2Row_NHWCB_to_N_OHOW_KHKWC(T* X, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW) {
+TabTensor<T> Img2Row_NHWCB_to_N_OHOW_KHKWC(T* X, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW) {
 
     const int OH = (H - KH) / StrideH + 1;
     const int OW = (W - KW) / StrideW + 1;
     const int H1 = OH * OW;      // Fused Height
     const int W1 = KH * KW * C;  // Fused Width
-    std::vector<T> y = std::vector<T>(N * H1 * W1);
+    // Every row is copied, no zero fill
+    TabTensor<T> y = TabTensor<T>((size_t)N * H1 * W1);
 
-    for (int n = 0; n < N; n++) {
-        for (int oh = 0; oh < OH; oh++) {
-            for (int ow = 0; ow < OW; ow++) {
-                for (int kh = 0; kh < KH; kh++) {
-                    for (int kw = 0; kw < KW; kw++) {
-                        for (int c = 0; c < C; c++)
-                            // y[N, OH, OW, KH, KW, C] = X[N, H+kh, W+kw, C]
-                            y[(n * H1 + oh * OW + ow) * W1 + kh * KW * C + kw * C + c] = X[((n * H + oh * StrideH + kh) * W + ow * StrideW + kw) * C + c];
-                    }
-                }
-            }
-        }
-    }
+    // One tile per output row, y[N, OH, OW, KH, KW, C] = X[N, H+kh, W+kw, C]
+    TAB_DispatchConvShape(KH, KW, StrideH, StrideW, [&](auto shape) {
+        typedef decltype(shape) S;
+        TAB_ParallelFor(N * OH, [&](int tile, int tid) {
+            const int n = tile / OH;
+            const int oh = tile % OH;
+            Img2Row_Row<S>(X, y.data() + ((int64_t)n * H1 + oh * OW) * W1, n, oh, C, H, W, KH, KW, StrideH, StrideW, OW);
+        });
+    });
 
     return y;
-}
\ No newline at end of file
+}
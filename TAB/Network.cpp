@@ -0,0 +1,472 @@
+#include "common.h"
+#include "GEMM.h"
+#include "TAB_CPU.h"
+#include "Network.h"
+#include "Autotune.h"
+#include "Quantize.h"
+#include "Pooling.h"
+#include <algorithm>
+#include <cstring>
+
+
+// 64-byte aligned offsets in bytes
+static inline size_t AlignBytes(size_t bytes) {
+    return (bytes + 63) / 64 * 64;
+}
+
+// The first byte of the arena, 64-byte aligned by its allocator
+static inline char* NetworkBase(TabNetwork& Net) {
+    return (char*)Net.Arena.data();
+}
+
+
+// Layer i + 1 reads the output of layer i as packed bits: the output pixels keep their channels (conv), or the
+// flatten into an FC layer lines up with whole words
+static bool PackedChain(const TabConvPlan& Plan, const TabConvPlan& Next) {
+    if ((Next.H == Plan.OH) && (Next.W == Plan.OW) && (Next.C == Plan.KN))
+        return true;
+    return (Plan.OH * Plan.OW == 1) || (Plan.KN % cntbits == 0);
+}
+
+
+// The layer whose packed output layer i adds as its shortcut, -1: none
+static int ShortcutSource(const TabNetwork& Net, int i) {
+    const TabLayer& Layer = Net.Layers[i];
+    const int j = i - Layer.Shortcut;
+    if ((Layer.Kind != Layer_Conv) || (Layer.Shortcut <= 0) || (j < 0) || !Net.PackedInput[j + 1])
+        return -1;
+    return j;
+}
+
+
+// Assign the intermediates to slots: tensor i is written by layer i and read by layer i + 1 and the shortcuts up to
+// layer LastRead[i], so a slot is free again once the layer after its last reader starts. Best fit among the free
+// slots, else grow the largest free slot, else a new slot. Written: per tensor the first layer that writes it, the
+// first layer of its fused run for the output of a run (its input is read until the run ends), -1: a tensor inside a
+// fused run, which gets no slot.
+static void PlanSlots(TabNetwork& Net, const std::vector<size_t>& TensorBytes, const std::vector<int>& Written) {
+    const int L = (int)Net.Layers.size();
+    std::vector<int> LastUse;  // of the tensor in each slot
+    Net.Slot = std::vector<int>(L, -1);
+    Net.SlotBytes.clear();
+    for (int i = 0; i < L - 1; i++) {
+        if (Written[i] < 0)
+            continue;
+        int best = -1;
+        for (int s = 0; s < (int)Net.SlotBytes.size(); s++) {
+            if (LastUse[s] >= Written[i])
+                continue;
+            const bool fits = Net.SlotBytes[s] >= TensorBytes[i];
+            if (best < 0)
+                best = s;
+            else if (fits && ((Net.SlotBytes[best] < TensorBytes[i]) || (Net.SlotBytes[s] < Net.SlotBytes[best])))
+                best = s;
+            else if (!fits && (Net.SlotBytes[best] < TensorBytes[i]) && (Net.SlotBytes[s] > Net.SlotBytes[best]))
+                best = s;
+        }
+        if (best < 0) {
+            best = (int)Net.SlotBytes.size();
+            Net.SlotBytes.push_back(0);
+            LastUse.push_back(0);
+        }
+        if (Net.SlotBytes[best] < TensorBytes[i])
+            Net.SlotBytes[best] = TensorBytes[i];
+        LastUse[best] = Net.LastRead[i];
+        Net.Slot[i] = best;
+    }
+}
+
+
+// Plan the slots of the intermediates (see PlanSlots()) for the fused runs of the network, and allocate the arena:
+// the slots, then the scratch shared by all plans. The shortcuts read the slots of their layers.
+static void PlanArena(TabNetwork& Net) {
+    const int L = (int)Net.Layers.size();
+    std::vector<size_t> TensorBytes(L, 0);
+    std::vector<int> Written(L);
+    for (int i = 0; i < L; i++) {
+        Written[i] = i;
+        if (i + 1 < L)
+            TensorBytes[i] = TAB_ConvPlanOutputBytes(Net.Plans[i], Net.Epilogues[i]);
+    }
+    for (const TabFusedRun& Run : Net.Runs) {
+        for (int i = Run.First; i < Run.Last; i++)
+            Written[i] = -1;
+        Written[Run.Last] = Run.First;
+    }
+    PlanSlots(Net, TensorBytes, Written);
+
+    size_t offset = 0;
+    Net.SlotOffset.clear();
+    for (size_t s = 0; s < Net.SlotBytes.size(); s++) {
+        Net.SlotOffset.push_back(offset);
+        offset += AlignBytes(Net.SlotBytes[s]);
+    }
+    Net.ScratchOffset = offset;
+    Net.ScratchBytes = 0;
+    for (int i = 0; i < L; i++) {
+        if (Net.Layers[i].Kind != Layer_Conv)
+            continue;
+        const size_t Bytes = TAB_ConvPlanArenaBytes(Net.Plans[i]);
+        Net.ScratchBytes = (Bytes > Net.ScratchBytes) ? Bytes : Net.ScratchBytes;
+    }
+    Net.PeakBytes = Net.ScratchOffset + AlignBytes(Net.ScratchBytes) + Net.FusedArena.size() * sizeof(int64_t);
+    Net.Arena = TabTensor<int64_t>((Net.ScratchOffset + AlignBytes(Net.ScratchBytes)) / sizeof(int64_t), 0);
+    char* base = NetworkBase(Net);
+    for (int i = 0; i < L; i++) {
+        TAB_ShareConvPlanArena(Net.Plans[i], (void*)(base + Net.ScratchOffset), Net.ScratchBytes);
+        const int j = ShortcutSource(Net, i);
+        if (j >= 0)
+            Net.Epilogues[i].ResidualBits = (const int64_t*)(base + Net.SlotOffset[Net.Slot[j]]);
+    }
+}
+
+
+TabNetwork TAB_CreateNetwork(const std::vector<TabLayer>& Layers, int Batch_Size, ConvAlgo Algo) {
+    TabNetwork Net;
+    const int L = (int)Layers.size();
+    Net.Batch_Size = Batch_Size;
+    Net.Layers = Layers;
+
+    for (int i = 0; i < L; i++) {
+        const TabLayer& Layer = Layers[i];
+        if (Layer.Kind == Layer_MaxPool) {
+            // The shape of the pooling, on its unpadded input: never run, no weights
+            Net.Plans.push_back(TAB_CreateConvPlan(Layer.TYPE, Layer.PaddingH, Layer.PaddingW, Layer.StrideH, Layer.StrideW, Batch_Size, Layer.C, Layer.H, Layer.W,
+                Layer.C, Layer.KH, Layer.KW, Algo));
+            TAB_SetConvPlanPaddingFree(Net.Plans.back(), true);
+            Net.Weights.push_back(TabPackedWeights());
+            continue;
+        }
+        Net.Plans.push_back(TAB_CreateConvPlan(Layer.TYPE, Layer.PaddingH, Layer.PaddingW, Layer.StrideH, Layer.StrideW, Batch_Size, Layer.C, Layer.H, Layer.W,
+            Layer.KN, Layer.KH, Layer.KW, Algo, Layer.Groups));
+        if (Layer.PaddingFree)
+            TAB_SetConvPlanPaddingFree(Net.Plans.back(), true);
+        TAB_TuneConvPlan(Net.Plans.back());
+        Net.Weights.push_back(TAB_PackWeights(Layer.TYPE, Layer.QWeights, Layer.KN, Layer.C, Layer.KH, Layer.KW, Layer.Groups));
+    }
+
+    // The format of every intermediate and the epilogue that writes it
+    Net.PackedInput = std::vector<bool>(L, false);
+    Net.QThresholds = std::vector<float>((size_t)L * Batch_Size, 0);
+    for (int i = 0; i < L; i++) {
+        GEMMEpilogue Epilogue = (Layers[i].Kind == Layer_Conv) ? Layers[i].Epilogue : GEMMEpilogue();
+        Epilogue.Output = Output_Float;
+        if (i + 1 < L) {
+            const TabConvPlan& Plan = Net.Plans[i];
+            const TabConvPlan& Next = Net.Plans[i + 1];
+            const TabLayer& NextLayer = Layers[i + 1];
+            if (PackedChain(Plan, Next)) {
+                // The thresholds of a flatten are per feature, not per output channel of this layer
+                const bool Flatten = !((Next.H == Plan.OH) && (Next.W == Plan.OW) && (Next.C == Plan.KN));
+                // The epilogue of the layer (scale, bias, activation, residual) with the packed output
+                const GEMMEpilogue Packed = TAB_PackedOutputEpilogue(Plan, Next, NextLayer.Threshold, Flatten ? NULL : NextLayer.Thresholds);
+                Epilogue.Output = Packed.Output;
+                Epilogue.OH = Packed.OH;
+                Epilogue.OW = Packed.OW;
+                Epilogue.PaddingH = Packed.PaddingH;
+                Epilogue.PaddingW = Packed.PaddingW;
+                Epilogue.Threshold = Packed.Threshold;
+                Epilogue.Thresholds = Packed.Thresholds;
+                Net.PackedInput[i + 1] = true;
+            }
+            else {
+                for (int n = 0; n < Batch_Size; n++)
+                    Net.QThresholds[(size_t)(i + 1) * Batch_Size + n] = NextLayer.Threshold;
+            }
+        }
+        Net.Epilogues.push_back(Epilogue);
+    }
+
+    // The shortcuts: the packed format of their layer, which stays in its slot until they are read
+    Net.LastRead = std::vector<int>(L);
+    for (int i = 0; i < L; i++)
+        Net.LastRead[i] = i + 1;
+    for (int i = 0; i < L; i++) {
+        const int j = ShortcutSource(Net, i);
+        if (j < 0)
+            continue;
+        Net.LastRead[j] = std::max(Net.LastRead[j], i);
+        GEMMEpilogue& ep = Net.Epilogues[i];
+        ep.ResidualTernary = (Net.Epilogues[j].Output == Output_Ternary);
+        ep.ResidualPaddingH = Net.Epilogues[j].PaddingH;
+        ep.ResidualPaddingW = Net.Epilogues[j].PaddingW;
+        ep.ResidualScale = ep.ResidualScale ? ep.ResidualScale : 1;
+    }
+    Net.BandRows = 0;
+    PlanArena(Net);
+    return Net;
+}
+
+
+// The words of one pixel of the padded input of a plan
+static inline int64_t PixelWords(const TabConvPlan& Plan) {
+    const int P = ((Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::TBN)) ? BITS : 1;
+    return (int64_t)((Plan.C + cntbits - 1) / cntbits) * P;
+}
+
+
+// Layer i runs in bands: a dense conv on a padded input
+static bool Fusible(const TabNetwork& Net, int i) {
+    const TabConvPlan& Plan = Net.Plans[i];
+    return (Net.Layers[i].Kind == Layer_Conv) && (Plan.Groups == 1) && !Plan.PaddingFree && (Plan.H > 1);
+}
+
+// Layers i and i + 1 run in one fused run: layer i + 1 reads the packed output of layer i pixel by pixel, and no
+// shortcut reads it later (it keeps a slot)
+static bool FusedChain(const TabNetwork& Net, int i) {
+    const TabConvPlan& Plan = Net.Plans[i];
+    const TabConvPlan& Next = Net.Plans[i + 1];
+    for (int j = i + 1; j <= Net.LastRead[i]; j++)
+        if (ShortcutSource(Net, j) == i)
+            return false;
+    return Fusible(Net, i) && Fusible(Net, i + 1) && Net.PackedInput[i + 1] && (Next.H == Plan.OH) && (Next.W == Plan.OW) && (Next.C == Plan.KN);
+}
+
+
+// The bands of a run for BandRows output rows of its last layer, top to bottom, 5 ints per band and layer (see
+// TabFusedRun), and the most padded rows of the band input of every layer
+// The band input of a layer holds the padded rows [pa, pb) its new output rows [lo, hi) read. The rows the band before
+// already holds are kept, the layer before only computes the rest, so every row is computed once.
+static void PlanBands(const TabNetwork& Net, const TabFusedRun& Run, int BandRows, std::vector<int>& Bands, std::vector<int>& InputRows) {
+    const int Layers = Run.Last - Run.First + 1;
+    const int OH = Net.Plans[Run.Last].OH;
+    std::vector<int> Top(Layers, 0), End(Layers, 0);  // the padded rows [Top, End) in the band input of each layer
+    Bands.clear();
+    InputRows = std::vector<int>(Layers, 0);
+    for (int r0 = 0; r0 < OH; r0 += BandRows) {
+        const size_t band = Bands.size();
+        Bands.resize(band + (size_t)Layers * 5, 0);
+        int lo = r0, hi = std::min(r0 + BandRows, OH);
+        for (int j = Layers - 1; j >= 0; j--) {
+            const TabConvPlan& Plan = Net.Plans[Run.First + j];
+            int* r = Bands.data() + band + j * 5;
+            r[4] = -1;
+            if (hi <= lo)
+                continue;
+            const int pa = lo * Plan.StrideH;
+            const int pb = (hi - 1) * Plan.StrideH + Plan.KH;
+            r[0] = lo;
+            r[1] = hi;
+            r[2] = pa - Top[j];
+            r[3] = std::max(std::min(End[j], pb) - pa, 0);
+            r[4] = pb - pa;
+            InputRows[j] = std::max(InputRows[j], pb - pa);
+            // The new padded rows are output rows of the layer before, minus its padding
+            if (j > 0) {
+                lo = std::max(std::max(pa, End[j]) - Plan.PaddingH, 0);
+                hi = std::min(pb - Plan.PaddingH, Net.Plans[Run.First + j - 1].OH);
+            }
+            Top[j] = pa;
+            End[j] = pb;
+        }
+    }
+}
+
+
+// The bytes of the band inputs of the run for bands of BandRows rows
+static size_t BandBytes(const TabNetwork& Net, const TabFusedRun& Run, int BandRows) {
+    std::vector<int> Bands, InputRows;
+    PlanBands(Net, Run, BandRows, Bands, InputRows);
+    size_t Bytes = 0;
+    for (int i = Run.First + 1; i <= Run.Last; i++) {
+        const TabConvPlan& Plan = Net.Plans[i];
+        Bytes += AlignBytes((size_t)InputRows[i - Run.First] * Plan.PackedW * PixelWords(Plan) * sizeof(int64_t));
+    }
+    return Bytes;
+}
+
+
+// The plan of layer Plan for a band of Rows padded input rows: the rows are a slice of the padded input, so there is
+// no padding along H
+static TabConvPlan BandPlan(const TabConvPlan& Plan, int Rows) {
+    TabConvPlan Band = TAB_CreateConvPlan(Plan.TYPE, 0, Plan.PaddingW, Plan.StrideH, Plan.StrideW, 1, Plan.C, Rows, Plan.W, Plan.KN, Plan.KH, Plan.KW, Plan.Algo);
+    TAB_SetConvPlanBlocking(Band, Plan.Algo, Plan.Blocking);
+    return Band;
+}
+
+
+void TAB_SetNetworkFusion(TabNetwork& Net, int BandRows) {
+    const int L = (int)Net.Layers.size();
+    Net.BandRows = 0;
+    Net.Runs.clear();
+    TabTensor<int64_t>().swap(Net.FusedArena);
+    if (BandRows == 0) {
+        PlanArena(Net);
+        return;
+    }
+
+    // The runs, each with the bands of the most rows within TAB_FUSION_BYTES (at least 1)
+    size_t BandsBytes = 0;
+    Net.FusedScratchBytes = 0;
+    for (int i = 0; i < L; i++) {
+        int Last = i;
+        while ((Last + 1 < L) && FusedChain(Net, Last))
+            Last++;
+        TabFusedRun Run;
+        Run.First = i;
+        Run.Last = Last;
+        i = Last;
+        if ((Run.Last == Run.First) || ((Run.First > 0) && !Net.PackedInput[Run.First]))
+            continue;
+        const int OH = Net.Plans[Run.Last].OH;
+        int Rows = (BandRows > 0) ? std::min(BandRows, OH) : 1;
+        while ((BandRows < 0) && (Rows < OH) && (BandBytes(Net, Run, Rows + 1) <= TAB_FUSION_BYTES))
+            Rows++;
+
+        // The band plans, one per count of input rows of a layer, and the band inputs (the runs share them)
+        const int Layers = Run.Last - Run.First + 1;
+        std::vector<int> InputRows;
+        PlanBands(Net, Run, Rows, Run.Bands, InputRows);
+        Run.Plans = std::vector<std::vector<TabConvPlan>>(Layers);
+        for (size_t b = 0; b < Run.Bands.size(); b += 5) {
+            const int j = (int)(b / 5 % Layers);
+            int& plan = Run.Bands[b + 4];
+            if (plan < 0)
+                continue;
+            std::vector<TabConvPlan>& Plans = Run.Plans[j];
+            int p = 0;
+            while ((p < (int)Plans.size()) && (Plans[p].H != plan))
+                p++;
+            if (p == (int)Plans.size()) {
+                Plans.push_back(BandPlan(Net.Plans[Run.First + j], plan));
+                Net.FusedScratchBytes = std::max(Net.FusedScratchBytes, TAB_ConvPlanArenaBytes(Plans.back()));
+            }
+            plan = p;
+        }
+        size_t offset = 0;
+        Run.BufferOffset = std::vector<size_t>(Layers, 0);
+        for (int j = 1; j < Layers; j++) {
+            const TabConvPlan& Plan = Net.Plans[Run.First + j];
+            Run.BufferOffset[j] = offset;
+            offset += AlignBytes((size_t)InputRows[j] * Plan.PackedW * PixelWords(Plan) * sizeof(int64_t));
+        }
+        BandsBytes = std::max(BandsBytes, offset);
+        Net.Runs.push_back(Run);
+    }
+    if (Net.Runs.empty()) {
+        PlanArena(Net);
+        return;
+    }
+    Net.BandRows = BandRows;
+
+    // One fusion arena: the band inputs, the quantized input of a run of the first layer, the scratch of the band plans
+    Net.FusedQXOffset = BandsBytes;
+    const size_t QXBytes = (Net.Runs[0].First == 0) ? (size_t)TAB_ConvPlanInputWords(Net.Plans[0]) * sizeof(int64_t) : 0;
+    Net.FusedScratchOffset = Net.FusedQXOffset + AlignBytes(QXBytes);
+    // The padding of the quantized input is never written, it keeps these zeros
+    Net.FusedArena = TabTensor<int64_t>((Net.FusedScratchOffset + AlignBytes(Net.FusedScratchBytes)) / sizeof(int64_t), 0);
+    char* base = (char*)Net.FusedArena.data();
+    for (TabFusedRun& Run : Net.Runs)
+        for (std::vector<TabConvPlan>& Plans : Run.Plans)
+            for (TabConvPlan& Plan : Plans)
+                TAB_ShareConvPlanArena(Plan, (void*)(base + Net.FusedScratchOffset), Net.FusedScratchBytes);
+    PlanArena(Net);
+}
+
+
+// Run the layers of Run depth first, from the padded input QX of its first layer into y, the output of its last
+// layer as written by its epilogue
+static void RunFused(TabNetwork& Net, TabFusedRun& Run, const int64_t* QX, void* y) {
+    const int Layers = Run.Last - Run.First + 1;
+    const int Bands = (int)Run.Bands.size() / (Layers * 5);
+    char* base = (char*)Net.FusedArena.data();
+
+    // The output rows of the last layer: the packed input of the next layer with its padding rows, which the bands do
+    // not write, or the rows of y
+    const TabConvPlan& Out = Net.Plans[Run.Last];
+    GEMMEpilogue Last = Net.Epilogues[Run.Last];
+    const int PadH = ((Last.Output == Output_Ternary) || (Last.Output == Output_Binary)) ? Last.PaddingH : 0;
+    Last.OH = 1;
+    Last.OW = Out.OW;
+    Last.PaddingH = 0;
+    const size_t RowBytes = TABGEMM_OutputBytes(&Last, Out.OW, Out.KN);
+
+    for (int n = 0; n < Net.Batch_Size; n++) {
+        char* yn = (char*)y + n * (Out.OH + 2 * PadH) * RowBytes;
+        if (PadH > 0) {
+            std::memset(yn, 0, PadH * RowBytes);
+            std::memset(yn + (PadH + Out.OH) * RowBytes, 0, PadH * RowBytes);
+        }
+        for (int b = 0; b < Bands; b++) {
+            for (int j = 0; j < Layers; j++) {
+                const int i = Run.First + j;
+                const TabConvPlan& Plan = Net.Plans[i];
+                const int* r = Run.Bands.data() + ((size_t)b * Layers + j) * 5;
+                const int64_t* in = (j == 0) ? (QX + ((int64_t)n * Plan.PackedH + r[0] * Plan.StrideH) * Plan.PackedW * PixelWords(Plan)) : (const int64_t*)(base + Run.BufferOffset[j]);
+                if (j + 1 == Layers) {
+                    TAB_RunConvPlan(Run.Plans[j][r[4]], in, Net.Weights[i], TABGEMM_ResidualFrom(Last, Out.OH, Out.OW, Out.KN, n, r[0]), (void*)(yn + (r[0] + PadH) * RowBytes));
+                    continue;
+                }
+
+                // The band input of the next layer: keep the rows it reads again, zero its new padding rows, and write
+                // the new rows of this layer after them
+                const TabConvPlan& Next = Net.Plans[i + 1];
+                const int* rn = r + 5;
+                if (rn[4] < 0)
+                    continue;
+                const int64_t line = Next.PackedW * PixelWords(Next);
+                const int pa = rn[0] * Next.StrideH;
+                const int Rows = Run.Plans[j + 1][rn[4]].H;
+                int64_t* band = (int64_t*)(base + Run.BufferOffset[j + 1]);
+                if (rn[3] > 0)
+                    std::memmove(band, band + rn[2] * line, rn[3] * line * sizeof(int64_t));
+                for (int p = pa + rn[3]; p < pa + Rows; p++)
+                    if ((p < Next.PaddingH) || (p >= Next.PaddingH + Next.H))
+                        std::fill(band + (p - pa) * line, band + (p - pa + 1) * line, (int64_t)0);
+                if (r[4] < 0)
+                    continue;
+                // The residual from the first new row of the band
+                GEMMEpilogue ep = TABGEMM_ResidualFrom(Net.Epilogues[i], Plan.OH, Plan.OW, Plan.KN, n, r[0]);
+                ep.PaddingH = 0;
+                TAB_RunConvPlan(Run.Plans[j][r[4]], in, Net.Weights[i], ep, (void*)(band + (r[0] + Next.PaddingH - pa) * line));
+            }
+        }
+    }
+}
+
+
+int64_t TAB_NetworkOutputSize(const TabNetwork& Net) {
+    return TAB_ConvPlanOutputSize(Net.Plans.back());
+}
+
+
+void TAB_RunNetwork(TabNetwork& Net, const float* X, float* Q_Threshold, float* y) {
+    const int L = (int)Net.Layers.size();
+    char* base = NetworkBase(Net);
+    size_t run = 0;
+    for (int i = 0; i < L; i++) {
+        if ((run < Net.Runs.size()) && (Net.Runs[run].First == i)) {
+            // A fused run, from the packed input of its first layer: the slot before, or X quantized into the fusion arena
+            TabFusedRun& Run = Net.Runs[run++];
+            const TabConvPlan& Plan = Net.Plans[i];
+            const int64_t* qx = (const int64_t*)(base + ((i > 0) ? Net.SlotOffset[Net.Slot[i - 1]] : 0));
+            if (i == 0) {
+                int64_t* qx0 = (int64_t*)((char*)Net.FusedArena.data() + Net.FusedQXOffset);
+                if ((Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::TBN))
+                    Ternarize_NCHW_to_NHWCB(X, Plan.PaddingH, Plan.PaddingW, Q_Threshold, Net.Batch_Size, Plan.C, Plan.H, Plan.W, qx0);
+                else
+                    Binarize_NCHW_to_NHWC(X, Plan.PaddingH, Plan.PaddingW, Q_Threshold, Net.Batch_Size, Plan.C, Plan.H, Plan.W, qx0);
+                qx = qx0;
+            }
+            i = Run.Last;
+            RunFused(Net, Run, qx, (Net.Slot[i] < 0) ? (void*)y : (void*)(base + Net.SlotOffset[Net.Slot[i]]));
+            continue;
+        }
+        void* out = (Net.Slot[i] < 0) ? (void*)y : (void*)(base + Net.SlotOffset[Net.Slot[i]]);
+        if (i == 0) {
+            TAB_RunConvPlan(Net.Plans[i], X, Q_Threshold, Net.Weights[i], Net.Epilogues[i], out);
+            continue;
+        }
+        const void* in = (const void*)(base + Net.SlotOffset[Net.Slot[i - 1]]);
+        if (Net.Layers[i].Kind == Layer_MaxPool) {
+            const TabLayer& Layer = Net.Layers[i];
+            const bool Ternary = (Layer.TYPE == ConvType::TNN) || (Layer.TYPE == ConvType::TBN);
+            MaxPool_NHWC((const int64_t*)in, Ternary, Net.Batch_Size, Layer.C, Layer.H, Layer.W, Layer.KH, Layer.KW, Layer.PaddingH, Layer.PaddingW,
+                Layer.StrideH, Layer.StrideW, Net.Epilogues[i].PaddingH, Net.Epilogues[i].PaddingW, (int64_t*)out);
+        }
+        else if (Net.PackedInput[i])
+            TAB_RunConvPlan(Net.Plans[i], (const int64_t*)in, Net.Weights[i], Net.Epilogues[i], out);
+        else
+            TAB_RunConvPlan(Net.Plans[i], (const float*)in, Net.QThresholds.data() + (size_t)i * Net.Batch_Size, Net.Weights[i], Net.Epilogues[i], out);
+    }
+}
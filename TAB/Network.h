@@ -0,0 +1,108 @@
+#pragma once
+#include "common.h"
+#include "GEMM.h"
+#include "TAB_CPU.h"
+
+// A sequence of TAB conv/FC layers run as one network
+// TAB_CreateNetwork() creates the plans, prepacks the weights and plans the memory of all intermediates once:
+// every intermediate lives from the layer that writes it to the layer that reads it, and is assigned to a slot of
+// one arena whose last tensor is already dead (ping-pong for a sequence). The plans share one scratch section.
+// TAB_RunNetwork() makes no heap allocation in the steady state.
+// The intermediates are the packed inputs of the next layer, written by the GEMM write-back (Output_Ternary /
+// Output_Binary). A flatten into an FC layer whose channels do not fill whole 64-bit words goes through floats instead.
+// An intermediate read again by a later layer as its shortcut (TabLayer::Shortcut) lives until that layer.
+// TAB_SetNetworkFusion() runs the chains of conv layers depth first, over bands of output rows.
+
+// The bytes of the packed band inputs of a fused run, for TAB_SetNetworkFusion(BandRows < 0): a share of the L2 cache
+#define TAB_FUSION_BYTES (256 << 10)
+
+enum TabLayerKind {
+    Layer_Conv = 0,    // conv or FC
+    Layer_MaxPool = 1  // max pooling of the packed input (see Pooling.h)
+};
+
+// One conv or FC layer. FC: H = W = KH = KW = 1, C = the input features.
+// After a conv layer of OH x OW x KN outputs, the next layer reads C = KN at H x W = OH x OW, or, for an FC layer,
+// the flattened C = OH * OW * KN (in OH_OW_KN order) at H x W = 1 x 1.
+// Max pooling: KN = C, KH x KW windows with the padding and stride, no weights or epilogue. It reads the packed output
+// of the layer before, quantized against its Threshold (TYPE: the activations), and writes the packed input of the
+// next layer, whose activations must be the same: it is neither the first nor the last layer, and a flatten after it
+// needs whole 64-bit words (C % 64 == 0).
+struct TabLayer {
+    TabLayerKind Kind;
+    ConvType TYPE;
+    int PaddingH, PaddingW, StrideH, StrideW;
+    int C, H, W;
+    int KN, KH, KW;
+    int Groups;               // grouped conv (0 or 1: dense), see TabConvPlan
+    bool PaddingFree;         // keep the quantized input unpadded, see TAB_SetConvPlanPaddingFree()
+    const int64_t* QWeights;  // from Ternarize_NCHW_to_NHWCB() (TNN, BTN) or Binarize_NCHW_to_NHWC() (TBN, BNN)
+
+    // The quantization threshold of the input (not used by the first layer, see TAB_RunNetwork())
+    float Threshold;
+    const float* Thresholds;  // per input channel, NULL: Threshold for all. Not used after a flatten.
+
+    // The epilogue of the output: Scale, Bias, Activation, Alpha, Alphas and the residual (Residual, ResidualBits of
+    // the N_OH_OW_KN output), Output is set by the network
+    GEMMEpilogue Epilogue;
+
+    // > 0: add the packed output of layer i - Shortcut (the input of layer i - Shortcut + 1), e.g. 2 for the input of a
+    // block of two convs, as the ResidualBits of the epilogue times its ResidualScale (0: 1). It has the output shape
+    // of this layer and is not a float flatten. 0: none, or the ResidualBits of the epilogue.
+    int Shortcut;
+};
+
+// A run of conv layers fused depth first (see TAB_SetNetworkFusion())
+struct TabFusedRun {
+    int First, Last;                              // the layers [First, Last]
+    std::vector<std::vector<TabConvPlan>> Plans;  // per layer of the run: its band plans, one per count of input rows
+    // Per band and layer of the run: its new output rows [lo, hi), then for its band input the row of the band before it
+    // starts at and the rows it keeps from there, and its plan (-1: no new rows)
+    std::vector<int> Bands;
+    std::vector<size_t> BufferOffset;             // per layer of the run: its band input in the fusion arena, in bytes (not used by First)
+};
+
+struct TabNetwork {
+    int Batch_Size;
+    std::vector<TabLayer> Layers;
+    std::vector<TabConvPlan> Plans;
+    std::vector<TabPackedWeights> Weights;
+    std::vector<GEMMEpilogue> Epilogues;  // the epilogues as run, with the packed outputs resolved
+    std::vector<bool> PackedInput;        // layer i reads packed bits (else floats)
+    std::vector<int> Slot;                // the slot of the output of layer i, -1: the network output y (or inside a fused run)
+    std::vector<int> LastRead;            // the last layer that reads the output of layer i: i + 1, or a later shortcut
+    std::vector<float> QThresholds;       // the per-image thresholds of the float inputs, Batch_Size per layer
+
+    // The arena, 64-byte aligned sections in bytes: slot 0 | slot 1 | ... | scratch
+    TabTensor<int64_t> Arena;
+    std::vector<size_t> SlotOffset, SlotBytes;
+    size_t ScratchOffset, ScratchBytes;
+    size_t PeakBytes;                     // the working memory of one inference: the slots, the scratch and the fusion arena
+
+    // Depth-first fusion (see TAB_SetNetworkFusion()), 0: off
+    int BandRows;
+    std::vector<TabFusedRun> Runs;
+    // The fusion arena, 64-byte aligned sections in bytes: band inputs | quantized network input | scratch of the band plans
+    TabTensor<int64_t> FusedArena;
+    size_t FusedQXOffset, FusedScratchOffset, FusedScratchBytes;
+};
+
+// Algo: the algorithm of every plan, unless the tuning cache holds the layer (see Autotune.h)
+TabNetwork TAB_CreateNetwork(const std::vector<TabLayer>& Layers, int Batch_Size, ConvAlgo Algo = Algo_Implicit);
+
+// The number of floats of the network output: Batch_Size * OH * OW * KN of the last layer, in N_OH_OW_KN format
+int64_t TAB_NetworkOutputSize(const TabNetwork& Net);
+
+// Depth-first fusion: every run of dense conv layers that chain pixel by pixel through packed intermediates (no
+// grouped, padding-free or FC layers) is computed one image and one band of output rows of its last layer at a time.
+// Each layer of the run computes the new rows the next one reads for the band into a small packed band input of the
+// next layer, which keeps the halo rows of the band before. The intermediates of a band stay in the cache, only the
+// input of the run and its output go through memory, and every row is computed once.
+// A layer runs a band as a batch 1 plan on the padded rows of the band (no padding along H), with the algorithm and
+// blocking of its own plan. The results are the same as without fusion.
+// BandRows: the output rows of the last layer of a run per band, < 0: the most rows whose band inputs fit in
+// TAB_FUSION_BYTES, 0: off. The intermediates inside a run get no slot, the arena is planned again.
+void TAB_SetNetworkFusion(TabNetwork& Net, int BandRows);
+
+// X: the NCHW float input of the first layer, Q_Threshold: its per-image thresholds (NULL: 0)
+void TAB_RunNetwork(TabNetwork& Net, const float* X, float* Q_Threshold, float* y);
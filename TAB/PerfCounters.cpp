@@ -0,0 +1,363 @@
+#include "common.h"
+#include "PerfCounters.h"
+
+#ifdef TAB_PERF
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define TAB_PERF_EVENT
+#endif
+#if defined(TAB_X86) && !(defined(_MSC_VER) && !defined(__clang__))
+#include <x86intrin.h>
+#endif
+
+static const char* CounterNames[TAB_Counters] = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses" };
+static const char* StageNames[TAB_Stages] = { "quantize", "img2row", "gemm", "epilogue" };
+
+struct TabPerfLayer {
+    std::string Name;
+    int64_t Calls[TAB_Stages];
+    double Seconds[TAB_Stages];
+    double Counts[TAB_Stages][TAB_Counters];
+};
+
+#ifdef TAB_PERF_EVENT
+// The counter group of one thread, read at once through its leader
+struct CounterGroup {
+    std::vector<int> Fds;       // Fds[0] is the leader
+    std::vector<int> Counters;  // the counter of each fd, in the order of the values of a group read
+};
+#endif
+
+struct PerfState {
+    std::mutex Lock;
+    std::map<std::string, TabPerfLayer> Layers;
+    bool Events;                 // the counters come from perf_event_open()
+    std::string Fallback;        // why they do not
+    bool Counted[TAB_Counters];  // the counters that are counted
+#ifdef TAB_PERF_EVENT
+    std::map<int, CounterGroup> Groups;  // per thread id
+    double Retired[TAB_Counters];        // the final counts of the threads that exited
+#endif
+};
+
+static thread_local TabPerfLayer* CurrentLayer = NULL;
+
+
+#ifdef TAB_PERF_EVENT
+static const struct {
+    uint32_t Type;
+    uint64_t Config;
+} Events[TAB_Counters] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static int OpenEvent(int tid, int Counter, int Leader) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = Events[Counter].Type;
+    attr.config = Events[Counter].Config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, tid, -1, Leader, PERF_FLAG_FD_CLOEXEC);
+}
+
+// The counters of thread tid that open, the first one leads the group. False when none opens.
+static bool OpenGroup(int tid, CounterGroup& Group) {
+    for (int c = 0; c < TAB_Counters; c++) {
+        const int fd = OpenEvent(tid, c, Group.Fds.empty() ? -1 : Group.Fds[0]);
+        if (fd < 0)
+            continue;
+        Group.Fds.push_back(fd);
+        Group.Counters.push_back(c);
+    }
+    return !Group.Fds.empty();
+}
+
+static void CloseGroup(CounterGroup& Group) {
+    for (int i = (int)Group.Fds.size() - 1; i >= 0; i--)
+        close(Group.Fds[i]);
+}
+
+// Adds the counts of the group to Counts, scaled up when the group was multiplexed with other events
+static void ReadGroup(const CounterGroup& Group, double* Counts) {
+    uint64_t values[3 + TAB_Counters];
+    if (read(Group.Fds[0], values, sizeof(values)) < (ssize_t)(3 * sizeof(uint64_t)))
+        return;
+    const uint64_t enabled = values[1];
+    const uint64_t running = values[2];
+    const double scale = ((running > 0) && (running < enabled)) ? ((double)enabled / running) : 1.0;
+    for (uint64_t i = 0; (i < values[0]) && (i < Group.Counters.size()); i++)
+        Counts[Group.Counters[i]] += scale * values[3 + i];
+}
+
+// Open the groups of the new threads of the process, retire the ones of the threads that exited
+static void RefreshThreads(PerfState& State) {
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir)
+        return;
+    std::map<int, bool> alive;
+    while (dirent* e = readdir(dir)) {
+        const int tid = std::atoi(e->d_name);
+        if (tid > 0)
+            alive[tid] = true;
+    }
+    closedir(dir);
+
+    for (auto it = State.Groups.begin(); it != State.Groups.end();) {
+        if (alive.count(it->first)) {
+            ++it;
+            continue;
+        }
+        ReadGroup(it->second, State.Retired);
+        CloseGroup(it->second);
+        it = State.Groups.erase(it);
+    }
+    for (const auto& t : alive) {
+        if (State.Groups.count(t.first))
+            continue;
+        CounterGroup Group;
+        if (OpenGroup(t.first, Group))
+            State.Groups[t.first] = Group;
+    }
+}
+#endif
+
+
+// The cycle counter of the fallback: the TSC on x86, ns elsewhere
+#if defined(TAB_X86)
+static const char* FallbackName = "rdtsc";
+#else
+static const char* FallbackName = "ns";
+#endif
+
+static double Ticks() {
+#if defined(TAB_X86)
+    return (double)__rdtsc();
+#else
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static double Now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The counts of the process so far, with the lock held
+static void ReadCounts(PerfState& State, double* Counts) {
+    std::fill(Counts, Counts + TAB_Counters, 0.0);
+#ifdef TAB_PERF_EVENT
+    if (State.Events) {
+        for (int c = 0; c < TAB_Counters; c++)
+            Counts[c] = State.Retired[c];
+        for (const auto& g : State.Groups)
+            ReadGroup(g.second, Counts);
+        return;
+    }
+#endif
+    Counts[Counter_Cycles] = Ticks();
+}
+
+
+static void DumpAtExit() {
+    const char* path = std::getenv("TAB_PERF_DUMP");
+    if (!std::strcmp(path, "stderr") || !std::strcmp(path, "stdout")) {
+        TAB_PerfDump(std::strcmp(path, "stderr") ? stdout : stderr);
+        return;
+    }
+    FILE* f = std::fopen(path, "w");
+    if (!f)
+        return;
+    TAB_PerfDump(f);
+    std::fclose(f);
+}
+
+// Function-local, the counters of the first thread decide between perf_event_open() and the fallback
+static PerfState& State() {
+    static PerfState state;
+    static bool ready = [] {
+        state.Events = false;
+        std::fill(state.Counted, state.Counted + TAB_Counters, false);
+        state.Counted[Counter_Cycles] = true;
+        state.Fallback = "not supported on this OS";
+#ifdef TAB_PERF_EVENT
+        std::fill(state.Retired, state.Retired + TAB_Counters, 0.0);
+        CounterGroup Group;
+        if (OpenGroup((int)syscall(SYS_gettid), Group)) {
+            state.Events = true;
+            state.Counted[Counter_Cycles] = false;
+            for (int c : Group.Counters)
+                state.Counted[c] = true;
+            CloseGroup(Group);
+            RefreshThreads(state);
+        }
+        else
+            state.Fallback = std::strerror(errno);
+#endif
+        if (std::getenv("TAB_PERF_DUMP"))
+            std::atexit(DumpAtExit);
+        return true;
+    }();
+    (void)ready;
+    return state;
+}
+
+
+bool TAB_PerfAvailable() {
+    return State().Events;
+}
+
+
+void TAB_PerfReset() {
+    PerfState& state = State();
+    std::lock_guard<std::mutex> lk(state.Lock);
+    // The layers stay, running stages keep pointers to them
+    for (auto& l : state.Layers) {
+        TabPerfLayer& Layer = l.second;
+        std::fill(Layer.Calls, Layer.Calls + TAB_Stages, 0);
+        std::fill(Layer.Seconds, Layer.Seconds + TAB_Stages, 0.0);
+        std::fill(&Layer.Counts[0][0], &Layer.Counts[0][0] + TAB_Stages * TAB_Counters, 0.0);
+    }
+}
+
+
+void TAB_PerfDump(FILE* f) {
+    PerfState& state = State();
+    std::lock_guard<std::mutex> lk(state.Lock);
+    if (state.Events)
+        std::fprintf(f, "# TAB perf counters per call, perf_event_open() on all threads\n");
+    else
+        std::fprintf(f, "# TAB perf counters per call, %s on the calling thread (perf_event_open(): %s)\n", FallbackName, state.Fallback.c_str());
+    std::fprintf(f, "%-52s %-8s %8s %10s", "layer", "stage", "calls", "ms");
+    for (int c = 0; c < TAB_Counters; c++)
+        std::fprintf(f, " %14s", CounterNames[c]);
+    std::fprintf(f, " %6s\n", "IPC");
+    for (const auto& l : state.Layers) {
+        const TabPerfLayer& Layer = l.second;
+        for (int s = 0; s < TAB_Stages; s++) {
+            const int64_t calls = Layer.Calls[s];
+            if (!calls)
+                continue;
+            std::fprintf(f, "%-52s %-8s %8lld %10.4f", Layer.Name.c_str(), StageNames[s], (long long)calls, 1e3 * Layer.Seconds[s] / calls);
+            for (int c = 0; c < TAB_Counters; c++) {
+                if (state.Counted[c])
+                    std::fprintf(f, " %14.0f", Layer.Counts[s][c] / calls);
+                else
+                    std::fprintf(f, " %14s", "-");
+            }
+            const double cycles = Layer.Counts[s][Counter_Cycles];
+            if (state.Events && state.Counted[Counter_Instructions] && (cycles > 0))
+                std::fprintf(f, " %6.2f\n", Layer.Counts[s][Counter_Instructions] / cycles);
+            else
+                std::fprintf(f, " %6s\n", "-");
+        }
+    }
+    std::fflush(f);
+}
+
+
+TabPerfLayer* TAB_PerfLayer(ConvType TYPE, ConvAlgo Algo, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W, int KN, int KH, int KW, int Groups, bool PaddingFree) {
+    static const char* Types[Conv_Types] = { "TNN", "TBN", "BTN", "BNN" };
+    static const char* Algos[Conv_Algos] = { "baseline", "blocked", "implicit" };
+    char name[128];
+    std::snprintf(name, sizeof(name), "%s %s N%d C%d H%d W%d KN%d K%dx%d P%dx%d S%dx%d G%d%s", Types[TYPE], Algos[Algo], Batch_Size, C, H, W,
+        KN, KH, KW, PaddingH, PaddingW, StrideH, StrideW, Groups, PaddingFree ? " PF" : "");
+
+    PerfState& state = State();
+    std::lock_guard<std::mutex> lk(state.Lock);
+    auto it = state.Layers.find(name);
+    if (it == state.Layers.end()) {
+        TabPerfLayer Layer;
+        Layer.Name = name;
+        std::fill(Layer.Calls, Layer.Calls + TAB_Stages, 0);
+        std::fill(Layer.Seconds, Layer.Seconds + TAB_Stages, 0.0);
+        std::fill(&Layer.Counts[0][0], &Layer.Counts[0][0] + TAB_Stages * TAB_Counters, 0.0);
+        it = state.Layers.emplace(name, Layer).first;
+    }
+#ifdef TAB_PERF_EVENT
+    // The threads of the layer, e.g. the pool started by its first run or the producer of a pipelined plan
+    if (state.Events)
+        RefreshThreads(state);
+#endif
+    return &it->second;
+}
+
+
+TabPerfLayer* TAB_PerfLayer(const TabConvPlan& Plan) {
+    return TAB_PerfLayer(Plan.TYPE, Plan.Algo, Plan.PaddingH, Plan.PaddingW, Plan.StrideH, Plan.StrideW, Plan.Batch_Size, Plan.C, Plan.H, Plan.W,
+        Plan.KN, Plan.KH, Plan.KW, Plan.Groups, Plan.PaddingFree);
+}
+
+
+TabPerfLayerScope::TabPerfLayerScope(TabPerfLayer* Layer) : Prev(CurrentLayer) {
+    CurrentLayer = Layer;
+}
+
+
+TabPerfLayerScope::~TabPerfLayerScope() {
+    CurrentLayer = Prev;
+}
+
+
+TabPerfLayer* TAB_PerfCurrentLayer() {
+    return CurrentLayer;
+}
+
+
+TabPerfStage::TabPerfStage(TabStage Stage) : Layer(CurrentLayer), Stage(Stage), Start(0) {
+    if (!Layer)
+        return;
+    PerfState& state = State();
+    std::lock_guard<std::mutex> lk(state.Lock);
+    ReadCounts(state, Counts);
+    Start = Now();
+}
+
+
+void TabPerfStage::Stop() {
+    if (!Layer)
+        return;
+    const double end = Now();
+    PerfState& state = State();
+    std::lock_guard<std::mutex> lk(state.Lock);
+    double counts[TAB_Counters];
+    ReadCounts(state, counts);
+    Layer->Calls[Stage]++;
+    Layer->Seconds[Stage] += end - Start;
+    for (int c = 0; c < TAB_Counters; c++)
+        Layer->Counts[Stage][c] += counts[c] - Counts[c];
+    Layer = NULL;
+}
+
+#else
+// Compiled out, see TAB_PERF in PerfCounters.h
+
+bool TAB_PerfAvailable() {
+    return false;
+}
+
+
+void TAB_PerfReset() {
+}
+
+
+void TAB_PerfDump(FILE* f) {
+    std::fprintf(f, "# TAB perf counters are compiled out, build with TAB_PERF\n");
+}
+#endif
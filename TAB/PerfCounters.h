@@ -0,0 +1,68 @@
+#pragma once
+#include "common.h"
+#include "TAB_CPU.h"
+#include <cstdio>
+
+// Hardware performance counters around the stages of the convs
+// Compiled out by default: build with TAB_PERF defined (cmake -DTAB_PERF=ON) to count every stage of every
+// TAB_RunConvPlan() / TAB_Conv() call, per layer shape. Without it the stage scopes are empty and the functions below
+// do nothing.
+//
+// The counters: cycles, instructions, L1D read misses, LLC misses and branch misses in user space, through Linux
+// perf_event_open(). The stages run on the thread pool, so every thread of the process has its own counter group
+// and a stage counts the events of all of them. A pipelined plan quantizes next to the GEMM, so these two stages
+// count some of each other's events.
+// When perf_event_open() is not available (other OS, perf_event_paranoid > 2, containers), only the cycles are
+// counted, by rdtsc on the calling thread (the TSC, in reference cycles), or in ns on non-x86 CPUs.
+//
+// The counts are summed per layer and stage until TAB_PerfReset(). TAB_PerfDump() prints them, and the
+// TAB_PERF_DUMP environment variable (a file name, or stderr) dumps them at exit.
+
+enum TabCounter {
+    Counter_Cycles = 0, Counter_Instructions = 1, Counter_L1DMisses = 2, Counter_LLCMisses = 3, Counter_BranchMisses = 4, TAB_Counters = 5
+};
+
+// True when the counters come from perf_event_open(), false for the rdtsc fallback (or without TAB_PERF)
+bool TAB_PerfAvailable();
+
+// Clear the counts of all layers
+void TAB_PerfReset();
+
+// Print the counts per layer and stage, per call, to f
+void TAB_PerfDump(FILE* f);
+
+
+#ifdef TAB_PERF
+// The counts of one layer shape
+struct TabPerfLayer;
+
+TabPerfLayer* TAB_PerfLayer(ConvType TYPE, ConvAlgo Algo, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W, int KN, int KH, int KW, int Groups, bool PaddingFree);
+TabPerfLayer* TAB_PerfLayer(const TabConvPlan& Plan);
+
+// The stages of the calling thread count into Layer for the scope
+struct TabPerfLayerScope {
+    explicit TabPerfLayerScope(TabPerfLayer* Layer);
+    ~TabPerfLayerScope();
+    TabPerfLayer* Prev;
+};
+
+// The layer of the calling thread, NULL outside of a TabPerfLayerScope
+TabPerfLayer* TAB_PerfCurrentLayer();
+
+// Counts its scope (until Stop()) into Stage of the layer of the calling thread
+struct TabPerfStage {
+    explicit TabPerfStage(TabStage Stage);
+    ~TabPerfStage() {
+        Stop();
+    }
+    void Stop();
+    TabPerfLayer* Layer;
+    TabStage Stage;
+    double Start;
+    double Counts[TAB_Counters];
+};
+
+#define TAB_PERF_LAYER(...) TabPerfLayerScope tab_perf_layer(TAB_PerfLayer(__VA_ARGS__))
+#else
+#define TAB_PERF_LAYER(...)
+#endif
@@ -0,0 +1,64 @@
+#include "common.h"
+#include "ThreadPool.h"
+#include "Pooling.h"
+#include <algorithm>
+
+
+int64_t MaxPool_OutputWords(bool Ternary, int N, int C, int OH, int OW, int OutPaddingH, int OutPaddingW) {
+    const int P = Ternary ? BITS : 1;
+    return (int64_t)N * (OH + 2 * OutPaddingH) * (OW + 2 * OutPaddingW) * ((C + cntbits - 1) / cntbits) * P;
+}
+
+
+void MaxPool_NHWC(const int64_t* X, bool Ternary, int N, int C, int H, int W, int KH, int KW, int PaddingH, int PaddingW, int StrideH, int StrideW,
+    int OutPaddingH, int OutPaddingW, int64_t* y) {
+    const int P = Ternary ? BITS : 1;
+    const int64_t pixel = (int64_t)((C + cntbits - 1) / cntbits) * P;
+    const int OH = (H + 2 * PaddingH - KH) / StrideH + 1;
+    const int OW = (W + 2 * PaddingW - KW) / StrideW + 1;
+    const int packH = OH + 2 * OutPaddingH;
+    const int packW = OW + 2 * OutPaddingW;
+
+    // One tile per output row, border rows included
+    TAB_ParallelFor(N * packH, [&](int tile, int tid) {
+        const int n = tile / packH;
+        const int oh = tile % packH - OutPaddingH;
+        int64_t* row = y + (int64_t)tile * packW * pixel;
+        if ((oh < 0) || (oh >= OH)) {
+            std::fill(row, row + packW * pixel, (int64_t)0);
+            return;
+        }
+        std::fill(row, row + OutPaddingW * pixel, (int64_t)0);
+        std::fill(row + (OutPaddingW + OW) * pixel, row + packW * pixel, (int64_t)0);
+        const int h0 = std::max(oh * StrideH - PaddingH, 0);
+        const int h1 = std::min(oh * StrideH - PaddingH + KH, H);
+        for (int ow = 0; ow < OW; ow++) {
+            const int w0 = std::max(ow * StrideW - PaddingW, 0);
+            const int w1 = std::min(ow * StrideW - PaddingW + KW, W);
+            int64_t* out = row + (OutPaddingW + ow) * pixel;
+            // Ternary: out[0] gathers neg, out[1] pos. Binary: out gathers the and. The unused channels of the last
+            // word stay 0, as every pixel holds 0 there.
+            for (int64_t i = 0; i < pixel; i++)
+                out[i] = (Ternary && (i % BITS)) ? 0 : ~(int64_t)0;
+            for (int h = h0; h < h1; h++) {
+                for (int w = w0; w < w1; w++) {
+                    const int64_t* x = X + (((int64_t)n * H + h) * W + w) * pixel;
+                    if (Ternary) {
+                        for (int64_t i = 0; i < pixel; i += BITS) {
+                            out[i + 1] = out[i + 1] | (x[i + 1] & ~x[i]);
+                            out[i] = out[i] & x[i];
+                        }
+                    }
+                    else {
+                        for (int64_t i = 0; i < pixel; i++)
+                            out[i] = out[i] & x[i];
+                    }
+                }
+            }
+            if (Ternary) {
+                for (int64_t i = 0; i < pixel; i += BITS)
+                    out[i + 1] = out[i + 1] | out[i];
+            }
+        }
+    });
+}
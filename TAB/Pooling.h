@@ -0,0 +1,19 @@
+#pragma once
+#include "common.h"
+
+// Pooling on the packed activations (N_H_W_C(_B), see Ternarize_NCHW_to_NHWCB() and Binarize_NCHW_to_NHWC()), without
+// unpacking. The max of quantized values is a few word-wide bit operations per pixel of the window:
+//   binary (bit 1: -1): the max is -1 only when all are -1, y = x0 & x1 & ...
+//   ternary (+1: (0, 1), -1: (1, 1), 0: (0, 0)): +1 when one is +1, -1 when all are -1, else 0
+//     neg = p1(x0) & p1(x1) & ..., pos = (p2 & ~p1)(x0) | (p2 & ~p1)(x1) | ..., y = (neg, pos | neg)
+// The results are the max pooling of the values, quantized again. A ReLU or a threshold is not needed in between.
+
+// The words of the pooled output of OH x OW pixels with a zero border of OutPaddingH / OutPaddingW pixels
+int64_t MaxPool_OutputWords(bool Ternary, int N, int C, int OH, int OW, int OutPaddingH, int OutPaddingW);
+
+// Max pooling of the quantized input X of H x W pixels (no border stored) with KH x KW windows
+// PaddingH / PaddingW: the pooling padding, which never wins the max (windows are clipped to the image), must be smaller
+// than the window. The output of OH = (H + 2 * PaddingH - KH) / StrideH + 1 rows and OW columns is written with a zero
+// border of OutPaddingH / OutPaddingW pixels, e.g. as the quantized input QX of the next conv plan.
+void MaxPool_NHWC(const int64_t* X, bool Ternary, int N, int C, int H, int W, int KH, int KW, int PaddingH, int PaddingW, int StrideH, int StrideW,
+    int OutPaddingH, int OutPaddingW, int64_t* y);
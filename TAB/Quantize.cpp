@@ -1,96 +1,116 @@
 #include "common.h"
 #include "Quantize.h"
+#include "Quantize_Kernels.h"
+#include "ThreadPool.h"
+#include "ConvShape.h"
 
-// Quantize the input x to be {+1, 0, -1} 
-// Input:
-//   x: the data to be quantized, using N_C_H_W data format
-//   padding1: the padding around Height
-//   padding2: the padding around Width
-//   ths: the threshold values of each filter or input image or activation
-//   N: batch size or filter number, C: Channel, H: Height, W: Width
-// Output:
-//   qx: the quantized x, using N, H, W, C, B format
-std::vector<int64_t> Ternarize_NCHW_to_NHWCB(float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W) {
+
+// Ternarize the input row x[in, :, ih, :] into W pixels of packC * BITS words: qrow[(iw * packC + ic) * BITS + bit]
+// +1 -> (p1, p2) = (0, 1), -1 -> (1, 1), 0 -> (0, 0)
+void Ternarize_Row_Scalar(const float* X, float Threshold, int in, int ih, int C, int H, int W, int64_t* qrow) {
     const int64_t one = 1;
-    int64_t onebit[cntbits];
-    // 64-bits, set each bit
-    for (int i = 0; i < cntbits; i++) {
-        onebit[i] = one << i;
+    const int packC = (C + cntbits - 1) / cntbits;
+    for (int iw = 0; iw < W; iw++) {
+        for (int ic = 0; ic < packC; ic++) {
+            // The last word only holds C % cntbits channels
+            const int bits = (C - ic * cntbits < cntbits) ? (C - ic * cntbits) : cntbits;
+            int64_t p1 = 0;
+            int64_t p2 = 0;
+            for (int bit = 0; bit < bits; bit++) {
+                // PyTorch uses N_C_H_W format: x.index({in, ic*cntbits+bit, ih, iw})
+                float currentx = X[((in * C + (ic * cntbits + bit)) * H + ih) * W + iw];
+                if (currentx > Threshold) {
+                    // Pack 1: 01
+                    p2 = p2 | (one << bit);
+                }
+                else if (currentx < (-Threshold)) {
+                    // Pack -1: 11
+                    p1 = p1 | (one << bit);
+                    p2 = p2 | (one << bit);
+                }
+            }
+            qrow[(iw * packC + ic) * BITS + 0] = p1;
+            qrow[(iw * packC + ic) * BITS + 1] = p2;
+        }
     }
+}
 
-    // initial packed channel num
-    const int priChannel = C / cntbits;
-    // packC: actual packed input channel
-    const int packC = (C % cntbits) ? (priChannel + 1) : priChannel;
-    const int packH = H + 2 * PaddingH;
-    const int packW = W + 2 * PaddingW;
-    // The quantized qx, in N_H_W_C_B format
-    std::vector<int64_t> qx = std::vector<int64_t>(N * packH * packW * packC * BITS, 0);
-    int64_t* qxptr = qx.data();
-
-    for (int in = 0; in < N; in++) {
-        for (int ih = 0; ih < H; ih++) {
-            for (int iw = 0; iw < W; iw++) {
-
-                // Pack the first part: 0 ~ priChannel*cntbits
-                for (int ic = 0; ic < priChannel; ic++) {
-                    // for 2-bit packing
-                    int64_t p1 = 0;
-                    int64_t p2 = 0;
-                    for (int bit = 0; bit < cntbits; bit++) {
-                        // PyTorch uses N_C_H_W format
-                        // x.index({in, ic*cntbits+bit, ih, iw})
-                        float currentx = X[((in * C + (ic * cntbits + bit)) * H + ih) * W + iw];
-                        if (currentx > Q_Threshold[in]) {
-                            // Pack 1: 01
-
-                            p2 = p2 | onebit[bit];
-                        }
-                        else if (currentx < (-Q_Threshold[in])) {
-                            // Pack -1: 11
-                            p1 = p1 | onebit[bit];
-                            p2 = p2 | onebit[bit];
-                        }
-                    }
-                    // Store the ternarized and packed data in N_H_W_C_B format
-                    //qx.index({ in, ih + padding1, iw + padding2, priChannel * 2 + 0 }) = p1;
-                    //qx.index({ in, ih + padding1, iw + padding2, priChannel * 2 + 1 }) = p2;
-                    qxptr[(((in * packH + ih + PaddingH) * packW + iw + PaddingW) * packC + ic) * BITS + 0] = p1;
-                    qxptr[(((in * packH + ih + PaddingH) * packW + iw + PaddingW) * packC + ic) * BITS + 1] = p2;
-                }
 
-                // Pack the second part: priChannel*cntbits ~ C
-                if ((C % cntbits) > 0) {
-                    int64_t p1 = 0;
-                    int64_t p2 = 0;
-                    for (int bit = 0; bit < (C % cntbits); bit++) {
-                        float currentx = X[((in * C + (priChannel * cntbits + bit)) * H + ih) * W + iw];
-                        if (currentx > Q_Threshold[in]) {
-                            // Pack 1: 01
-
-                            p2 = p2 | onebit[bit];
-                        }
-                        else if (currentx < (-Q_Threshold[in])) {
-                            // Pack -1: 11
-                            p1 = p1 | onebit[bit];
-                            p2 = p2 | onebit[bit];
-                        }
-                    }
-                    // Old NCHWB format for reference
-                    //qxptr[((in * packC + priChannel) * packH + (ih + padding1)) * packWB + ow + 0] = p1;
-                    //qxptr[((in * packC + priChannel) * packH + (ih + padding1)) * packWB + ow + 1] = p2;
-
-                    // Store packed data into new NHWCB format
-                    qxptr[(((in * packH + ih + PaddingH) * packW + iw + PaddingW) * packC + priChannel) * BITS + 0] = p1;
-                    qxptr[(((in * packH + ih + PaddingH) * packW + iw + PaddingW) * packC + priChannel) * BITS + 1] = p2;
+// Binarize the input row x[in, :, ih, :] into W pixels of packC words: qrow[iw * packC + ic]
+// -1 (x < Threshold) -> 1, +1 -> 0
+void Binarize_Row_Scalar(const float* X, float Threshold, int in, int ih, int C, int H, int W, int64_t* qrow) {
+    const int64_t one = 1;
+    const int packC = (C + cntbits - 1) / cntbits;
+    for (int iw = 0; iw < W; iw++) {
+        for (int ic = 0; ic < packC; ic++) {
+            const int bits = (C - ic * cntbits < cntbits) ? (C - ic * cntbits) : cntbits;
+            int64_t p1 = 0;
+            for (int bit = 0; bit < bits; bit++) {
+                // Each filter can have its own adjustable quantization threshold, e.g., -0.1, 0, +0.1, ...
+                if (X[((in * C + (ic * cntbits + bit)) * H + ih) * W + iw] < Threshold) {
+                    // Pack -1: 1
+                    p1 = p1 | (one << bit);
                 }
             }
+            qrow[iw * packC + ic] = p1;
         }
     }
+}
+
+
+QuantizeRowFn Quantize_GetRowKernel(bool Ternary) {
+#ifdef TAB_X86
+    if (TAB_GetISA() >= ISA_AVX2)
+        return Ternary ? Ternarize_Row_AVX2 : Binarize_Row_AVX2;
+#endif
+    return Ternary ? Ternarize_Row_Scalar : Binarize_Row_Scalar;
+}
+
+
+// Quantize into the padded N_H_W_C(_B) tensor, P = BITS for ternary, 1 for binary
+// Only the interior is written, the padding of qx must already be 0
+static void Quantize_NCHW_to_NHWC(const float* X, bool Ternary, int PaddingH, int PaddingW, const float* Q_Threshold, int N, int C, int H, int W, int64_t* qxptr) {
+    const int P = Ternary ? BITS : 1;
+    const int packC = (C + cntbits - 1) / cntbits;
+    const int packH = H + 2 * PaddingH;
+    const int packW = W + 2 * PaddingW;
+    const QuantizeRowFn QuantizeRow = Quantize_GetRowKernel(Ternary);
+
+    // One tile per input row, the rows write disjoint parts of qx
+    TAB_ParallelFor(N * H, [&](int tile, int tid) {
+        const int in = tile / H;
+        const int ih = tile % H;
+        const float Threshold = Q_Threshold ? Q_Threshold[in] : 0;
+        int64_t* qrow = qxptr + ((in * packH + ih + PaddingH) * packW + PaddingW) * packC * P;
+        QuantizeRow(X, Threshold, in, ih, C, H, W, qrow);
+    });
+}
+
+
+static TabTensor<int64_t> Quantize_NCHW_to_NHWC(const float* X, bool Ternary, int PaddingH, int PaddingW, const float* Q_Threshold, int N, int C, int H, int W) {
+    const int P = Ternary ? BITS : 1;
+    const int packC = (C + cntbits - 1) / cntbits;
+    // The padding stays 0
+    TabTensor<int64_t> qx = TabTensor<int64_t>((size_t)N * (H + 2 * PaddingH) * (W + 2 * PaddingW) * packC * P, 0);
+    Quantize_NCHW_to_NHWC(X, Ternary, PaddingH, PaddingW, Q_Threshold, N, C, H, W, qx.data());
     return qx;
 }
 
 
+// Quantize the input x to be {+1, 0, -1} 
+// Input:
+//   x: the data to be quantized, using N_C_H_W data format
+//   padding1: the padding around Height
+//   padding2: the padding around Width
+//   ths: the threshold values of each filter or input image or activation
+//   N: batch size or filter number, C: Channel, H: Height, W: Width
+// Output:
+//   qx: the quantized x, using N, H, W, C, B format
+TabTensor<int64_t> Ternarize_NCHW_to_NHWCB(float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W) {
+    return Quantize_NCHW_to_NHWC(X, true, PaddingH, PaddingW, Q_Threshold, N, C, H, W);
+}
+
+
 // Quantize the input x to be {+1, -1} 
 // Input:
 //   x: the data to be quantized, using N_C_H_W data format
@@ -100,120 +120,160 @@ std::vector<int64_t> Ternarize_NCHW_to_NHWCB(float* X, int PaddingH, int Padding
 //   N: batch size or filter number, C: Channel, H: Height, W: Width
 // Output:
 //   qx: the quantized x, using N, H, W, C format
-std::vector<int64_t> Binarize_NCHW_to_NHWC(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W) {
-    const int64_t one = 1;
-    int64_t onebit[cntbits];
-    // 64-bits, set each bit
-    for (int i = 0; i < cntbits; i++) {
-        onebit[i] = one << i;
-    }
+TabTensor<int64_t> Binarize_NCHW_to_NHWC(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W) {
+    return Quantize_NCHW_to_NHWC(X, false, PaddingH, PaddingW, Q_Threshold, N, C, H, W);
+}
 
-    // initial packed channel num
-    const int priChannel = C / cntbits;
-    // packC: actual packed input channel
-    const int packC = (C % cntbits) ? (priChannel + 1) : priChannel;
+
+// This Binarization use ths=0
+TabTensor<int64_t> Binarize_NCHW_to_NHWC(const float* X, int PaddingH, int PaddingW, int N, int C, int H, int W) {
+    return Quantize_NCHW_to_NHWC(X, false, PaddingH, PaddingW, NULL, N, C, H, W);
+}
+
+
+// Into a caller-provided qx of N * packH * packW * packC * BITS words, whose padding is already 0
+void Ternarize_NCHW_to_NHWCB(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int64_t* qx) {
+    Quantize_NCHW_to_NHWC(X, true, PaddingH, PaddingW, Q_Threshold, N, C, H, W, qx);
+}
+
+
+// Into a caller-provided qx of N * packH * packW * packC words, whose padding is already 0
+void Binarize_NCHW_to_NHWC(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int64_t* qx) {
+    Quantize_NCHW_to_NHWC(X, false, PaddingH, PaddingW, Q_Threshold, N, C, H, W, qx);
+}
+
+
+// Fused quantize + Img2Row into the (N * OH * OW, KH * KW * packC * P) GEMM rows, without the padded tensor
+// Each tile quantizes one padded input row once into a line buffer (padded rows stay 0),
+// then copies it into every (oh, kh) row segment that reads it: ph = oh * StrideH + kh.
+// Every word of y is written. The copies run on the window of the shape S (see ConvShape.h).
+template <class S>
+static void Quantize_NCHW_to_Rows(const float* X, bool Ternary, int PaddingH, int PaddingW, const float* Q_Threshold,
+    int N, int C, int H, int W, int KH_, int KW_, int StrideH_, int StrideW_, int64_t* yptr) {
+    const int KH = ShapeDim<S::KH>(KH_);
+    const int KW = ShapeDim<S::KW>(KW_);
+    const int StrideH = ShapeDim<S::StrideH>(StrideH_);
+    const int StrideW = ShapeDim<S::StrideW>(StrideW_);
+    const int P = Ternary ? BITS : 1;
+    const int packC = (C + cntbits - 1) / cntbits;
     const int packH = H + 2 * PaddingH;
     const int packW = W + 2 * PaddingW;
+    const int OH = (packH - KH) / StrideH + 1;
+    const int OW = (packW - KW) / StrideW + 1;
+    const int pixel = packC * P;             // words per pixel
+    const int K = KH * KW * pixel;           // words per GEMM row
+    const QuantizeRowFn QuantizeRow = Quantize_GetRowKernel(Ternary);
 
-    // The PyTorch data always uses N, C, H, W format, no matter how we permute the data
-    // torch::Tensor qx = torch::zeros({ N, packH, packW, packC }, torch::dtype(torch::kInt64));
-    std::vector<int64_t> qx = std::vector<int64_t>(N * packH * packW * packC, 0);
-    int64_t* qxptr = qx.data();
-
-    for (int in = 0; in < N; in++) {
-        for (int ih = 0; ih < H; ih++) {
-            for (int iw = 0; iw < W; iw++) {
-
-                // Pack the first part: 0 ~ priChannel*cntbits
-                for (int ic = 0; ic < priChannel; ic++) {
-                    // for 1-bit packing
-                    int64_t p1 = 0;
-                    for (int bit = 0; bit < cntbits; bit++) {
-                        // PyTorch uses N_C_H_W format: x.index({in, ic*cntbits+bit, ih, iw})
-                        // Each filter can have its own adjustable quantization threshold, e.g., -0.1, 0, +0.1, ...
-                        if (X[((in * C + (ic * cntbits + bit)) * H + ih) * W + iw] < Q_Threshold[in]) {
-                            // Pack -1: 1
-                            p1 = p1 | onebit[bit];
-                        }
-                    }
-                    // Store the binarized and packed data in N_H_W_C format
-                    qxptr[((in * packH + ih + PaddingH) * packW + iw + PaddingW) * packC + ic] = p1;
-                }
+    TAB_ParallelFor(N * packH, [&](int tile, int tid) {
+        const int in = tile / packH;
+        const int ph = tile % packH;
+        const int ih = ph - PaddingH;
+        // Output rows that read ph: 0 <= ph - oh * StrideH < KH
+        const int oh0 = (ph >= KH) ? ((ph - KH) / StrideH + 1) : 0;
+        const int oh1 = (ph / StrideH < OH - 1) ? (ph / StrideH) : (OH - 1);
+        if (oh0 > oh1)
+            return;
 
-                // Pack the second part: priChannel*cntbits ~ C
-                if ((C % cntbits) > 0) {
-                    int64_t p1 = 0;
-                    for (int bit = 0; bit < (C % cntbits); bit++) {
-                        if (X[((in * C + (priChannel * cntbits + bit)) * H + ih) * W + iw] < Q_Threshold[in]) {
-                            // Pack -1: 1
-                            p1 = p1 | onebit[bit];
-                        }
-                    }
-                    qxptr[((in * packH + ih + PaddingH) * packW + iw + PaddingW) * packC + priChannel] = p1;
-                }
+        // The line buffer of this thread, kept across calls
+        static thread_local std::vector<int64_t> lines;
+        if (lines.size() < (size_t)packW * pixel)
+            lines.resize((size_t)packW * pixel);
+        int64_t* line = lines.data();
+        for (int i = 0; i < PaddingW * pixel; i++) {
+            line[i] = 0;
+            line[(PaddingW + W) * pixel + i] = 0;
+        }
+        if ((ih < 0) || (ih >= H)) {
+            for (int i = 0; i < W * pixel; i++)
+                line[PaddingW * pixel + i] = 0;
+        }
+        else {
+            const float Threshold = Q_Threshold ? Q_Threshold[in] : 0;
+            QuantizeRow(X, Threshold, in, ih, C, H, W, line + PaddingW * pixel);
+        }
+
+        for (int oh = oh0; oh <= oh1; oh++) {
+            const int kh = ph - oh * StrideH;
+            // y[in, oh, ow, kh, 0 : KW, :] = line[ow * StrideW : ow * StrideW + KW, :]
+            int64_t* dst = yptr + ((int64_t)(in * OH + oh) * OW * K) + kh * KW * pixel;
+            for (int ow = 0; ow < OW; ow++) {
+                const int64_t* src = line + ow * StrideW * pixel;
+                for (int i = 0; i < KW * pixel; i++)
+                    dst[(int64_t)ow * K + i] = src[i];
             }
         }
-    }
-    return qx;
+    });
 }
 
+static void Quantize_NCHW_to_Rows(const float* X, bool Ternary, int PaddingH, int PaddingW, const float* Q_Threshold,
+    int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW, int64_t* y) {
+    TAB_DispatchConvShape(KH, KW, StrideH, StrideW, [&](auto shape) {
+        Quantize_NCHW_to_Rows<decltype(shape)>(X, Ternary, PaddingH, PaddingW, Q_Threshold, N, C, H, W, KH, KW, StrideH, StrideW, y);
+    });
+}
 
-// This Binarization use ths=0
-std::vector<int64_t> Binarize_NCHW_to_NHWC(const float* X, int PaddingH, int PaddingW, int N, int C, int H, int W) {
-    const int64_t one = 1;
-    int64_t onebit[cntbits];
-    // 64-bits, set each bit
-    for (int i = 0; i < cntbits; i++) {
-        onebit[i] = one << i;
-    }
 
-    // initial packed channel num
-    const int priChannel = C / cntbits;
-    // packC: actual packed input channel
-    const int packC = (C % cntbits) ? (priChannel + 1) : priChannel;
-    const int packH = H + 2 * PaddingH;
-    const int packW = W + 2 * PaddingW;
+static TabTensor<int64_t> Quantize_NCHW_to_Rows(const float* X, bool Ternary, int PaddingH, int PaddingW, const float* Q_Threshold,
+    int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW) {
+    const int P = Ternary ? BITS : 1;
+    const int packC = (C + cntbits - 1) / cntbits;
+    const int OH = (H + 2 * PaddingH - KH) / StrideH + 1;
+    const int OW = (W + 2 * PaddingW - KW) / StrideW + 1;
+    // Every word is written, no zero fill
+    TabTensor<int64_t> y = TabTensor<int64_t>((size_t)N * OH * OW * KH * KW * packC * P);
+    Quantize_NCHW_to_Rows(X, Ternary, PaddingH, PaddingW, Q_Threshold, N, C, H, W, KH, KW, StrideH, StrideW, y.data());
+    return y;
+}
 
-    // The PyTorch data always uses N, C, H, W format, no matter how we permute the data
-    // torch::Tensor qx = torch::zeros({ N, packH, packW, packC }, torch::dtype(torch::kInt64));
-    std::vector<int64_t> qx = std::vector<int64_t>(N * packH * packW * packC, 0);
-    int64_t* qxptr = qx.data();
-
-    for (int in = 0; in < N; in++) {
-        for (int ih = 0; ih < H; ih++) {
-            for (int iw = 0; iw < W; iw++) {
-
-                // Pack the first part: 0 ~ priChannel*cntbits
-                for (int ic = 0; ic < priChannel; ic++) {
-                    // for 1-bit packing
-                    int64_t p1 = 0;
-                    for (int bit = 0; bit < cntbits; bit++) {
-                        // PyTorch uses N_C_H_W format: x.index({in, ic*cntbits+bit, ih, iw})
-                        // Each channel can have its own adjustable quantization threshold, e.g., -0.1, 0, +0.1, ...
-                        if (X[((in * C + (ic * cntbits + bit)) * H + ih) * W + iw] < 0) {
-                            // Pack -1: 1
-                            p1 = p1 | onebit[bit];
-                        }
-                    }
-                    // Store the binarized and packed data in N_H_W_C format
-                    qxptr[((in * packH + ih + PaddingH) * packW + iw + PaddingW) * packC + ic] = p1;
-                }
 
-                // Pack the second part: priChannel*cntbits ~ C
-                if ((C % cntbits) > 0) {
-                    int64_t p1 = 0;
-                    for (int bit = 0; bit < (C % cntbits); bit++) {
-                        if (X[((in * C + (priChannel * cntbits + bit)) * H + ih) * W + iw] < 0) {
-                            // Pack -1: 1
-                            p1 = p1 | onebit[bit];
-                        }
-                    }
-                    qxptr[((in * packH + ih + PaddingH) * packW + iw + PaddingW) * packC + priChannel] = p1;
-                }
-            }
+// Ternarize + Img2Row: the same result as Img2Row_NHWCB_to_N_OHOW_KHKWC(Ternarize_NCHW_to_NHWCB(...)) in one pass
+TabTensor<int64_t> Ternarize_NCHW_to_N_OHOW_KHKWCB(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW) {
+    return Quantize_NCHW_to_Rows(X, true, PaddingH, PaddingW, Q_Threshold, N, C, H, W, KH, KW, StrideH, StrideW);
+}
+
+void Ternarize_NCHW_to_N_OHOW_KHKWCB(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW, int64_t* y) {
+    Quantize_NCHW_to_Rows(X, true, PaddingH, PaddingW, Q_Threshold, N, C, H, W, KH, KW, StrideH, StrideW, y);
+}
+
+
+// Binarize + Img2Row: the same result as Img2Row_NHWCB_to_N_OHOW_KHKWC(Binarize_NCHW_to_NHWC(...)) in one pass
+TabTensor<int64_t> Binarize_NCHW_to_N_OHOW_KHKWC(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW) {
+    return Quantize_NCHW_to_Rows(X, false, PaddingH, PaddingW, Q_Threshold, N, C, H, W, KH, KW, StrideH, StrideW);
+}
+
+void Binarize_NCHW_to_N_OHOW_KHKWC(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW, int64_t* y) {
+    Quantize_NCHW_to_Rows(X, false, PaddingH, PaddingW, Q_Threshold, N, C, H, W, KH, KW, StrideH, StrideW, y);
+}
+
+
+// Grouped: one quantization per group and image, into qx of Groups * N * packH * packW * packCg * P words
+void Quantize_NCHW_to_NHWCB_Grouped(const float* X, bool Ternary, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int Groups, int64_t* qx) {
+    const int P = Ternary ? BITS : 1;
+    const int Cg = C / Groups;
+    const int64_t image = (int64_t)(H + 2 * PaddingH) * (W + 2 * PaddingW) * ((Cg + cntbits - 1) / cntbits) * P;
+    for (int g = 0; g < Groups; g++) {
+        for (int in = 0; in < N; in++) {
+            const float* Xg = X + ((int64_t)in * C + (int64_t)g * Cg) * H * W;
+            Quantize_NCHW_to_NHWC(Xg, Ternary, PaddingH, PaddingW, Q_Threshold ? (Q_Threshold + in) : NULL, 1, Cg, H, W, qx + ((int64_t)g * N + in) * image);
+        }
+    }
+}
+
+
+// Grouped: one fused quantize + Img2Row per group and image, into the GEMM rows of every group
+void Quantize_NCHW_to_Rows_Grouped(const float* X, bool Ternary, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW,
+    int Groups, int64_t* y) {
+    const int P = Ternary ? BITS : 1;
+    const int Cg = C / Groups;
+    const int OH = (H + 2 * PaddingH - KH) / StrideH + 1;
+    const int OW = (W + 2 * PaddingW - KW) / StrideW + 1;
+    const int64_t image = (int64_t)OH * OW * KH * KW * ((Cg + cntbits - 1) / cntbits) * P;
+    for (int g = 0; g < Groups; g++) {
+        for (int in = 0; in < N; in++) {
+            const float* Xg = X + ((int64_t)in * C + (int64_t)g * Cg) * H * W;
+            Quantize_NCHW_to_Rows(Xg, Ternary, PaddingH, PaddingW, Q_Threshold ? (Q_Threshold + in) : NULL, 1, Cg, H, W, KH, KW, StrideH, StrideW, y + ((int64_t)g * N + in) * image);
         }
     }
-    return qx;
 }
 
 
@@ -1,5 +1,19 @@
 #pragma once
-std::vector<int64_t> Ternarize_NCHW_to_NHWCB(float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W);
-std::vector<int64_t> Binarize_NCHW_to_NHWC(const float* X, int PaddingH, int PaddingW, int N, int C, int H, int W);
-std::vector<int64_t> Binarize_NCHW_to_NHWC(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W);
+#include "Allocator.h"
+TabTensor<int64_t> Ternarize_NCHW_to_NHWCB(float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W);
+TabTensor<int64_t> Binarize_NCHW_to_NHWC(const float* X, int PaddingH, int PaddingW, int N, int C, int H, int W);
+TabTensor<int64_t> Binarize_NCHW_to_NHWC(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W);
+// Into a caller-provided qx whose padding is already 0, no allocation
+void Ternarize_NCHW_to_NHWCB(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int64_t* qx);
+void Binarize_NCHW_to_NHWC(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int64_t* qx);
+// Fused quantize + Img2Row, straight into the (N * OH * OW, KH * KW * C) GEMM rows
+TabTensor<int64_t> Ternarize_NCHW_to_N_OHOW_KHKWCB(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW);
+TabTensor<int64_t> Binarize_NCHW_to_N_OHOW_KHKWC(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW);
+void Ternarize_NCHW_to_N_OHOW_KHKWCB(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW, int64_t* y);
+void Binarize_NCHW_to_N_OHOW_KHKWC(const float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW, int64_t* y);
+// Grouped convs: group g reads the channels [g * C / Groups, (g + 1) * C / Groups). Every group is quantized as a tensor
+// of its own C / Groups channels, group after group: Groups_N_PackedH_PackedW_C(_B) or Groups_(N * OH * OW)_(KH * KW * C(_B))
+void Quantize_NCHW_to_NHWCB_Grouped(const float* X, bool Ternary, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int Groups, int64_t* qx);
+void Quantize_NCHW_to_Rows_Grouped(const float* X, bool Ternary, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W, int KH, int KW, int StrideH, int StrideW,
+    int Groups, int64_t* y);
 std::vector<int> BTN_CNT_W2(int64_t* QW, int KN, int C, int KH, int KW);
\ No newline at end of file
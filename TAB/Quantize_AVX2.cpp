@@ -0,0 +1,102 @@
+#include "common.h"
+#include "Quantize_Kernels.h"
+
+#ifdef TAB_X86
+#include <immintrin.h>
+
+// AVX2 row quantizers, only called when TAB_GetISA() >= ISA_AVX2
+#define TAB_AVX2 TAB_TARGET("avx2")
+
+
+// Transpose the 8x8 bit matrix x: bit j of byte i <-> bit i of byte j
+static inline uint64_t Transpose8x8(uint64_t x) {
+    x = (x & 0xAA55AA55AA55AA55ull) | ((x & 0x00AA00AA00AA00AAull) << 7) | ((x >> 7) & 0x00AA00AA00AA00AAull);
+    x = (x & 0xCCCC3333CCCC3333ull) | ((x & 0x0000CCCC0000CCCCull) << 14) | ((x >> 14) & 0x0000CCCC0000CCCCull);
+    x = (x & 0xF0F0F0F00F0F0F0Full) | ((x & 0x00000000F0F0F0F0ull) << 28) | ((x >> 28) & 0x00000000F0F0F0F0ull);
+    return x;
+}
+
+
+// The lanes [0, n) of a load, the others are neither read nor set
+TAB_AVX2 static inline __m256 LoadPixels(const float* x, int n) {
+    if (n >= 8)
+        return _mm256_loadu_ps(x);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    return _mm256_maskload_ps(x, _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lane));
+}
+
+
+// Quantize 8 pixels [iw, iw + n) of the row, n <= 8, into the words of channel word ic
+// For every 8 channels, the 8 pixel masks (one byte per channel) are transposed into one byte per pixel.
+template <bool Ternary>
+TAB_AVX2 static inline void QuantizePixels(const float* xrow, int64_t HW, float Threshold, int C, int ic, int n, uint64_t* p1, uint64_t* p2) {
+    const __m256 pth = _mm256_set1_ps(Threshold);
+    const __m256 nth = _mm256_set1_ps(-Threshold);
+    for (int j = 0; j < 8; j++) {
+        p1[j] = 0;
+        p2[j] = 0;
+    }
+    for (int g = 0; g < cntbits / 8; g++) {
+        const int c0 = ic * cntbits + g * 8;
+        if (c0 >= C)
+            break;
+        const int nc = (C - c0 < 8) ? (C - c0) : 8;
+        uint64_t m1 = 0;
+        uint64_t m2 = 0;
+        for (int c = 0; c < nc; c++) {
+            const __m256 v = LoadPixels(xrow + (c0 + c) * HW, n);
+            if (Ternary) {
+                // -1: (1, 1), +1: (0, 1)
+                const __m256 neg = _mm256_cmp_ps(v, nth, _CMP_LT_OQ);
+                const __m256 nz = _mm256_or_ps(neg, _mm256_cmp_ps(v, pth, _CMP_GT_OQ));
+                m1 |= (uint64_t)(uint32_t)_mm256_movemask_ps(neg) << (8 * c);
+                m2 |= (uint64_t)(uint32_t)_mm256_movemask_ps(nz) << (8 * c);
+            }
+            else {
+                // -1: 1
+                m1 |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(v, pth, _CMP_LT_OQ)) << (8 * c);
+            }
+        }
+        m1 = Transpose8x8(m1);
+        m2 = Ternary ? Transpose8x8(m2) : 0;
+        for (int j = 0; j < 8; j++) {
+            p1[j] |= ((m1 >> (8 * j)) & 0xFF) << (8 * g);
+            p2[j] |= ((m2 >> (8 * j)) & 0xFF) << (8 * g);
+        }
+    }
+}
+
+
+// The row is read in blocks of 8 pixels: the C strided loads of a block are 32 contiguous bytes each,
+// and the masked load covers the W % 8 tail.
+template <bool Ternary>
+TAB_AVX2 static void Quantize_Row_AVX2(const float* X, float Threshold, int in, int ih, int C, int H, int W, int64_t* qrow) {
+    const int P = Ternary ? BITS : 1;
+    const int packC = (C + cntbits - 1) / cntbits;
+    const int64_t HW = (int64_t)H * W;
+    const float* xrow = X + (int64_t)in * C * HW + (int64_t)ih * W;
+    uint64_t p1[8], p2[8];
+    for (int iw = 0; iw < W; iw += 8) {
+        const int n = (W - iw < 8) ? (W - iw) : 8;
+        for (int ic = 0; ic < packC; ic++) {
+            QuantizePixels<Ternary>(xrow + iw, HW, Threshold, C, ic, n, p1, p2);
+            for (int j = 0; j < n; j++) {
+                qrow[((iw + j) * packC + ic) * P] = (int64_t)p1[j];
+                if (Ternary)
+                    qrow[((iw + j) * packC + ic) * P + 1] = (int64_t)p2[j];
+            }
+        }
+    }
+}
+
+
+void Ternarize_Row_AVX2(const float* X, float Threshold, int in, int ih, int C, int H, int W, int64_t* qrow) {
+    Quantize_Row_AVX2<true>(X, Threshold, in, ih, C, H, W, qrow);
+}
+
+
+void Binarize_Row_AVX2(const float* X, float Threshold, int in, int ih, int C, int H, int W, int64_t* qrow) {
+    Quantize_Row_AVX2<false>(X, Threshold, in, ih, C, H, W, qrow);
+}
+
+#endif // TAB_X86
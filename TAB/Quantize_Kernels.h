@@ -0,0 +1,20 @@
+#pragma once
+#include "common.h"
+#include "CPUFeatures.h"
+
+// Row quantizers: the input row x[in, :, ih, :] in N_C_H_W format -> W pixels of packC * P words
+// Ternarize: qrow[(iw * packC + ic) * BITS + bit], Binarize: qrow[iw * packC + ic]
+typedef void (*QuantizeRowFn)(const float* X, float Threshold, int in, int ih, int C, int H, int W, int64_t* qrow);
+
+// One channel bit per float, read with a stride of H * W floats (reference)
+void Ternarize_Row_Scalar(const float* X, float Threshold, int in, int ih, int C, int H, int W, int64_t* qrow);
+void Binarize_Row_Scalar(const float* X, float Threshold, int in, int ih, int C, int H, int W, int64_t* qrow);
+
+#ifdef TAB_X86
+// 8 pixels of one channel per compare + movemask, then an 8x8 bit transpose per 8 channels
+void Ternarize_Row_AVX2(const float* X, float Threshold, int in, int ih, int C, int H, int W, int64_t* qrow);
+void Binarize_Row_AVX2(const float* X, float Threshold, int in, int ih, int C, int H, int W, int64_t* qrow);
+#endif
+
+// The row quantizer of the current ISA (see TAB_GetISA())
+QuantizeRowFn Quantize_GetRowKernel(bool Ternary);
\ No newline at end of file
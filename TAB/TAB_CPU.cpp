@@ -4,8 +4,15 @@
 #include "GEMM.h"
 #include "Activation.h"
 #include "TAB_CPU.h"
+#include "ThreadPool.h"
+#include "Depthwise.h"
+#include "PerfCounters.h"
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
-/* Container function of quantization and convolution functions. Can be applied to conv and FC layers.
+/* Quantization and convolution functions. Can be applied to conv and FC layers.
 * Conv: 1X1, 3X3, and larger kernels. FC equals to 1x1 conv.
 * type: 
 * 0: TAB-TNN
@@ -13,43 +20,126 @@
 * 2: TAB-BTN
 * 3: TAB-BNN
 * */
-// Ternary and Binary Convolution using N, H, W, C, B format
-// Input: 
-//   x: input activation in NCHW format 
-//   qw: quantized weights in KN_KH_KW_C_Bit format
-//   stride: the stride on Height and Width
-//   padding: the padding on Height and Width
-//   N: batch number, C, channel, H: Height, W: Width
-//   KN: number of filters/kernels, KH: Kernel Height, KW, Kernel Width 
-// Output:
-//   y: convolution result
-std::vector<float> TAB_Conv(float * X, float * Q_Threshold, int64_t * QWeights, int * BTN_CNT1, ConvType TYPE, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W,
-    int KN, int KH, int KW, float ReLU_alpha) {
-    int PackedH, PackedW, OH, OW, PackedC;
+static TabTensor<int> TAB_Conv_Baseline_Packed(const int64_t* QX, int64_t* QWeights, int* BTN_CNT1, ConvType TYPE, int Batch_Size, int C, int PackedH, int PackedW, int StrideH, int StrideW,
+    int KN, int KH, int KW, int Groups, double* Seconds = NULL);
+
+// Adds the wall time of its scope to Seconds[Stage], Seconds NULL: no timing
+// With TAB_PERF it also counts the scope into the perf counters of the layer (see PerfCounters.h)
+struct StageTimer {
+    StageTimer(double* Seconds, TabStage Stage) : Sum(Seconds ? (Seconds + Stage) : NULL)
+#ifdef TAB_PERF
+        , Perf(Stage)
+#endif
+    {
+        if (Sum)
+            Start = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        Stop();
+    }
+    void Stop() {
+        if (Sum)
+            *Sum += std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+        Sum = NULL;
+#ifdef TAB_PERF
+        Perf.Stop();
+#endif
+    }
+    double* Sum;
+    std::chrono::steady_clock::time_point Start;
+#ifdef TAB_PERF
+    TabPerfStage Perf;
+#endif
+};
+
+// The channels [c0, c0 + Cg) of one packed pixel of packC words per plane, as (Cg + 63) / 64 words per plane
+static void GroupPixel(const int64_t* src, int P, int packC, int c0, int Cg, int64_t* dst) {
+    const int packCg = (Cg + cntbits - 1) / cntbits;
+    for (int w = 0; w < packCg; w++) {
+        const int lo = c0 + w * cntbits;
+        const int i = lo / cntbits;
+        const int sh = lo % cntbits;
+        const int left = Cg - w * cntbits;
+        const uint64_t mask = (left < cntbits) ? ((((uint64_t)1) << left) - 1) : ~(uint64_t)0;
+        for (int p = 0; p < P; p++) {
+            uint64_t v = ((uint64_t)src[i * P + p]) >> sh;
+            if (sh && (i + 1 < packC))
+                v = v | (((uint64_t)src[(i + 1) * P + p]) << (cntbits - sh));
+            dst[w * P + p] = (int64_t)(v & mask);
+        }
+    }
+}
+
+// The reference path: quantize, Img2Row and baseline GEMM, each into a new vector. Returns the int conv results.
+// Seconds: the stage times (NULL: not timed)
+static TabTensor<int> TAB_Conv_Baseline_GEMM(float* X, float* Q_Threshold, int64_t* QWeights, int* BTN_CNT1, ConvType TYPE, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W,
+    int KN, int KH, int KW, int Groups, double* Seconds = NULL) {
+    int PackedH, PackedW;
     PackedH = H + 2 * PaddingH; // Height after bit-packing
     PackedW = W + 2 * PaddingW; // Width  after bit-packing
-    // Referring to https://pytorch.org/docs/2.3/generated/torch.nn.Conv2d.html#conv2d
-    OH = (PackedH - KH) / StrideH + 1; // Output Height
-    OW = (PackedW - KW) / StrideW + 1; // Output Width
-    PackedC = (C % cntbits) ? ((C / cntbits) + 1) : (C / cntbits); // The channel after bit-packing
     
-    std::vector<int64_t> qx;
-    std::vector<int> yi;
-    std::vector<float> y;
+    TabTensor<int64_t> qx;
 
     // Quantize and Img2Row/Img2Col
-        
+    {
+        StageTimer timer(Seconds, Stage_Quantize);
         if ((TYPE == ConvType::TNN) || (TYPE == ConvType::TBN)) {
             qx = Ternarize_NCHW_to_NHWCB(X, PaddingH, PaddingW, Q_Threshold, Batch_Size, C, H, W);
-            qx = Img2Row_NHWCB_to_N_OHOW_KHKWC(qx.data(), Batch_Size, PackedC * BITS, PackedH, PackedW, KH, KW, StrideH, StrideW);
         }
         else {
             qx = Binarize_NCHW_to_NHWC(X, PaddingH, PaddingW, Q_Threshold, Batch_Size, C, H, W);
-            qx = Img2Row_NHWCB_to_N_OHOW_KHKWC(qx.data(), Batch_Size, PackedC, PackedH, PackedW, KH, KW, StrideH, StrideW);
         }
-       
+    }
+
+    return TAB_Conv_Baseline_Packed(qx.data(), QWeights, BTN_CNT1, TYPE, Batch_Size, C, PackedH, PackedW, StrideH, StrideW, KN, KH, KW, Groups, Seconds);
+}
+
+
+// The reference path from a quantized, padded input qx: Img2Row and baseline GEMM
+// Grouped: the dense reference of every group on its own channels, into its columns of the result
+static TabTensor<int> TAB_Conv_Baseline_Packed(const int64_t* QX, int64_t* QWeights, int* BTN_CNT1, ConvType TYPE, int Batch_Size, int C, int PackedH, int PackedW, int StrideH, int StrideW,
+    int KN, int KH, int KW, int Groups, double* Seconds) {
+    // Referring to https://pytorch.org/docs/2.3/generated/torch.nn.Conv2d.html#conv2d
+    const int OH = (PackedH - KH) / StrideH + 1; // Output Height
+    const int OW = (PackedW - KW) / StrideW + 1; // Output Width
+    const int PackedC = (C % cntbits) ? ((C / cntbits) + 1) : (C / cntbits); // The channel after bit-packing
+    const int P = ((TYPE == ConvType::TNN) || (TYPE == ConvType::TBN)) ? BITS : 1;
+
+    TabTensor<int64_t> qx;
+    TabTensor<int> yi;
+
+    if (Groups > 1) {
+        const int Cg = C / Groups;
+        const int KNg = KN / Groups;
+        const int PackedCg = (Cg + cntbits - 1) / cntbits;
+        const int PB = ((TYPE == ConvType::TNN) || (TYPE == ConvType::BTN)) ? BITS : 1;
+        const int64_t pixels = (int64_t)Batch_Size * PackedH * PackedW;
+        yi = TabTensor<int>((size_t)Batch_Size * OH * OW * KN);
+        qx = TabTensor<int64_t>(pixels * PackedCg * P);
+        for (int g = 0; g < Groups; g++) {
+            {
+                StageTimer timer(Seconds, Stage_Img2Row);
+                for (int64_t i = 0; i < pixels; i++)
+                    GroupPixel(QX + i * PackedC * P, P, PackedC, g * Cg, Cg, qx.data() + i * PackedCg * P);
+            }
+            TabTensor<int> yg = TAB_Conv_Baseline_Packed(qx.data(), QWeights + (int64_t)g * KNg * PackedCg * KH * KW * PB, BTN_CNT1 ? (BTN_CNT1 + g * KNg) : NULL, TYPE,
+                Batch_Size, Cg, PackedH, PackedW, StrideH, StrideW, KNg, KH, KW, 1, Seconds);
+            for (size_t m = 0; m < (size_t)Batch_Size * OH * OW; m++)
+                for (int j = 0; j < KNg; j++)
+                    yi[m * KN + g * KNg + j] = yg[m * KNg + j];
+        }
+        return yi;
+    }
+
+    // Img2Row/Img2Col
+    {
+        StageTimer timer(Seconds, Stage_Img2Row);
+        qx = Img2Row_NHWCB_to_N_OHOW_KHKWC((int64_t*)QX, Batch_Size, PackedC * P, PackedH, PackedW, KH, KW, StrideH, StrideW);
+    }
+
     // Bitwise GEMM
-     
+    {
+        StageTimer timer(Seconds, Stage_GEMM);
         switch (TYPE) {
         case ConvType::TNN: {
             yi = TNNGEMM_baseline(qx.data(), QWeights, Batch_Size * OH * OW, KN, PackedC * KH * KW);
@@ -68,10 +158,810 @@ std::vector<float> TAB_Conv(float * X, float * Q_Threshold, int64_t * QWeights,
             break;
         }
         } // switch
-    
-    // Activation function: PReLU
+    }
+
+    return yi;
+}
+
 
-        y = PReLU(yi.data(), Batch_Size, KN, OH, OW, ReLU_alpha);
+// The reference path with PReLU as a separate pass
+static std::vector<float> TAB_Conv_Baseline(float* X, float* Q_Threshold, int64_t* QWeights, int* BTN_CNT1, ConvType TYPE, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W,
+    int KN, int KH, int KW, float ReLU_alpha, int Groups) {
+    TabTensor<int> yi = TAB_Conv_Baseline_GEMM(X, Q_Threshold, QWeights, BTN_CNT1, TYPE, PaddingH, PaddingW, StrideH, StrideW, Batch_Size, C, H, W, KN, KH, KW, Groups);
 
+    // Activation function: PReLU
+    StageTimer timer(NULL, Stage_Epilogue);
+    std::vector<float> y = std::vector<float>(yi.size());
+    PReLU(yi.data(), y.data(), (int64_t)yi.size(), ReLU_alpha);
     return y;
 }
+
+
+// The epilogue of TAB_Conv(): float PReLU with one alpha
+static GEMMEpilogue PReLU_Epilogue(float ReLU_alpha) {
+    GEMMEpilogue Epilogue = GEMMEpilogue();
+    Epilogue.Scale = NULL;
+    Epilogue.Bias = NULL;
+    Epilogue.Activation = true;
+    Epilogue.Alpha = ReLU_alpha;
+    Epilogue.Alphas = NULL;
+    Epilogue.Output = Output_Float;
+    return Epilogue;
+}
+
+
+// 64-byte aligned offsets in words
+static inline size_t AlignWords(size_t words) {
+    return (words + 7) / 8 * 8;
+}
+
+// The first word of the arena, 64-byte aligned by its allocator (or the caller of TAB_ShareConvPlanArena())
+static inline int64_t* ArenaBase(TabConvPlan& Plan) {
+    if (Plan.SharedArena)
+        return Plan.SharedArena;
+    return Plan.Arena.data();
+}
+
+// The stage times of a profiled plan, NULL when it is not profiled
+static inline double* PlanSeconds(TabConvPlan& Plan) {
+    return Plan.Profile ? Plan.StageSeconds : NULL;
+}
+
+// Depthwise plans run the spatially packed kernels of Depthwise.h
+static inline bool PlanDepthwise(const TabConvPlan& Plan) {
+    return (Plan.Groups > 1) && (Plan.Groups == Plan.C);
+}
+
+// Grouped plans quantize the whole batch group after group, so they are never pipelined
+static inline bool PlanPipelined(const TabConvPlan& Plan) {
+    return (Plan.PipelineDepth > 0) && (Plan.Groups == 1);
+}
+
+// The padding border stored in the quantized input: none when padding-free
+static inline int PlanInputPaddingH(const TabConvPlan& Plan) {
+    return Plan.PaddingFree ? 0 : Plan.PaddingH;
+}
+
+static inline int PlanInputPaddingW(const TabConvPlan& Plan) {
+    return Plan.PaddingFree ? 0 : Plan.PaddingW;
+}
+
+// The words of the quantized input of one image: the padded input (implicit) or the GEMM rows (blocked) of all
+// groups, or the spatially packed input (depthwise)
+static size_t PlanImageWords(const TabConvPlan& Plan) {
+    const int P = ((Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::TBN)) ? BITS : 1;
+    if (PlanDepthwise(Plan))
+        return (size_t)Depthwise_PackedWords(P == BITS, 1, Plan.C, Plan.PackedH, Plan.PackedW, Plan.KW, Plan.StrideW);
+    if (Plan.Algo == Algo_Implicit)
+        return (size_t)Plan.Groups * (Plan.H + 2 * PlanInputPaddingH(Plan)) * (Plan.W + 2 * PlanInputPaddingW(Plan)) * Plan.PackedC * P;
+    return (size_t)Plan.Groups * Plan.OH * Plan.OW * Plan.KH * Plan.KW * Plan.PackedC * P;
+}
+
+// The images of qx: the whole batch, or the ring of the pipeline
+static int PlanQXImages(const TabConvPlan& Plan) {
+    if (PlanPipelined(Plan) && (Plan.PipelineDepth < Plan.Batch_Size))
+        return Plan.PipelineDepth;
+    return Plan.Batch_Size;
+}
+
+// The GEMM scratch of Images images for the current thread count and ISA, shared by the GEMMs of the groups
+static size_t PlanWorkspaceBytes(const TabConvPlan& Plan, int Images) {
+    if (PlanDepthwise(Plan))
+        return 0;
+    if (Plan.Algo == Algo_Implicit) {
+        GEMMConvShape Shape = Plan.Shape;
+        Shape.N = Images;
+        return TABGEMM_Implicit_WorkspaceSize(Plan.TYPE, Shape, Plan.KN / Plan.Groups, Plan.Blocking);
+    }
+    return TABGEMM_Blocked_WorkspaceSize(Plan.TYPE, Images * Plan.OH * Plan.OW, Plan.KN / Plan.Groups, Plan.PackedC * Plan.KH * Plan.KW, Plan.Blocking);
+}
+
+// The GEMM scratch for the current thread count and ISA: the whole batch, and one image when pipelined
+static size_t PlanWorkspaceBytes(const TabConvPlan& Plan) {
+    size_t Bytes = PlanWorkspaceBytes(Plan, Plan.Batch_Size);
+    if (PlanPipelined(Plan)) {
+        const size_t ImageBytes = PlanWorkspaceBytes(Plan, 1);
+        Bytes = (ImageBytes > Bytes) ? ImageBytes : Bytes;
+    }
+    return Bytes;
+}
+
+// (Re)allocate the arena for WorkspaceBytes of GEMM scratch
+static void PlanAllocate(TabConvPlan& Plan, size_t WorkspaceBytes) {
+    Plan.QXOffset = 0;
+    Plan.WorkspaceOffset = AlignWords(PlanQXImages(Plan) * PlanImageWords(Plan));
+    Plan.WorkspaceBytes = WorkspaceBytes;
+    // The padding of qx is never written, it keeps these zeros
+    Plan.Arena = TabTensor<int64_t>(Plan.WorkspaceOffset + AlignWords((WorkspaceBytes + 7) / 8), 0);
+    Plan.SharedArena = NULL;
+    Plan.SharedBytes = 0;
+}
+
+
+TabConvPlan TAB_CreateConvPlan(ConvType TYPE, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W, int KN, int KH, int KW, ConvAlgo Algo, int Groups) {
+    TabConvPlan Plan;
+    Plan.TYPE = TYPE;
+    Plan.Algo = Algo;
+    Plan.PaddingH = PaddingH;
+    Plan.PaddingW = PaddingW;
+    Plan.StrideH = StrideH;
+    Plan.StrideW = StrideW;
+    Plan.Batch_Size = Batch_Size;
+    Plan.C = C;
+    Plan.H = H;
+    Plan.W = W;
+    Plan.KN = KN;
+    Plan.KH = KH;
+    Plan.KW = KW;
+    Plan.Groups = (Groups > 1) ? Groups : 1;
+
+    Plan.PackedH = H + 2 * PaddingH; // Height after bit-packing
+    Plan.PackedW = W + 2 * PaddingW; // Width  after bit-packing
+    // Referring to https://pytorch.org/docs/2.3/generated/torch.nn.Conv2d.html#conv2d
+    Plan.OH = (Plan.PackedH - KH) / StrideH + 1; // Output Height
+    Plan.OW = (Plan.PackedW - KW) / StrideW + 1; // Output Width
+    Plan.PackedC = (C / Plan.Groups + cntbits - 1) / cntbits; // The channel of a group after bit-packing
+
+    Plan.Shape.N = Batch_Size;
+    Plan.Shape.PackedH = Plan.PackedH;
+    Plan.Shape.PackedW = Plan.PackedW;
+    Plan.Shape.PackedC = Plan.PackedC;
+    Plan.Shape.KH = KH;
+    Plan.Shape.KW = KW;
+    Plan.Shape.StrideH = StrideH;
+    Plan.Shape.StrideW = StrideW;
+    Plan.Shape.OH = Plan.OH;
+    Plan.Shape.OW = Plan.OW;
+    Plan.Shape.PaddingH = 0;
+    Plan.Shape.PaddingW = 0;
+    Plan.Blocking = GEMM_DefaultBlocking();
+    Plan.Blocking.Container = TABGEMM_ContainerWords(Plan.PackedC * KH * KW);
+    Plan.PipelineDepth = 0;
+    Plan.PaddingFree = false;
+    Plan.Profile = false;
+    std::fill(Plan.StageSeconds, Plan.StageSeconds + TAB_Stages, 0.0);
+
+    // The baseline allocates its own buffers
+    if (Algo == Algo_Baseline)
+        PlanAllocate(Plan, 0);
+    else
+        PlanAllocate(Plan, PlanWorkspaceBytes(Plan));
+    return Plan;
+}
+
+
+int64_t TAB_ConvPlanOutputSize(const TabConvPlan& Plan) {
+    return (int64_t)Plan.Batch_Size * Plan.OH * Plan.OW * Plan.KN;
+}
+
+
+int64_t TAB_ConvPlanInputWords(const TabConvPlan& Plan) {
+    const int P = ((Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::TBN)) ? BITS : 1;
+    return (int64_t)Plan.Batch_Size * (Plan.H + 2 * PlanInputPaddingH(Plan)) * (Plan.W + 2 * PlanInputPaddingW(Plan)) * ((Plan.C + cntbits - 1) / cntbits) * P;
+}
+
+
+size_t TAB_ConvPlanOutputBytes(const TabConvPlan& Plan, const GEMMEpilogue& Epilogue) {
+    GEMMEpilogue ep = Epilogue;
+    ep.OH = Plan.OH;
+    ep.OW = Plan.OW;
+    return TABGEMM_OutputBytes(&ep, Plan.Batch_Size * Plan.OH * Plan.OW, Plan.KN);
+}
+
+
+GEMMEpilogue TAB_PackedOutputEpilogue(const TabConvPlan& Plan, const TabConvPlan& Next, float Threshold, const float* Thresholds) {
+    GEMMEpilogue Epilogue = GEMMEpilogue();
+    Epilogue.Output = ((Next.TYPE == ConvType::TNN) || (Next.TYPE == ConvType::TBN)) ? Output_Ternary : Output_Binary;
+    Epilogue.OH = Plan.OH;
+    Epilogue.OW = Plan.OW;
+    Epilogue.PaddingH = PlanInputPaddingH(Next);
+    Epilogue.PaddingW = PlanInputPaddingW(Next);
+    Epilogue.Threshold = Threshold;
+    Epilogue.Thresholds = Thresholds;
+    return Epilogue;
+}
+
+
+// Pixel (ph, pw) of the padded image n from the quantized input QX of Words words per pixel, NULL: a padding
+// pixel that a padding-free QX does not store (all 0 words)
+static inline const int64_t* PlanInputPixel(const TabConvPlan& Plan, const int64_t* QX, int64_t Words, int n, int ph, int pw) {
+    const int ih = ph - Plan.PaddingH + PlanInputPaddingH(Plan);
+    const int iw = pw - Plan.PaddingW + PlanInputPaddingW(Plan);
+    const int xh = Plan.H + 2 * PlanInputPaddingH(Plan);
+    const int xw = Plan.W + 2 * PlanInputPaddingW(Plan);
+    if ((ih < 0) || (ih >= xh) || (iw < 0) || (iw >= xw))
+        return NULL;
+    return QX + (((int64_t)n * xh + ih) * xw + iw) * Words;
+}
+
+
+// The GEMM rows of the blocked GEMM from the padded input: Img2Row of images [n0, n0 + Images) into qx
+static void PlanImg2Row(const TabConvPlan& Plan, const int64_t* QX, int n0, int Images, int64_t* qx) {
+    const int P = ((Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::TBN)) ? BITS : 1;
+    const int64_t pixel = (int64_t)Plan.PackedC * P;
+    const int64_t line = (int64_t)Plan.KW * pixel; // the (kw, c) words of one kh are contiguous
+    TAB_ParallelFor(Images * Plan.OH, [&](int tile, int tid) {
+        const int n = n0 + tile / Plan.OH;
+        const int oh = tile % Plan.OH;
+        for (int ow = 0; ow < Plan.OW; ow++) {
+            int64_t* row = qx + ((int64_t)tile * Plan.OW + ow) * Plan.KH * line;
+            for (int kh = 0; kh < Plan.KH; kh++) {
+                if (!Plan.PaddingFree) {
+                    const int64_t* src = PlanInputPixel(Plan, QX, pixel, n, oh * Plan.StrideH + kh, ow * Plan.StrideW);
+                    for (int64_t i = 0; i < line; i++)
+                        row[kh * line + i] = src[i];
+                    continue;
+                }
+                for (int kw = 0; kw < Plan.KW; kw++) {
+                    const int64_t* src = PlanInputPixel(Plan, QX, pixel, n, oh * Plan.StrideH + kh, ow * Plan.StrideW + kw);
+                    for (int64_t i = 0; i < pixel; i++)
+                        row[kh * line + kw * pixel + i] = src ? src[i] : 0;
+                }
+            }
+        }
+    });
+}
+
+
+// Grouped: the padded input (implicit) or the GEMM rows (blocked) of every group from the padded input QX of all
+// channels, group after group. The implicit inputs of the groups store the same border as QX.
+static void PlanRegroup(const TabConvPlan& Plan, const int64_t* QX, int64_t* qx) {
+    const int P = ((Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::TBN)) ? BITS : 1;
+    const int packC = (Plan.C + cntbits - 1) / cntbits;
+    const int Cg = Plan.C / Plan.Groups;
+    const int64_t pixel = (int64_t)Plan.PackedC * P;
+    const size_t groupWords = (size_t)Plan.Batch_Size * PlanImageWords(Plan) / Plan.Groups;
+    if (Plan.Algo == Algo_Implicit) {
+        const int xh = Plan.H + 2 * PlanInputPaddingH(Plan);
+        const int xw = Plan.W + 2 * PlanInputPaddingW(Plan);
+        TAB_ParallelFor(Plan.Groups * Plan.Batch_Size * xh, [&](int tile, int tid) {
+            const int g = tile / (Plan.Batch_Size * xh);
+            const int64_t row = tile % (Plan.Batch_Size * xh);
+            for (int pw = 0; pw < xw; pw++)
+                GroupPixel(QX + (row * xw + pw) * packC * P, P, packC, g * Cg, Cg, qx + g * groupWords + (row * xw + pw) * pixel);
+        });
+        return;
+    }
+    TAB_ParallelFor(Plan.Groups * Plan.Batch_Size * Plan.OH, [&](int tile, int tid) {
+        const int g = tile / (Plan.Batch_Size * Plan.OH);
+        const int n = tile / Plan.OH % Plan.Batch_Size;
+        const int oh = tile % Plan.OH;
+        for (int ow = 0; ow < Plan.OW; ow++) {
+            int64_t* row = qx + g * groupWords + (((int64_t)n * Plan.OH + oh) * Plan.OW + ow) * Plan.KH * Plan.KW * pixel;
+            for (int kh = 0; kh < Plan.KH; kh++) {
+                for (int kw = 0; kw < Plan.KW; kw++) {
+                    int64_t* dst = row + (kh * Plan.KW + kw) * pixel;
+                    const int64_t* src = PlanInputPixel(Plan, QX, (int64_t)packC * P, n, oh * Plan.StrideH + kh, ow * Plan.StrideW + kw);
+                    if (src)
+                        GroupPixel(src, P, packC, g * Cg, Cg, dst);
+                    else
+                        std::fill(dst, dst + pixel, (int64_t)0);
+                }
+            }
+        }
+    });
+}
+
+
+// The padded input from a padding-free QX, for the baseline
+static TabTensor<int64_t> PlanPadInput(const TabConvPlan& Plan, const int64_t* QX) {
+    const int P = ((Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::TBN)) ? BITS : 1;
+    const int64_t pixel = (int64_t)((Plan.C + cntbits - 1) / cntbits) * P;
+    TabTensor<int64_t> qx((size_t)Plan.Batch_Size * Plan.PackedH * Plan.PackedW * pixel, 0);
+    for (int n = 0; n < Plan.Batch_Size; n++)
+        for (int ph = 0; ph < Plan.PackedH; ph++)
+            for (int pw = 0; pw < Plan.PackedW; pw++) {
+                const int64_t* src = PlanInputPixel(Plan, QX, pixel, n, ph, pw);
+                if (src)
+                    std::copy(src, src + pixel, qx.begin() + (((int64_t)n * Plan.PackedH + ph) * Plan.PackedW + pw) * pixel);
+            }
+    return qx;
+}
+
+
+// Quantize images [n0, n0 + Images) of X into qx, fused with Img2Row for the blocked GEMM
+// Grouped plans quantize the whole batch, group after group.
+static void PlanQuantize(const TabConvPlan& Plan, const float* X, float* Q_Threshold, int n0, int Images, int64_t* qx) {
+    const bool Ternary = (Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::TBN);
+    const float* Xn = X + (int64_t)n0 * Plan.C * Plan.H * Plan.W;
+    float* Qn = Q_Threshold ? (Q_Threshold + n0) : NULL;
+    if (PlanDepthwise(Plan)) {
+        Depthwise_Quantize_NCHW(Xn, Ternary, Plan.PaddingH, Plan.PaddingW, Qn, Images, Plan.C, Plan.H, Plan.W, Plan.KW, Plan.StrideW, qx);
+    }
+    else if (Plan.Groups > 1) {
+        if (Plan.Algo == Algo_Implicit)
+            Quantize_NCHW_to_NHWCB_Grouped(Xn, Ternary, PlanInputPaddingH(Plan), PlanInputPaddingW(Plan), Qn, Images, Plan.C, Plan.H, Plan.W, Plan.Groups, qx);
+        else
+            Quantize_NCHW_to_Rows_Grouped(Xn, Ternary, Plan.PaddingH, Plan.PaddingW, Qn, Images, Plan.C, Plan.H, Plan.W, Plan.KH, Plan.KW, Plan.StrideH, Plan.StrideW, Plan.Groups, qx);
+    }
+    else if (Plan.Algo == Algo_Implicit) {
+        if (Ternary)
+            Ternarize_NCHW_to_NHWCB(Xn, PlanInputPaddingH(Plan), PlanInputPaddingW(Plan), Qn, Images, Plan.C, Plan.H, Plan.W, qx);
+        else
+            Binarize_NCHW_to_NHWC(Xn, PlanInputPaddingH(Plan), PlanInputPaddingW(Plan), Qn, Images, Plan.C, Plan.H, Plan.W, qx);
+    }
+    else {
+        if (Ternary)
+            Ternarize_NCHW_to_N_OHOW_KHKWCB(Xn, Plan.PaddingH, Plan.PaddingW, Qn, Images, Plan.C, Plan.H, Plan.W, Plan.KH, Plan.KW, Plan.StrideH, Plan.StrideW, qx);
+        else
+            Binarize_NCHW_to_N_OHOW_KHKWC(Xn, Plan.PaddingH, Plan.PaddingW, Qn, Images, Plan.C, Plan.H, Plan.W, Plan.KH, Plan.KW, Plan.StrideH, Plan.StrideW, qx);
+    }
+}
+
+
+// The bitwise GEMM of Images images from their quantized input qx (implicit: padded input, blocked: GEMM rows) into y
+// The epilogue writes y straight from the GEMM tiles.
+// Grouped: one GEMM of KN / Groups filters per group, each writing its channels of y. A packed output whose groups do
+// not fill whole words goes through the int results of all groups instead.
+static void PlanGEMM(TabConvPlan& Plan, const int64_t* qx, int Images, int64_t* QWeights, const int64_t* Panels, int* BTN_CNT1, const GEMMEpilogue& ep, void* y) {
+    if (PlanDepthwise(Plan)) {
+        StageTimer timer(PlanSeconds(Plan), Stage_GEMM);
+        Depthwise_Conv(Plan.TYPE, qx, QWeights, Images, Plan.C, Plan.PackedH, Plan.PackedW, Plan.KN, Plan.KH, Plan.KW, Plan.StrideH, Plan.StrideW, ep, y);
+        return;
+    }
+    const int PB = ((Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::BTN)) ? BITS : 1;
+    const int M = Images * Plan.OH * Plan.OW;
+    const int K = Plan.PackedC * Plan.KH * Plan.KW;
+    const int KNg = Plan.KN / Plan.Groups;
+    const int NUM = Plan.C / Plan.Groups * Plan.KH * Plan.KW;
+    const size_t groupWords = (size_t)Images * PlanImageWords(Plan) / Plan.Groups;
+    void* Workspace = (void*)(ArenaBase(Plan) + Plan.WorkspaceOffset);
+
+    TabTensor<int> conv;
+    GEMMEpilogue gep = ep;
+    void* out = y;
+    if ((Plan.Groups > 1) && ((ep.Output == Output_Ternary) || (ep.Output == Output_Binary)) && (KNg % cntbits)) {
+        conv = TabTensor<int>((size_t)M * Plan.KN);
+        gep = GEMMEpilogue();
+        gep.Output = Output_Int32;
+        out = (void*)conv.data();
+    }
+
+    {
+        StageTimer timer(PlanSeconds(Plan), Stage_GEMM);
+        for (int g = 0; g < Plan.Groups; g++) {
+            GEMMEpilogue epg = gep;
+            if (Plan.Groups > 1) {
+                epg.Channels = Plan.KN;
+                epg.ChannelOffset = g * KNg;
+                epg.Scale = gep.Scale ? (gep.Scale + g * KNg) : NULL;
+                epg.Bias = gep.Bias ? (gep.Bias + g * KNg) : NULL;
+                epg.Alphas = gep.Alphas ? (gep.Alphas + g * KNg) : NULL;
+                epg.Thresholds = gep.Thresholds ? (gep.Thresholds + g * KNg) : NULL;
+                epg.Border = gep.Border ? (gep.Border + g * KNg) : NULL;
+            }
+            const int64_t* qxg = qx + g * groupWords;
+            int64_t* Wg = QWeights + (int64_t)g * KNg * K * PB;
+            const int64_t* Pg = Panels ? (Panels + (size_t)g * TABGEMM_PackedBWords(Plan.TYPE, KNg, K, Plan.Blocking.Container)) : NULL;
+            int* cnt1 = BTN_CNT1 ? (BTN_CNT1 + g * KNg) : NULL;
+            if (Plan.Algo == Algo_Implicit) {
+                // The (kh, kw) offsets are resolved while packing the GEMM blocks from the padded input
+                GEMMConvShape Shape = Plan.Shape;
+                Shape.N = Images;
+                TABGEMM_Implicit(Plan.TYPE, qxg, Shape, Wg, cnt1, out, KNg, NUM, Plan.Blocking, Workspace, Pg, &epg);
+            }
+            else {
+                TABGEMM_Blocked(Plan.TYPE, qxg, Wg, cnt1, out, M, KNg, K, NUM, Plan.Blocking, Workspace, Pg, &epg);
+            }
+        }
+    }
+    if (!conv.empty()) {
+        StageTimer epilogue(PlanSeconds(Plan), Stage_Epilogue);
+        TABGEMM_Epilogue(ep, conv.data(), M, Plan.KN, y);
+    }
+}
+
+
+// Padding-free binary activations: the out-of-bounds taps read 0 bits, which are +1, so every border pixel
+// gets the sum of the weights on its out-of-bounds taps too much. The ternary activations read 0 there.
+static bool PlanBorderCorrection(const TabConvPlan& Plan) {
+    return Plan.PaddingFree && ((Plan.TYPE == ConvType::BTN) || (Plan.TYPE == ConvType::BNN)) && !Plan.BorderTaps.empty();
+}
+
+// The weight sum of every tap over the Cg channels of the KN filters QWeights (BTN, BNN), TapSums[k * KH * KW + t]:
+// binary Cg - 2 * (-1s), ternary (+1s) - (-1s)
+static void WeightTapSums(ConvType TYPE, const int64_t* QWeights, int KN, int Cg, int KH, int KW, int* TapSums) {
+    const int PB = (TYPE == ConvType::BTN) ? BITS : 1;
+    const int PackedC = (Cg + cntbits - 1) / cntbits;
+    const int64_t taps = (int64_t)KN * KH * KW;
+    for (int64_t t = 0; t < taps; t++) {
+        const int64_t* w = QWeights + t * PackedC * PB;
+        int sum = (PB == 1) ? Cg : 0;
+        for (int c = 0; c < PackedC; c++) {
+            if (PB == 1)
+                sum -= 2 * (int)popcnt64(w[c]);
+            else
+                sum += (int)popcnt64(w[c * PB + 1]) - 2 * (int)popcnt64(w[c * PB] & w[c * PB + 1]);
+        }
+        TapSums[t] = sum;
+    }
+}
+
+// The border correction of the tap sums: per class and filter, the sum of the weights on its out-of-bounds taps
+static void PlanBorder(TabConvPlan& Plan, const int* TapSums) {
+    const int taps = Plan.KH * Plan.KW;
+    const int classes = (int)Plan.BorderTaps.size() / 4;
+    for (int k = 0; k < Plan.KN; k++) {
+        const int* sums = TapSums + (size_t)k * taps;
+        for (int cls = 0; cls < classes; cls++) {
+            const int* range = Plan.BorderTaps.data() + cls * 4;
+            int sum = 0;
+            for (int t = 0; t < taps; t++) {
+                const int kh = t / Plan.KW;
+                const int kw = t % Plan.KW;
+                if ((kh < range[0]) || (kh >= range[1]) || (kw < range[2]) || (kw >= range[3]))
+                    sum += sums[t];
+            }
+            Plan.Border[(size_t)cls * Plan.KN + k] = sum;
+        }
+    }
+}
+
+// The packed outputs take their image from the plan, padding-free plans add the border correction of the weights:
+// from their TapSums (see TAB_PackWeights()), NULL: from QWeights
+static GEMMEpilogue PlanEpilogue(TabConvPlan& Plan, const GEMMEpilogue& Epilogue, const int64_t* QWeights, const int* TapSums) {
+    GEMMEpilogue ep = Epilogue;
+    ep.OH = Plan.OH;
+    ep.OW = Plan.OW;
+    if (PlanBorderCorrection(Plan)) {
+        if (!TapSums) {
+            WeightTapSums(Plan.TYPE, QWeights, Plan.KN, Plan.C / Plan.Groups, Plan.KH, Plan.KW, Plan.TapSums.data());
+            TapSums = Plan.TapSums.data();
+        }
+        PlanBorder(Plan, TapSums);
+        ep.Border = Plan.Border.data();
+        ep.BorderClass = Plan.BorderClass.data();
+    }
+    return ep;
+}
+
+
+// The GEMM of a plan from its quantized, padded input QX (N_PackedH_PackedW_C(_B))
+static void RunConvPlanGEMM(TabConvPlan& Plan, const int64_t* QX, int64_t* QWeights, const int64_t* Panels, int* BTN_CNT1, const int* TapSums, const GEMMEpilogue& Epilogue, void* y) {
+    const GEMMEpilogue ep = PlanEpilogue(Plan, Epilogue, QWeights, TapSums);
+
+    if (Plan.Algo == Algo_Baseline) {
+        TabTensor<int64_t> padded;
+        if (Plan.PaddingFree && (Plan.PaddingH || Plan.PaddingW)) {
+            padded = PlanPadInput(Plan, QX);
+            QX = padded.data();
+        }
+        TabTensor<int> yi = TAB_Conv_Baseline_Packed(QX, QWeights, BTN_CNT1, Plan.TYPE, Plan.Batch_Size, Plan.C, Plan.PackedH, Plan.PackedW, Plan.StrideH, Plan.StrideW,
+            Plan.KN, Plan.KH, Plan.KW, Plan.Groups, PlanSeconds(Plan));
+        StageTimer timer(PlanSeconds(Plan), Stage_Epilogue);
+        TABGEMM_Epilogue(ep, yi.data(), Plan.Batch_Size * Plan.OH * Plan.OW, Plan.KN, y);
+        return;
+    }
+
+    // Grouped: the input of every group (or the spatially packed input) into qx
+    if (Plan.Groups > 1) {
+        int64_t* qx = ArenaBase(Plan) + Plan.QXOffset;
+        StageTimer timer(PlanSeconds(Plan), Stage_Img2Row);
+        if (PlanDepthwise(Plan))
+            Depthwise_Pack_NHWC(QX, (Plan.TYPE == ConvType::TNN) || (Plan.TYPE == ConvType::TBN), Plan.Batch_Size, Plan.C, Plan.H + 2 * PlanInputPaddingH(Plan), Plan.W + 2 * PlanInputPaddingW(Plan),
+                Plan.PaddingH - PlanInputPaddingH(Plan), Plan.PaddingW - PlanInputPaddingW(Plan), Plan.KW, Plan.StrideW, qx);
+        else
+            PlanRegroup(Plan, QX, qx);
+        timer.Stop();
+        PlanGEMM(Plan, qx, Plan.Batch_Size, QWeights, Panels, BTN_CNT1, ep, y);
+        return;
+    }
+    if (Plan.Algo == Algo_Implicit) {
+        PlanGEMM(Plan, QX, Plan.Batch_Size, QWeights, Panels, BTN_CNT1, ep, y);
+        return;
+    }
+
+    // 1x1 kernels at stride 1 without padding (FC layers): the padded input already holds the GEMM rows
+    if ((Plan.KH == 1) && (Plan.KW == 1) && (Plan.StrideH == 1) && (Plan.StrideW == 1) && (Plan.PaddingH == 0) && (Plan.PaddingW == 0)) {
+        PlanGEMM(Plan, QX, Plan.Batch_Size, QWeights, Panels, BTN_CNT1, ep, y);
+        return;
+    }
+
+    // Img2Row into qx, as many images at a time as it holds
+    int64_t* qx = ArenaBase(Plan) + Plan.QXOffset;
+    const int Images = PlanQXImages(Plan);
+    const size_t ImageBytes = TABGEMM_OutputBytes(&ep, Plan.OH * Plan.OW, Plan.KN);
+    for (int n0 = 0; n0 < Plan.Batch_Size; n0 += Images) {
+        const int count = (Plan.Batch_Size - n0 < Images) ? (Plan.Batch_Size - n0) : Images;
+        {
+            StageTimer timer(PlanSeconds(Plan), Stage_Img2Row);
+            PlanImg2Row(Plan, QX, n0, count, qx);
+        }
+        PlanGEMM(Plan, qx, count, QWeights, Panels, BTN_CNT1, TABGEMM_ResidualFrom(ep, Plan.OH, Plan.OW, Plan.KN, n0, 0), (void*)((char*)y + n0 * ImageBytes));
+    }
+}
+
+
+// Batch pipelining: the producer thread of the plan quantizes image n + 1 into a ring of PipelineDepth per-image
+// buffers while the calling thread runs the GEMM of image n on the pool. The producer runs its stages serially, so
+// the pool stays with the GEMM.
+static void RunConvPlanPipelined(TabConvPlan& Plan, const float* X, float* Q_Threshold, int64_t* QWeights, const int64_t* Panels, int* BTN_CNT1, const GEMMEpilogue& ep, void* y) {
+    const int Depth = PlanQXImages(Plan);
+    const size_t ImageWords = PlanImageWords(Plan);
+    const size_t ImageBytes = TABGEMM_OutputBytes(&ep, Plan.OH * Plan.OW, Plan.KN);
+    int64_t* qx = ArenaBase(Plan) + Plan.QXOffset;
+
+    std::mutex lock;
+    std::condition_variable cv;
+    int produced = 0;  // images in the ring
+    int consumed = 0;  // images out of the ring
+
+    const auto producer = [&] {
+        TAB_PERF_LAYER(Plan);
+        for (int n = 0; n < Plan.Batch_Size; n++) {
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                cv.wait(lk, [&] { return n - consumed < Depth; });
+            }
+            {
+                StageTimer timer(PlanSeconds(Plan), Stage_Quantize);
+                PlanQuantize(Plan, X, Q_Threshold, n, 1, qx + (n % Depth) * ImageWords);
+            }
+            {
+                std::lock_guard<std::mutex> lk(lock);
+                produced = n + 1;
+            }
+            cv.notify_all();
+        }
+    };
+    Plan.Producer.Run(producer);
+
+    for (int n = 0; n < Plan.Batch_Size; n++) {
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            cv.wait(lk, [&] { return produced > n; });
+        }
+        PlanGEMM(Plan, qx + (n % Depth) * ImageWords, 1, QWeights, Panels, BTN_CNT1, TABGEMM_ResidualFrom(ep, Plan.OH, Plan.OW, Plan.KN, n, 0), (void*)((char*)y + n * ImageBytes));
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            consumed = n + 1;
+        }
+        cv.notify_all();
+    }
+    Plan.Producer.Wait();
+}
+
+
+// The thread count or the ISA changed since the last run
+static void PlanReserve(TabConvPlan& Plan) {
+    if (Plan.Algo == Algo_Baseline)
+        return;
+    const size_t WorkspaceBytes = PlanWorkspaceBytes(Plan);
+    if (WorkspaceBytes > Plan.WorkspaceBytes) {
+        if (Plan.SharedArena && (Plan.WorkspaceOffset * sizeof(int64_t) + WorkspaceBytes <= Plan.SharedBytes))
+            Plan.WorkspaceBytes = WorkspaceBytes;
+        else
+            PlanAllocate(Plan, WorkspaceBytes);
+    }
+}
+
+
+size_t TAB_ConvPlanArenaBytes(const TabConvPlan& Plan) {
+    const size_t WorkspaceBytes = (Plan.Algo == Algo_Baseline) ? 0 : PlanWorkspaceBytes(Plan);
+    return (Plan.WorkspaceOffset + AlignWords((WorkspaceBytes + 7) / 8)) * sizeof(int64_t);
+}
+
+
+void TAB_SetConvPlanPipeline(TabConvPlan& Plan, int Depth) {
+    Plan.PipelineDepth = (Depth > 0) ? Depth : 0;
+    if (PlanPipelined(Plan) && (Plan.Algo != Algo_Baseline))
+        Plan.Producer.Start();
+    else
+        Plan.Producer.Stop();
+    if (Plan.Algo == Algo_Baseline)
+        return;
+    PlanAllocate(Plan, PlanWorkspaceBytes(Plan));
+}
+
+
+void TAB_SetConvPlanBlocking(TabConvPlan& Plan, ConvAlgo Algo, GEMMBlocking Blocking) {
+    if (Plan.Algo == Algo_Baseline)
+        return;
+    if (Algo != Algo_Baseline)
+        Plan.Algo = Algo;
+    Blocking.Container = Plan.Blocking.Container;
+    Plan.Blocking = Blocking;
+    PlanAllocate(Plan, PlanWorkspaceBytes(Plan));
+}
+
+
+// The in-bounds kh (kw) range [lo, hi) of every output row (column), as an index into the distinct ranges
+static void BorderRanges(int O, int S, int Padding, int K, int X, std::vector<int>& Index, std::vector<int>& Ranges) {
+    Index = std::vector<int>(O);
+    Ranges.clear();
+    for (int o = 0; o < O; o++) {
+        const int lo = std::max(0, Padding - o * S);
+        const int hi = std::min(K, X + Padding - o * S);
+        int r = 0;
+        while ((2 * r < (int)Ranges.size()) && !((Ranges[2 * r] == lo) && (Ranges[2 * r + 1] == hi)))
+            r++;
+        if (2 * r == (int)Ranges.size()) {
+            Ranges.push_back(lo);
+            Ranges.push_back(hi);
+        }
+        Index[o] = r;
+    }
+}
+
+
+void TAB_SetConvPlanPaddingFree(TabConvPlan& Plan, bool PaddingFree) {
+    Plan.PaddingFree = PaddingFree;
+    Plan.Shape.PaddingH = PaddingFree ? Plan.PaddingH : 0;
+    Plan.Shape.PaddingW = PaddingFree ? Plan.PaddingW : 0;
+
+    // The classes of the border pixels: the same out-of-bounds taps
+    Plan.BorderClass.clear();
+    Plan.BorderTaps.clear();
+    if (PaddingFree && (Plan.PaddingH || Plan.PaddingW)) {
+        std::vector<int> rowIndex, rowRanges, colIndex, colRanges;
+        BorderRanges(Plan.OH, Plan.StrideH, Plan.PaddingH, Plan.KH, Plan.H, rowIndex, rowRanges);
+        BorderRanges(Plan.OW, Plan.StrideW, Plan.PaddingW, Plan.KW, Plan.W, colIndex, colRanges);
+        const int cols = (int)colRanges.size() / 2;
+        for (size_t r = 0; r < rowRanges.size() / 2; r++) {
+            for (int c = 0; c < cols; c++) {
+                const int taps[4] = { rowRanges[2 * r], rowRanges[2 * r + 1], colRanges[2 * c], colRanges[2 * c + 1] };
+                Plan.BorderTaps.insert(Plan.BorderTaps.end(), taps, taps + 4);
+            }
+        }
+        Plan.BorderClass = std::vector<int>((size_t)Plan.OH * Plan.OW);
+        for (int oh = 0; oh < Plan.OH; oh++) {
+            for (int ow = 0; ow < Plan.OW; ow++) {
+                const int* range = Plan.BorderTaps.data() + (rowIndex[oh] * cols + colIndex[ow]) * 4;
+                const bool interior = (range[0] == 0) && (range[1] == Plan.KH) && (range[2] == 0) && (range[3] == Plan.KW);
+                Plan.BorderClass[(size_t)oh * Plan.OW + ow] = interior ? -1 : (rowIndex[oh] * cols + colIndex[ow]);
+            }
+        }
+    }
+    Plan.TapSums = std::vector<int>(Plan.BorderTaps.empty() ? 0 : (size_t)Plan.KN * Plan.KH * Plan.KW);
+    Plan.Border = std::vector<int>(Plan.BorderTaps.size() / 4 * Plan.KN);
+
+    if (Plan.Algo == Algo_Baseline)
+        return;
+    PlanAllocate(Plan, PlanWorkspaceBytes(Plan));
+}
+
+
+void TAB_SetConvPlanProfile(TabConvPlan& Plan, bool Profile) {
+    Plan.Profile = Profile;
+    std::fill(Plan.StageSeconds, Plan.StageSeconds + TAB_Stages, 0.0);
+}
+
+
+void TAB_ShareConvPlanArena(TabConvPlan& Plan, void* Arena, size_t Bytes) {
+    if (Plan.Algo != Algo_Baseline)
+        Plan.WorkspaceBytes = PlanWorkspaceBytes(Plan);
+    TabTensor<int64_t>().swap(Plan.Arena);
+    Plan.SharedArena = (int64_t*)Arena;
+    Plan.SharedBytes = Bytes;
+}
+
+
+/* Container function of quantization and convolution functions. Can be applied to conv and FC layers.
+* Stages: Quantize (+ Img2Row for Algo_Blocked) -> Bitwise GEMM with the epilogue (PReLU, ...) fused into its write-back
+* Panels: the prepacked weights, or NULL to pack QWeights in the GEMM
+* TapSums: the tap sums of the prepacked weights, or NULL to sum QWeights for the padding-free border correction
+* */
+static void RunConvPlan(TabConvPlan& Plan, const float* X, float* Q_Threshold, int64_t* QWeights, const int64_t* Panels, int* BTN_CNT1, const int* TapSums, const GEMMEpilogue& Epilogue, void* y) {
+    const ConvType TYPE = Plan.TYPE;
+    TAB_PERF_LAYER(Plan);
+
+    if (Plan.Algo == Algo_Baseline) {
+        TabTensor<int> yi = TAB_Conv_Baseline_GEMM((float*)X, Q_Threshold, QWeights, BTN_CNT1, TYPE, Plan.PaddingH, Plan.PaddingW, Plan.StrideH, Plan.StrideW,
+            Plan.Batch_Size, Plan.C, Plan.H, Plan.W, Plan.KN, Plan.KH, Plan.KW, Plan.Groups, PlanSeconds(Plan));
+        StageTimer timer(PlanSeconds(Plan), Stage_Epilogue);
+        TABGEMM_Epilogue(PlanEpilogue(Plan, Epilogue, QWeights, TapSums), yi.data(), Plan.Batch_Size * Plan.OH * Plan.OW, Plan.KN, y);
+        return;
+    }
+
+    PlanReserve(Plan);
+    int64_t* qx = ArenaBase(Plan) + Plan.QXOffset;
+    if (Plan.SharedArena)
+        std::fill(qx, qx + (Plan.WorkspaceOffset - Plan.QXOffset), (int64_t)0);
+
+    const GEMMEpilogue ep = PlanEpilogue(Plan, Epilogue, QWeights, TapSums);
+    if (PlanPipelined(Plan) && (Plan.Batch_Size > 1)) {
+        RunConvPlanPipelined(Plan, X, Q_Threshold, QWeights, Panels, BTN_CNT1, ep, y);
+        return;
+    }
+    {
+        StageTimer timer(PlanSeconds(Plan), Stage_Quantize);
+        PlanQuantize(Plan, X, Q_Threshold, 0, Plan.Batch_Size, qx);
+    }
+    PlanGEMM(Plan, qx, Plan.Batch_Size, QWeights, Panels, BTN_CNT1, ep, y);
+}
+
+
+void TAB_RunConvPlan(TabConvPlan& Plan, const float* X, float* Q_Threshold, int64_t* QWeights, int* BTN_CNT1, float ReLU_alpha, float* y) {
+    RunConvPlan(Plan, X, Q_Threshold, QWeights, NULL, BTN_CNT1, NULL, PReLU_Epilogue(ReLU_alpha), y);
+}
+
+
+TabPackedWeights TAB_PackWeights(ConvType TYPE, const int64_t* QWeights, int KN, int C, int KH, int KW, int Groups) {
+    TabPackedWeights Weights;
+    const int G = (Groups > 1) ? Groups : 1;
+    const int Cg = C / G;
+    const int KNg = KN / G;
+    const int PackedC = (Cg % cntbits) ? ((Cg / cntbits) + 1) : (Cg / cntbits);
+    const int P = ((TYPE == ConvType::TNN) || (TYPE == ConvType::BTN)) ? BITS : 1;
+    Weights.TYPE = TYPE;
+    Weights.KN = KN;
+    Weights.C = C;
+    Weights.KH = KH;
+    Weights.KW = KW;
+    Weights.Groups = G;
+    Weights.K = PackedC * KH * KW;
+    Weights.NUM = Cg * KH * KW;
+    Weights.Rows = TabTensor<int64_t>(QWeights, QWeights + (size_t)KN * Weights.K * P);
+    // The panels of every group, the GEMM of a group reads its KN / Groups filters
+    Weights.Container = TABGEMM_ContainerWords(Weights.K);
+    const size_t GroupWords = TABGEMM_PackedBWords(TYPE, KNg, Weights.K, Weights.Container);
+    Weights.Panels = TabTensor<int64_t>(G * GroupWords, 0);
+    for (int g = 0; g < G; g++)
+        TABGEMM_PackB_Into(TYPE, QWeights + (int64_t)g * KNg * Weights.K * P, KNg, Weights.K, Weights.Panels.data() + g * GroupWords, Weights.Container);
+    if (TYPE == ConvType::BTN)
+        Weights.CNT1 = BTN_CNT_W2(Weights.Rows.data(), KN, Cg, KH, KW);
+    if ((TYPE == ConvType::BTN) || (TYPE == ConvType::BNN)) {
+        Weights.TapSums = std::vector<int>((size_t)KN * KH * KW);
+        WeightTapSums(TYPE, QWeights, KN, Cg, KH, KW, Weights.TapSums.data());
+    }
+    return Weights;
+}
+
+
+// The panels of the packed weights, the GEMMs of the plan read them in the container they were packed in
+static const int64_t* PlanPanels(TabConvPlan& Plan, const TabPackedWeights& Weights) {
+    Plan.Blocking.Container = Weights.Container;
+    return Weights.Panels.data();
+}
+
+// The tap sums of the packed weights, NULL for the ternary activations
+static const int* WeightsTapSums(const TabPackedWeights& Weights) {
+    return Weights.TapSums.empty() ? NULL : Weights.TapSums.data();
+}
+
+
+void TAB_RunConvPlan(TabConvPlan& Plan, const float* X, float* Q_Threshold, const TabPackedWeights& Weights, float ReLU_alpha, float* y) {
+    RunConvPlan(Plan, X, Q_Threshold, (int64_t*)Weights.Rows.data(), PlanPanels(Plan, Weights), (int*)Weights.CNT1.data(), WeightsTapSums(Weights), PReLU_Epilogue(ReLU_alpha), y);
+}
+
+
+void TAB_RunConvPlan(TabConvPlan& Plan, const float* X, float* Q_Threshold, const TabPackedWeights& Weights, const GEMMEpilogue& Epilogue, void* y) {
+    RunConvPlan(Plan, X, Q_Threshold, (int64_t*)Weights.Rows.data(), PlanPanels(Plan, Weights), (int*)Weights.CNT1.data(), WeightsTapSums(Weights), Epilogue, y);
+}
+
+
+void TAB_RunConvPlan(TabConvPlan& Plan, const int64_t* QX, const TabPackedWeights& Weights, const GEMMEpilogue& Epilogue, void* y) {
+    TAB_PERF_LAYER(Plan);
+    PlanReserve(Plan);
+    RunConvPlanGEMM(Plan, QX, (int64_t*)Weights.Rows.data(), PlanPanels(Plan, Weights), (int*)Weights.CNT1.data(), WeightsTapSums(Weights), Epilogue, y);
+}
+
+
+// Ternary and Binary Convolution using N, H, W, C, B format
+// Input: 
+//   x: input activation in NCHW format 
+//   qw: quantized weights in KN_KH_KW_C_Bit format
+//   stride: the stride on Height and Width
+//   padding: the padding on Height and Width
+//   N: batch number, C, channel, H: Height, W: Width
+//   KN: number of filters/kernels, KH: Kernel Height, KW, Kernel Width 
+//   Algo: Algo_Implicit by default (no Img2Row), Algo_Blocked runs fused quantize + Img2Row and the blocked GEMM, Algo_Baseline runs the reference GEMMs
+//   PaddingFree: no padding border in the quantized input, exact zero padding for binary activations (see TAB_SetConvPlanPaddingFree())
+//   Groups: grouped conv, qw holds KN filters of C / Groups channels (BTN_CNT1: BTN_CNT_W2() with C / Groups). Groups == C is depthwise.
+// Output:
+//   y: convolution result
+// A one-shot plan: layers that run repeatedly should keep a TabConvPlan instead.
+std::vector<float> TAB_Conv(float * X, float * Q_Threshold, int64_t * QWeights, int * BTN_CNT1, ConvType TYPE, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W,
+    int KN, int KH, int KW, float ReLU_alpha, ConvAlgo Algo, int Groups, bool PaddingFree) {
+    if ((Algo == Algo_Baseline) && !PaddingFree) {
+        TAB_PERF_LAYER(TYPE, Algo, PaddingH, PaddingW, StrideH, StrideW, Batch_Size, C, H, W, KN, KH, KW, (Groups > 1) ? Groups : 1, false);
+        return TAB_Conv_Baseline(X, Q_Threshold, QWeights, BTN_CNT1, TYPE, PaddingH, PaddingW, StrideH, StrideW, Batch_Size, C, H, W, KN, KH, KW, ReLU_alpha, (Groups > 1) ? Groups : 1);
+    }
+
+    TabConvPlan Plan = TAB_CreateConvPlan(TYPE, PaddingH, PaddingW, StrideH, StrideW, Batch_Size, C, H, W, KN, KH, KW, Algo, Groups);
+    if (PaddingFree)
+        TAB_SetConvPlanPaddingFree(Plan, true);
+    std::vector<float> y = std::vector<float>(TAB_ConvPlanOutputSize(Plan));
+    TAB_RunConvPlan(Plan, X, Q_Threshold, QWeights, BTN_CNT1, ReLU_alpha, y.data());
+    return y;
+}
\ No newline at end of file
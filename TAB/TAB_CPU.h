@@ -1,5 +1,149 @@
 #pragma once
-std::vector<float> TAB_Conv(float* X, float* Q_Threshold, int64_t* QWeights, int* BTN_CNT1, ConvType TYPE, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W, int KN, int KH, int KW, float ReLU_alpha);
+#include "common.h"
+#include "GEMM.h"
+#include "ThreadPool.h"
 
+std::vector<float> TAB_Conv(float* X, float* Q_Threshold, int64_t* QWeights, int* BTN_CNT1, ConvType TYPE, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W, int KN, int KH, int KW, float ReLU_alpha, ConvAlgo Algo = Algo_Implicit, int Groups = 1, bool PaddingFree = false);
 
 
+// The stages of a conv, for the stage times of a profiled plan (see TAB_SetConvPlanProfile())
+// Fused stages count as the first of them: the fused quantize + Img2Row of Algo_Blocked as Stage_Quantize, the
+// epilogue in the GEMM write-back as Stage_GEMM. Stage_Epilogue only counts separate epilogue passes.
+enum TabStage {
+    Stage_Quantize = 0, Stage_Img2Row = 1, Stage_GEMM = 2, Stage_Epilogue = 3, TAB_Stages = 4
+};
+
+// A conv layer of one shape, created once and run many times
+// The plan keeps the derived sizes and one workspace arena for the quantized input and the GEMM scratch.
+// The GEMM writes the output through its epilogue, no int conv result is stored.
+// The arena is allocated (and zero filled) once, so TAB_RunConvPlan() makes no heap allocation in the steady state.
+// It only grows again when the thread count or the ISA changes to one that needs more scratch.
+// A plan must not be run by two threads at the same time.
+// Grouped convs (Groups > 1): C and KN divide by Groups, filter k reads the C / Groups channels of group
+// k / (KN / Groups) and the weights are KN_KH_KW_(C / Groups)_B. Each group runs its own GEMM of KN / Groups filters
+// on its own quantized channels. Depthwise convs (Groups == C) pack along the width instead (see Depthwise.h).
+// Grouped plans are not pipelined.
+struct TabConvPlan {
+    // The layer
+    ConvType TYPE;
+    ConvAlgo Algo;
+    int PaddingH, PaddingW, StrideH, StrideW;
+    int Batch_Size, C, H, W;
+    int KN, KH, KW;
+    int Groups;
+
+    // Derived sizes, PackedC per group
+    int PackedH, PackedW, PackedC;
+    int OH, OW;
+    GEMMConvShape Shape;
+    GEMMBlocking Blocking;
+
+    // The arena, 64-byte aligned sections in words: qx | GEMM workspace
+    TabTensor<int64_t> Arena;
+    size_t QXOffset, WorkspaceOffset;
+    size_t WorkspaceBytes;
+
+    // An arena shared with other plans (see TAB_ShareConvPlanArena()), NULL: Arena
+    int64_t* SharedArena;
+    size_t SharedBytes;
+
+    // 0: each stage runs on the whole batch, else the number of per-image buffers of the pipeline
+    int PipelineDepth;
+    TabWorker Producer;  // the quantizing thread of the pipeline, from TAB_SetConvPlanPipeline()
+
+    // Padding-free (see TAB_SetConvPlanPaddingFree())
+    bool PaddingFree;
+    std::vector<int> BorderClass;  // per output pixel (oh, ow): its class of out-of-bounds taps, -1: interior
+    std::vector<int> BorderTaps;   // per class: the in-bounds kh range and kw range [lo, hi)
+    std::vector<int> TapSums;      // per filter and tap: the weight sums of unpacked weights (scratch of the correction)
+    std::vector<int> Border;       // per class and filter: the sum of the weights on its out-of-bounds taps
+
+    // Profiling: the seconds of every stage, summed over the runs
+    bool Profile;
+    double StageSeconds[TAB_Stages];
+};
+
+TabConvPlan TAB_CreateConvPlan(ConvType TYPE, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W, int KN, int KH, int KW, ConvAlgo Algo = Algo_Implicit, int Groups = 1);
+
+// The number of floats of the conv result: Batch_Size * OH * OW * KN, in N_OH_OW_KN format
+int64_t TAB_ConvPlanOutputSize(const TabConvPlan& Plan);
+
+// Batch pipelining: quantize image n + 1 on a producer thread while image n is in the GEMM, through a ring of
+// Depth per-image buffers (Depth = 2 is double buffering, 0 turns it off). The quantized input then takes Depth images
+// instead of Batch_Size. The producer runs serially next to the pool, so it pays off when the GEMM dominates. Its
+// thread is started here and sleeps between the runs, until the pipeline is turned off or the plan is destroyed.
+// Not used by Algo_Baseline.
+void TAB_SetConvPlanPipeline(TabConvPlan& Plan, int Depth);
+
+// Padding-free execution: the quantized input keeps no padding border (N_H_W_C(_B) instead of
+// N_PackedH_PackedW_C(_B), also for TAB_ConvPlanInputWords() and the packed outputs written for this plan), and the
+// out-of-bounds taps are handled in the conv: the implicit GEMM packs 0 words for them, and the results of the border
+// pixels are corrected by the weights on their out-of-bounds taps, precomputed per class of border pixels.
+// The interior pixels run unchanged. Binary activations (BTN, BNN) then see an exact zero padding instead of the +1
+// of a 0 bit, the ternary ones (TNN, TBN) give the same results as before.
+// The tap sums of the correction are summed once by TAB_PackWeights(), the weights given unpacked are summed every run.
+void TAB_SetConvPlanPaddingFree(TabConvPlan& Plan, bool PaddingFree);
+
+// The algorithm (Algo_Blocked or Algo_Implicit) and the cache blocking of the GEMM, e.g. from the autotuner (see
+// Autotune.h). The container of the blocking stays the plan's own.
+void TAB_SetConvPlanBlocking(TabConvPlan& Plan, ConvAlgo Algo, GEMMBlocking Blocking);
+
+// Time the stages of every run into Plan.StageSeconds, which this resets. A pipelined plan quantizes next to the
+// GEMM, so its stage times overlap.
+void TAB_SetConvPlanProfile(TabConvPlan& Plan, bool Profile);
+
+// The bytes of the arena for the current thread count and ISA
+size_t TAB_ConvPlanArenaBytes(const TabConvPlan& Plan);
+
+// Run the plan in a caller-owned, 64-byte aligned arena of Bytes >= TAB_ConvPlanArenaBytes(), and free its own.
+// Plans that never run at the same time can share one arena. The shared arena holds the data of other plans, so the
+// padding of the quantized input is zeroed on every run. When the arena gets too small (more threads), the plan
+// allocates its own again.
+void TAB_ShareConvPlanArena(TabConvPlan& Plan, void* Arena, size_t Bytes);
+
+// Run the layer into y, which must hold TAB_ConvPlanOutputSize() floats
+void TAB_RunConvPlan(TabConvPlan& Plan, const float* X, float* Q_Threshold, int64_t* QWeights, int* BTN_CNT1, float ReLU_alpha, float* y);
+
+
+// Weights prepacked once for every run: the micro-kernel panels and the constants of the conv type
+struct TabPackedWeights {
+    ConvType TYPE;
+    int KN, C, KH, KW, Groups;
+    int K;                        // words per filter and plane: PackedC * KH * KW, PackedC of C / Groups channels
+    int NUM;                      // C / Groups * KH * KW, the BNN base
+    TabTensor<int64_t> Rows;      // the filters as given, KN_KH_KW_C_Bit (read by the dot kernels when M < MR)
+    TabTensor<int64_t> Panels;    // the filters in the NR-row panels of the micro-kernels, group after group
+    int Container;                // the container words of the panels (TABGEMM_ContainerWords() when packed)
+    std::vector<int> CNT1;        // BTN: the bit-2 popcount of each filter (BTN_CNT_W2())
+    std::vector<int> TapSums;     // BTN, BNN: per filter and tap, the weight sum over its channels (the padding-free
+                                  // border correction, see TAB_SetConvPlanPaddingFree())
+};
+
+// QWeights: from Ternarize_NCHW_to_NHWCB() (TNN, BTN) or Binarize_NCHW_to_NHWC() (TBN, BNN)
+// C: the input channels of the layer, the filters of a grouped conv have C / Groups channels
+TabPackedWeights TAB_PackWeights(ConvType TYPE, const int64_t* QWeights, int KN, int C, int KH, int KW, int Groups = 1);
+
+// Same as above, with prepacked weights of the same type and shape as the plan
+void TAB_RunConvPlan(TabConvPlan& Plan, const float* X, float* Q_Threshold, const TabPackedWeights& Weights, float ReLU_alpha, float* y);
+
+// Same, with any epilogue: per-channel scale, bias and PReLU slopes, float, int, 16-bit or packed output (see GEMMEpilogue)
+// y must hold TAB_ConvPlanOutputBytes() bytes. The OH and OW of the epilogue are taken from the plan.
+void TAB_RunConvPlan(TabConvPlan& Plan, const float* X, float* Q_Threshold, const TabPackedWeights& Weights, const GEMMEpilogue& Epilogue, void* y);
+
+// Layer chaining: the output of a layer is quantized in its GEMM write-back, straight into the padded input of the next
+// layer. No float tensor and no quantization pass in between.
+//   GEMMEpilogue ep = TAB_PackedOutputEpilogue(Plan1, Plan2, Threshold, NULL); // + Scale, Bias, Activation, ...
+//   TAB_RunConvPlan(Plan1, X, Q_Threshold, W1, ep, qx2);
+//   TAB_RunConvPlan(Plan2, qx2, W2, Epilogue2, y);
+// The bytes of y for the epilogue
+size_t TAB_ConvPlanOutputBytes(const TabConvPlan& Plan, const GEMMEpilogue& Epilogue);
+
+// The words of the quantized, padded input of the plan: N_PackedH_PackedW_C(_B), all C channels for grouped plans
+int64_t TAB_ConvPlanInputWords(const TabConvPlan& Plan);
+
+// The packed epilogue that writes the output of Plan as the input of Next (Output_Ternary for TNN and TBN, else
+// Output_Binary), without scale, bias or activation
+GEMMEpilogue TAB_PackedOutputEpilogue(const TabConvPlan& Plan, const TabConvPlan& Next, float Threshold, const float* Thresholds);
+
+// Run the layer from its quantized input QX (TAB_ConvPlanInputWords() words, with a zero padding border)
+void TAB_RunConvPlan(TabConvPlan& Plan, const int64_t* QX, const TabPackedWeights& Weights, const GEMMEpilogue& Epilogue, void* y);
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include "common.h"
+#include "ThreadPool.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdlib>
+
+
+// Set on the pool threads while they run tasks, so nested calls never touch PoolLock again
+static thread_local bool InsidePool = false;
+
+// Set by TAB_SetSerialThread()
+static thread_local bool SerialThread = false;
+
+// The remaining tiles [begin, end) of one worker, on its own cache line
+struct alignas(64) TileRange {
+    std::mutex lock;
+    int begin;
+    int end;
+};
+
+
+class ThreadPool {
+public:
+    explicit ThreadPool(int n) : NumThreads(n), Ranges(n), Generation(0), Active(0), Stop(false), Fn(NULL), Ctx(NULL) {
+        for (int t = 1; t < n; t++)
+            Workers.push_back(std::thread(&ThreadPool::WorkerMain, this, t));
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lk(Lock);
+            Stop = true;
+        }
+        StartCV.notify_all();
+        for (size_t i = 0; i < Workers.size(); i++)
+            Workers[i].join();
+    }
+
+    int Size() const {
+        return NumThreads;
+    }
+
+    void ParallelFor(int ntiles, TABTaskFn fn, void* ctx) {
+        const int T = NumThreads;
+        for (int t = 0; t < T; t++) {
+            std::lock_guard<std::mutex> lk(Ranges[t].lock);
+            Ranges[t].begin = (int)((int64_t)ntiles * t / T);
+            Ranges[t].end = (int)((int64_t)ntiles * (t + 1) / T);
+        }
+        {
+            std::lock_guard<std::mutex> lk(Lock);
+            Fn = fn;
+            Ctx = ctx;
+            Active = T - 1;
+            Generation++;
+        }
+        StartCV.notify_all();
+
+        RunTiles(0);
+
+        std::unique_lock<std::mutex> lk(Lock);
+        DoneCV.wait(lk, [this] { return Active == 0; });
+    }
+
+private:
+    void WorkerMain(int tid) {
+        InsidePool = true;
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lk(Lock);
+                StartCV.wait(lk, [&] { return Stop || (Generation != seen); });
+                if (Stop)
+                    return;
+                seen = Generation;
+            }
+            RunTiles(tid);
+            {
+                std::lock_guard<std::mutex> lk(Lock);
+                Active--;
+            }
+            DoneCV.notify_one();
+        }
+    }
+
+    // Take the next tile of worker tid, stealing from the other workers when its own range is empty
+    bool NextTile(int tid, int& tile) {
+        {
+            std::lock_guard<std::mutex> lk(Ranges[tid].lock);
+            if (Ranges[tid].begin < Ranges[tid].end) {
+                tile = Ranges[tid].begin++;
+                return true;
+            }
+        }
+        for (int i = 1; i < NumThreads; i++) {
+            TileRange& victim = Ranges[(tid + i) % NumThreads];
+            int begin, end;
+            {
+                std::lock_guard<std::mutex> lk(victim.lock);
+                const int left = victim.end - victim.begin;
+                if (left <= 0)
+                    continue;
+                // Steal the back half, the victim keeps working on the front
+                end = victim.end;
+                begin = victim.end - (left + 1) / 2;
+                victim.end = begin;
+            }
+            std::lock_guard<std::mutex> lk(Ranges[tid].lock);
+            Ranges[tid].begin = begin + 1;
+            Ranges[tid].end = end;
+            tile = begin;
+            return true;
+        }
+        return false;
+    }
+
+    void RunTiles(int tid) {
+        int tile;
+        while (NextTile(tid, tile))
+            Fn(Ctx, tile, tid);
+    }
+
+    const int NumThreads;
+    std::vector<std::thread> Workers;
+    std::vector<TileRange> Ranges;
+
+    std::mutex Lock;
+    std::condition_variable StartCV;
+    std::condition_variable DoneCV;
+    uint64_t Generation;
+    int Active;
+    bool Stop;
+    TABTaskFn Fn;
+    void* Ctx;
+};
+
+
+static int DefaultNumThreads() {
+    const char* env = std::getenv("TAB_NUM_THREADS");
+    if (env && (std::atoi(env) > 0))
+        return std::atoi(env);
+    const int n = (int)std::thread::hardware_concurrency();
+    return (n > 0) ? n : 1;
+}
+
+// Serializes the owners of the pool: ParallelFor callers and TAB_SetNumThreads
+static std::mutex& PoolLock() {
+    static std::mutex lock;
+    return lock;
+}
+
+static ThreadPool*& Pool() {
+    static ThreadPool* pool = NULL;
+    return pool;
+}
+
+// The configured thread count, readable from inside tasks without taking PoolLock
+static std::atomic<int>& NumThreads() {
+    static std::atomic<int> n(DefaultNumThreads());
+    return n;
+}
+
+// Joins the workers at exit
+struct PoolOwner {
+    ~PoolOwner() {
+        std::lock_guard<std::mutex> lk(PoolLock());
+        delete Pool();
+        Pool() = NULL;
+    }
+};
+static PoolOwner Owner;
+
+
+// Must not be called from inside a task
+void TAB_SetNumThreads(int n) {
+    if (n <= 0) {
+        n = (int)std::thread::hardware_concurrency();
+        n = (n > 0) ? n : 1;
+    }
+    std::lock_guard<std::mutex> lk(PoolLock());
+    NumThreads() = n;
+    if (Pool() && (Pool()->Size() != n)) {
+        delete Pool();
+        Pool() = NULL;
+    }
+}
+
+
+int TAB_GetNumThreads() {
+    return NumThreads();
+}
+
+
+void TAB_SetSerialThread(bool Serial) {
+    SerialThread = Serial;
+}
+
+
+void TAB_ParallelFor(int ntiles, TABTaskFn fn, void* ctx) {
+    if (ntiles <= 0)
+        return;
+    std::unique_lock<std::mutex> lk(PoolLock(), std::defer_lock);
+    if ((ntiles > 1) && (NumThreads() > 1) && !InsidePool && !SerialThread && lk.try_lock()) {
+        if (!Pool())
+            Pool() = new ThreadPool(NumThreads());
+        InsidePool = true;
+        Pool()->ParallelFor(ntiles, fn, ctx);
+        InsidePool = false;
+        return;
+    }
+    // Serial fallback: single thread, a serial thread, or a nested call / another caller while the pool is busy
+    for (int tile = 0; tile < ntiles; tile++)
+        fn(ctx, tile, 0);
+}
+
+
+struct TabWorker::State {
+    std::thread Thread;
+    std::mutex Lock;
+    std::condition_variable CV;
+    void (*Fn)(void* ctx);  // the current job, NULL: idle
+    void* Ctx;
+    bool Quit;
+
+    State() : Fn(NULL), Ctx(NULL), Quit(false) {}
+
+    void Main() {
+        SerialThread = true;
+        while (true) {
+            void (*fn)(void* ctx);
+            void* ctx;
+            {
+                std::unique_lock<std::mutex> lk(Lock);
+                CV.wait(lk, [this] { return Quit || Fn; });
+                if (!Fn)
+                    return;
+                fn = Fn;
+                ctx = Ctx;
+            }
+            fn(ctx);
+            {
+                std::lock_guard<std::mutex> lk(Lock);
+                Fn = NULL;
+            }
+            CV.notify_all();
+        }
+    }
+};
+
+
+TabWorker::TabWorker() : S(NULL) {}
+
+TabWorker::TabWorker(const TabWorker& Other) : S(NULL) {
+    if (Other.S)
+        Start();
+}
+
+TabWorker::TabWorker(TabWorker&& Other) noexcept : S(Other.S) {
+    Other.S = NULL;
+}
+
+TabWorker& TabWorker::operator=(const TabWorker& Other) {
+    if (Other.S)
+        Start();
+    else
+        Stop();
+    return *this;
+}
+
+TabWorker& TabWorker::operator=(TabWorker&& Other) noexcept {
+    if (this != &Other) {
+        Stop();
+        S = Other.S;
+        Other.S = NULL;
+    }
+    return *this;
+}
+
+TabWorker::~TabWorker() {
+    Stop();
+}
+
+
+void TabWorker::Start() {
+    if (S)
+        return;
+    S = new State();
+    S->Thread = std::thread(&State::Main, S);
+}
+
+
+// Waits for the current job
+void TabWorker::Stop() {
+    if (!S)
+        return;
+    {
+        std::lock_guard<std::mutex> lk(S->Lock);
+        S->Quit = true;
+    }
+    S->CV.notify_all();
+    S->Thread.join();
+    delete S;
+    S = NULL;
+}
+
+
+bool TabWorker::Running() const {
+    return S != NULL;
+}
+
+
+void TabWorker::Run(void (*fn)(void* ctx), void* ctx) {
+    Start();
+    {
+        std::lock_guard<std::mutex> lk(S->Lock);
+        S->Fn = fn;
+        S->Ctx = ctx;
+    }
+    S->CV.notify_all();
+}
+
+
+void TabWorker::Wait() {
+    if (!S)
+        return;
+    std::unique_lock<std::mutex> lk(S->Lock);
+    S->CV.wait(lk, [this] { return !S->Fn; });
+}
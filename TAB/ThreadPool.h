@@ -0,0 +1,70 @@
+#pragma once
+#include "common.h"
+
+// Persistent work-stealing thread pool
+// TAB_ParallelFor() gives each worker one contiguous range of tiles. A worker takes tiles from the front of its
+// own range, and once it runs dry it steals the back half of another worker's range. The caller runs as worker 0,
+// and the workers sleep between calls, so no thread is created per call.
+// Calls from inside a task, or while another thread owns the pool, run serially on the calling thread.
+
+// Set the number of threads (including the caller). n <= 0 selects std::thread::hardware_concurrency().
+// The default is the TAB_NUM_THREADS environment variable, or hardware_concurrency() when it is not set.
+void TAB_SetNumThreads(int n);
+int TAB_GetNumThreads();
+
+// Run all TAB_ParallelFor() calls of the calling thread serially (tid 0), e.g. on a pipeline producer thread that
+// works next to the pool. Without it, whichever thread takes the pool first gets it.
+void TAB_SetSerialThread(bool Serial);
+
+// Run fn(ctx, tile, tid) for every tile in [0, ntiles), tid in [0, TAB_GetNumThreads())
+typedef void (*TABTaskFn)(void* ctx, int tile, int tid);
+void TAB_ParallelFor(int ntiles, TABTaskFn fn, void* ctx);
+
+// Same for a lambda f(tile, tid), without any heap allocation
+template <typename F>
+void TAB_ParallelFor(int ntiles, const F& f) {
+    struct Thunk {
+        static void Run(void* ctx, int tile, int tid) {
+            (*(const F*)ctx)(tile, tid);
+        }
+    };
+    TAB_ParallelFor(ntiles, &Thunk::Run, (void*)&f);
+}
+
+
+// A persistent thread next to the pool, e.g. the producer of a pipelined plan. It sleeps between jobs, so no thread is
+// created per job, and its TAB_ParallelFor() calls run serially (see TAB_SetSerialThread()). A copy starts its own
+// thread when the original has one: two workers never share a thread. The destructor joins it.
+class TabWorker {
+public:
+    TabWorker();
+    TabWorker(const TabWorker& Other);
+    TabWorker(TabWorker&& Other) noexcept;
+    TabWorker& operator=(const TabWorker& Other);
+    TabWorker& operator=(TabWorker&& Other) noexcept;
+    ~TabWorker();
+
+    // Start the thread, if it does not run yet, or join it
+    void Start();
+    void Stop();
+    bool Running() const;
+
+    // Run fn(ctx) on the thread (started when needed), next to the calling thread, until Wait()
+    void Run(void (*fn)(void* ctx), void* ctx);
+    void Wait();
+
+    // Same for a lambda f(), which must live until Wait()
+    template <typename F>
+    void Run(const F& f) {
+        struct Thunk {
+            static void Call(void* ctx) {
+                (*(const F*)ctx)();
+            }
+        };
+        Run(&Thunk::Call, (void*)&f);
+    }
+
+private:
+    struct State;
+    State* S;
+};
@@ -1,31 +1,34 @@
 #pragma once
 
-// Please define GCC or CLANG when using these compilers
-// Their intrinsic popcnt functions are different from MSVC
-//#define GCC
-//#define CLANG
+// popcnt64 is picked from the compiler. The old GCC/CLANG defines are no longer needed:
+// GCC and Clang share __builtin_popcountll (a single popcnt instruction with -mpopcnt on x86_64, cnt on ARM),
+// MSVC uses __popcnt64 from intrin.h.
+// The SIMD kernels do not depend on it, they are selected at runtime (see CPUFeatures.h).
 
 #include <cstdint>
 #include <vector>
 #include <iostream>
 
 
-#ifdef CLANG
-// CLANG may use popcntintrin.h, but clang may share the same __builtin_popcountll(a) as GCC
-#include <popcntintrin.h>
-#define popcnt64(a)      _mm_popcnt_u64(a)
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>	
+#define popcnt64(a)       __popcnt64(a)
 #else
-#ifdef GCC
-// GCC on GNU/Linux may use the nmmintrin.h and immintrin.h for x86_64 CPUs, no need to include them on ARM CPU
-#include <nmmintrin.h>
-#include <immintrin.h>
 #define popcnt64(a)       __builtin_popcountll(a)
+#endif
+
+// x86_64 builds also compile the AVX2/AVX-512 kernels
+#if defined(__x86_64__) || defined(_M_X64)
+#define TAB_X86
+#endif
+
+// Compile one function for an instruction set that the rest of the build does not enable.
+// MSVC accepts any intrinsic without it.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TAB_TARGET(isa)
 #else
-// MSVC on Windows uses the intrin.h
-#include <intrin.h>	
-#define popcnt64(a)       __popcnt64(a)
-#endif // GCC
-#endif // CLANG
+#define TAB_TARGET(isa)   __attribute__((target(isa)))
+#endif
 
 
 // The bits of the container integer: int64_t
@@ -36,4 +39,12 @@
 // The supported bitwise conv types
 enum ConvType {
     TNN = 0, TBN = 1, BTN = 2, BNN = 3, Conv_Types = 4
+};
+
+// The conv algorithms of TAB_Conv
+// Baseline: Img2Row + baseline GEMMs (reference)
+// Blocked:  fused quantize + Img2Row, blocked GEMM with packed panels and register-blocked micro-kernels
+// Implicit: blocked GEMM that packs its a blocks straight from the quantized input, without Img2Row
+enum ConvAlgo {
+    Algo_Baseline = 0, Algo_Blocked = 1, Algo_Implicit = 2, Conv_Algos = 3
 };
\ No newline at end of file
@@ -24,12 +24,7 @@ int Verify() {
           1024, 1,  1, 1640,1,  1, 2, 3,
     };
 
-    // Get the reference matrix
-    std::vector<float> TX = generate_array(16 * 64 * 224 * 224, true);  // Ternary X: size = 51,380,224
-    std::vector<float> BX = generate_array(16 * 64 * 224 * 224, false); // Binary X : size = 51,380,224
-    std::vector<float> TW = generate_array(1024 * 1024 * 3 * 3, true);  // Ternary Weights: size = 51,380,224
-    std::vector<float> BW = generate_array(1024 * 1024 * 3 * 3, false); // Binary Weights : size = 51,380,224
-    std::vector<int64_t> QW; // Quantized Weights
+    TabTensor<int64_t> QW; // Quantized Weights
     std::vector<float> Q_Threshold = std::vector<float>(1640, 0.5); // Quantization threshold for ternarization
 
     // Iterate on layer configurations
@@ -45,66 +40,70 @@ int Verify() {
         p = TestCases[icase][6];
         s = TestCases[icase][7];
 
+        // Get the reference matrix, sized to the case
+        std::vector<float> TX = generate_array(Batch_Size * c * h * w, true, 1);    // Ternary X
+        std::vector<float> BX = generate_array(Batch_Size * c * h * w, false, 2);   // Binary X
+        std::vector<float> TW = generate_array(kn * c * kh * kw, true, 3);          // Ternary Weights
+        std::vector<float> BW = generate_array(kn * c * kh * kw, false, 4);         // Binary Weights
+
         // iterate on conv types
         std::vector< std::string> ConvNames = {"TAB_TNN","TAB_TBN","TAB_BTN","TAB_BNN"};
+        std::vector< std::string> AlgoNames = {"Baseline","Blocked","Implicit"};
         for (int iconv = 0; iconv < ConvType::Conv_Types; iconv++) {
 
             // Get ref input x and weights w 
             float* ref_x = NULL;
             float* ref_w = NULL;
-            std::vector<float> y;
+            std::vector<int> BTN_CNT;
             if (iconv == ConvType::TNN) {
                 ref_x = TX.data();
                 ref_w = TW.data();
                 // Ternarize_NCHW_to_NHWCB(float* X, int PaddingH, int PaddingW, float* Q_Threshold, int N, int C, int H, int W)
                 QW = Ternarize_NCHW_to_NHWCB(TW.data(), 0, 0, Q_Threshold.data(), kn, c, kh, kw);
-                // TAB_Conv(float* X, float* Q_Threshold, int64_t * QWeights, int* BTN_CNT1, ConvType TYPE, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W, int KN, int KH, int KW, float ReLU_alpha);
-                y = TAB_Conv(TX.data(), Q_Threshold.data(), QW.data(), NULL, ConvType::TNN, p, p, s, s, Batch_Size, c, h, w, kn, kh, kw, ReLU_alpha);
             }
             if (iconv == ConvType::TBN) {
                 ref_x = TX.data();
                 ref_w = BW.data();
                 QW = Binarize_NCHW_to_NHWC(BW.data(), 0, 0, kn, c, kh, kw);
-                y = TAB_Conv(TX.data(), Q_Threshold.data(), QW.data(), NULL, ConvType::TBN, p, p, s, s, Batch_Size, c, h, w, kn, kh, kw, ReLU_alpha);
             }
             if (iconv == ConvType::BTN) {
                 ref_x = BX.data();
                 ref_w = TW.data();
                 QW = Ternarize_NCHW_to_NHWCB(TW.data(), 0, 0, Q_Threshold.data(), kn, c, kh, kw);
-                std::vector<int> BTN_CNT = BTN_CNT_W2(QW.data(), kn, c, kh, kw);
-                y = TAB_Conv(BX.data(), Q_Threshold.data(), QW.data(), BTN_CNT.data(), ConvType::BTN, p, p, s, s, Batch_Size, c, h, w, kn, kh, kw, ReLU_alpha);
+                BTN_CNT = BTN_CNT_W2(QW.data(), kn, c, kh, kw);
             }
             if (iconv == ConvType::BNN) {
                 ref_x = BX.data();
                 ref_w = BW.data();
                 QW = Binarize_NCHW_to_NHWC(BW.data(), 0, 0,  kn, c, kh, kw);
-                y = TAB_Conv(BX.data(), Q_Threshold.data(), QW.data(), NULL, ConvType::BNN, p, p, s, s, Batch_Size, c, h, w, kn, kh, kw, ReLU_alpha);
             }
 
             // Get reference conv result: direct conv on ref_x and ref_w
-
-            std::vector<float> px = DirectPad(ref_x, p, p, Batch_Size, c, h, w);
+            // BTN and BNN regard the padded zeros as 1s because binary quantization only has (+1, -1) no zeros,
+            // so their reference input is padded with 1s.
+            float pad = ((iconv == ConvType::BTN) || (iconv == ConvType::BNN)) ? 1.0f : 0.0f;
+            std::vector<float> px = DirectPad(ref_x, p, p, Batch_Size, c, h, w, pad);
             // std::vector<float> DirectConv2d_FP32(float* x, float* w, int stride1, int stride2, int N, int C, int paddedH, int paddedW, int KN, int KH, int KW)
             int paddedh = h + 2 * p; // height after zero padding
             int paddedw = w + 2 * p; // width  adter zero padding
             std::vector<float> ref_y = DirectConv2d_FP32(px.data(), ref_w, s, s, Batch_Size, c, paddedh, paddedw, kn, kh, kw);
 
-            // Compare the conv results to ensure the functions are correct
-
-            int cmp;
-            // change OH and OW calculation referring to PyTorch Conv2d 
-            int outh = (h + 2 * p - kh) / s + 1; // The output height of y
-            int outw = (w + 2 * p - kw) / s + 1; // The output width  of y
-            if ((p > 0) && ((iconv == ConvType::BTN) || (iconv == ConvType::BNN))) 
-                // BTN and BNN regard the padded zeros as 1s because binary quantization only has (+1, -1) no zeros.
-                // So we only compare the central part of conv results here, excluding the zero padding part.
-                cmp = Compare_Tensor_BNN_Padding(y.data(), ref_y.data(), Batch_Size, kn, outh, outw, p, p);
-            else
-                cmp = Compare_Tensor_NHWC(y.data(), ref_y.data(), Batch_Size, kn, outh, outw);
-            if(cmp>0)
-                std::cout << "Test Case " << icase << " kernel: " << kw << "X" << kh << " " << ConvNames[iconv] << " Passed!" << std::endl;    
-            else 
-                std::cout << "Test Case " << icase << " kernel: " << kw << "X" << kh << " " << ConvNames[iconv] << " Failed!" << std::endl;
+            // iterate on conv algorithms, all of them must match the reference
+            for (int ialgo = 0; ialgo < ConvAlgo::Conv_Algos; ialgo++) {
+                // TAB_Conv(float* X, float* Q_Threshold, int64_t * QWeights, int* BTN_CNT1, ConvType TYPE, int PaddingH, int PaddingW, int StrideH, int StrideW, int Batch_Size, int C, int H, int W, int KN, int KH, int KW, float ReLU_alpha, ConvAlgo Algo);
+                std::vector<float> y = TAB_Conv(ref_x, Q_Threshold.data(), QW.data(), BTN_CNT.data(), (ConvType)iconv, p, p, s, s, Batch_Size, c, h, w, kn, kh, kw, ReLU_alpha, (ConvAlgo)ialgo);
+
+                // Compare the conv results to ensure the functions are correct
+
+                // change OH and OW calculation referring to PyTorch Conv2d 
+                int outh = (h + 2 * p - kh) / s + 1; // The output height of y
+                int outw = (w + 2 * p - kw) / s + 1; // The output width  of y
+                int cmp = Compare_Tensor_NHWC(y.data(), ref_y.data(), Batch_Size, kn, outh, outw);
+                if(cmp>0)
+                    std::cout << "Test Case " << icase << " kernel: " << kw << "X" << kh << " " << ConvNames[iconv] << " " << AlgoNames[ialgo] << " Passed!" << std::endl;    
+                else 
+                    std::cout << "Test Case " << icase << " kernel: " << kw << "X" << kh << " " << ConvNames[iconv] << " " << AlgoNames[ialgo] << " Failed!" << std::endl;
+            }
         }
     }
     return 0;
@@ -1,18 +1,20 @@
 #pragma once
 #include"common.h"
+#include "ThreadPool.h"
+#include <algorithm>
 #include <thread>
 #include <random>
 
 
-// direct zero padding function
+// direct zero padding function, PadValue fills the border (1 for the +1 padding of binary activations)
 template <typename T>
-std::vector<T> DirectPad(T* x, int padding1, int padding2, int N, int C, int H, int W) {
+std::vector<T> DirectPad(T* x, int padding1, int padding2, int N, int C, int H, int W, T PadValue = 0) {
     const int packH = H + 2 * padding1;
     const int packW = W + 2 * padding2;
 
     // The PyTorch data always uses N, C, H, W format, no matter how we permute the data
     // torch::Tensor qx = torch::zeros({ N, packH, packW, packC }, torch::dtype(torch::kInt64));
-    std::vector<T> qx = std::vector<T>(N * C * packH * packW, 0);
+    std::vector<T> qx = std::vector<T>(N * C * packH * packW, PadValue);
     T* qxptr = qx.data();
 
     for (int in = 0; in < N; in++) {
@@ -29,44 +31,75 @@ std::vector<T> DirectPad(T* x, int padding1, int padding2, int N, int C, int H,
 }
 
 
-// direct conv2d implemented in fp
-std::vector<float> DirectConv2d_FP32(float* x, float* w, int stride1, int stride2, int N, int C, int H, int W, int KN, int KH, int KW) {
+// Filters per task of DirectConv2d_FP32(), the accumulators of one output row are FW x DIRECT_KNB floats
+#define DIRECT_KNB 64
+
+// direct conv2d implemented in fp, on the padded input x (N_C_H_W) and the weights w (KN_(C / Groups)_KH_KW)
+// The reference of Verify() and the tests, so it has to be fast on large layers: the weights are transposed to
+// (C / Groups)_KH_KW_KN once, and every task computes one output row (n, oh) for a block of DIRECT_KNB filters.
+// For each tap it adds one input pixel times DIRECT_KNB contiguous weights to the accumulators of its output pixel, so
+// the inner loop vectorizes, and the zeros of ternary inputs are skipped. The tasks run on the thread pool.
+// The sums of ternary and binary values are exact in float, in any order.
+std::vector<float> DirectConv2d_FP32(float* x, float* w, int stride1, int stride2, int N, int C, int H, int W, int KN, int KH, int KW, int Groups = 1) {
     const int OH = H - KH;
     const int OW = W - KW;
     const int FH = (int)(OH / stride1) + 1;
     const int FW = (int)(OW / stride2) + 1;
+    const int Cg = C / Groups;
+    const int KNg = KN / Groups;
+    const int KNB = std::min(KNg, DIRECT_KNB);
+    const int blocks = (KNg + KNB - 1) / KNB;
+
+    // wt[((g * Cg + kc) * KH + kh) * KW + kw][kn % KNg]
+    std::vector<float> wt = std::vector<float>((size_t)KN * Cg * KH * KW);
+    for (int kn = 0; kn < KN; kn++) {
+        for (int t = 0; t < Cg * KH * KW; t++) {
+            wt[((size_t)(kn / KNg) * Cg * KH * KW + t) * KNg + kn % KNg] = w[(size_t)kn * Cg * KH * KW + t];
+        }
+    }
 
-    std::vector<float> y = std::vector<float>(N * KN * FH * FW);
+    std::vector<float> y = std::vector<float>((size_t)N * KN * FH * FW);
     float* yptr = y.data();
 
-    for (int on = 0; on < N; on++) {
-        for (int kn = 0; kn < KN; kn++) {
-            for (int oh = 0; oh < FH; oh++) {
-                for (int ow = 0; ow < FW; ow++) {
-                    float sum = 0;
-                    // kc = kc + 1
-                    for (int kc = 0; kc < C; kc++) {
-                        for (int kh = 0; kh < KH; kh++) {
-                            for (int kw = 0; kw < KW; kw++) {
-                                // Use N_C_H_W format
-                                sum += x[((on * C + kc) * H + (oh * stride1 + kh)) * W + ow * stride2 + kw] * w[((kn * C + kc) * KH + kh) * KW + kw];
-                            }
-                        }
+    TAB_ParallelFor(N * FH * Groups * blocks, [&](int tile, int tid) {
+        const int on = tile / (FH * Groups * blocks);
+        const int oh = tile / (Groups * blocks) % FH;
+        const int g = tile / blocks % Groups;
+        const int kn0 = tile % blocks * KNB;
+        const int nb = std::min(KNB, KNg - kn0);
+        std::vector<float> acc((size_t)FW * KNB, 0);
+        for (int kc = 0; kc < Cg; kc++) {
+            for (int kh = 0; kh < KH; kh++) {
+                const float* xrow = x + ((size_t)(on * C + g * Cg + kc) * H + oh * stride1 + kh) * W;
+                for (int kw = 0; kw < KW; kw++) {
+                    const float* wrow = wt.data() + ((size_t)((g * Cg + kc) * KH + kh) * KW + kw) * KNg + kn0;
+                    for (int ow = 0; ow < FW; ow++) {
+                        const float xv = xrow[ow * stride2 + kw];
+                        if (xv == 0)
+                            continue;
+                        float* a = acc.data() + (size_t)ow * KNB;
+                        for (int j = 0; j < nb; j++)
+                            a[j] += xv * wrow[j];
                     }
-                    yptr[((on * FH + oh) * FW + ow) * KN + kn] = sum;
                 }
             }
         }
-    }
+        // Use N_H_W_C format for the output
+        for (int ow = 0; ow < FW; ow++) {
+            float* yrow = yptr + (((size_t)on * FH + oh) * FW + ow) * KN + g * KNg + kn0;
+            for (int j = 0; j < nb; j++)
+                yrow[j] = acc[(size_t)ow * KNB + j];
+        }
+    });
 
     return y;
 }
 
 
 // Generate a random binary or ternary array for testing
-std::vector<float> generate_array(int size, bool Ternary) {
+std::vector<float> generate_array(int size, bool Ternary, unsigned Seed = std::default_random_engine::default_seed) {
     std::vector<float> y = std::vector<float>(size, 0);
-    std::default_random_engine generator;
+    std::default_random_engine generator(Seed);
     std::uniform_int_distribution<int> distribution(-1, 1);
     if (Ternary) {
         for (int i = 0; i < size; i++) {
@@ -0,0 +1,359 @@
+// TAB benchmark harness
+// Runs TAB conv layers through prepacked plans and reports the percentiles of the run times, the median time of every
+// stage (quantize, Img2Row, GEMM, separate epilogue passes), the effective binary GOPS and the GB/s of the layer.
+//
+// Usage: tab_bench [options]
+//   --cases FILE      the layers, one per line: c h w kn kh kw p s [groups], '#' starts a comment
+//                     (default: the cases of Benchmark() in main.cpp)
+//   --types LIST      conv types, e.g. TNN,BNN (default: all)
+//   --algos LIST      baseline, blocked, implicit (default: implicit)
+//   --batch LIST      batch sizes (default: 1)
+//   --threads LIST    thread counts, 0: all hardware threads (default: the pool default)
+//   --isa NAME        scalar, avx2 or avx512 (default: the best supported)
+//   --warmup N        untimed runs per layer (default: 2)
+//   --runs N          timed runs per layer (default: 10)
+//   --flush           flush the caches before every timed run
+//   --output NAME     the output type of the epilogue: int32, float, int16, half or bf16 (default: float)
+//   --autotune        tune every layer first (see Autotune.h), with TAB_TUNE_CACHE as the cache file
+//   --csv FILE        write the results as CSV
+//   --json FILE       write the results as JSON
+#include "common.h"
+#include "TAB_CPU.h"
+#include "CPUFeatures.h"
+#include "ThreadPool.h"
+#include "Autotune.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+
+struct BenchCase {
+    int C, H, W, KN, KH, KW, P, S, Groups;
+};
+
+struct BenchOptions {
+    std::vector<BenchCase> Cases;
+    std::vector<int> Types;
+    std::vector<int> Algos;
+    std::vector<int> Batches;
+    std::vector<int> Threads;
+    int Warmup;
+    int Runs;
+    bool Flush;
+    bool Autotune;
+    int Output;
+    std::string CSV, JSON;
+};
+
+// The result of one layer: run times in ms, sorted, and the median of every stage
+struct BenchResult {
+    BenchCase Case;
+    int TYPE, Algo, Batch, Threads, Output;
+    std::vector<double> Times;
+    double Stages[TAB_Stages];
+    double GOPS, GBs;
+};
+
+static const char* TypeNames[] = { "TNN", "TBN", "BTN", "BNN" };
+static const char* AlgoNames[] = { "baseline", "blocked", "implicit" };
+static const char* StageNames[] = { "quantize", "img2row", "gemm", "epilogue" };
+// The names of the GEMMOutputType values, "" for the packed ones
+static const char* OutputNames[] = { "int32", "float", "", "", "int16", "half", "bf16" };
+
+// The cases of Benchmark() in main.cpp
+static const BenchCase DefaultCases[] = {
+    { 64, 56, 56, 64, 3, 3, 1, 1, 1 }, { 64, 56, 56, 128, 3, 3, 1, 1, 1 }, { 128, 28, 28, 128, 3, 3, 1, 1, 1 },
+    { 128, 28, 28, 256, 3, 3, 1, 1, 1 }, { 256, 14, 14, 256, 3, 3, 1, 1, 1 }, { 256, 14, 14, 512, 3, 3, 1, 1, 1 },
+    { 80, 224, 224, 80, 3, 3, 1, 1, 1 }, { 80, 224, 224, 80, 3, 3, 1, 2, 1 }, { 80, 224, 224, 80, 3, 3, 1, 3, 1 },
+    { 80, 224, 224, 80, 3, 3, 1, 4, 1 },
+    { 512, 56, 56, 256, 1, 1, 0, 1, 1 }, { 512, 56, 56, 256, 3, 3, 1, 1, 1 }, { 512, 56, 56, 256, 5, 5, 2, 1, 1 },
+    { 512, 56, 56, 256, 7, 7, 3, 1, 1 }, { 512, 56, 56, 256, 9, 9, 3, 1, 1 }, { 512, 56, 56, 256, 11, 11, 3, 1, 1 },
+    { 2000, 1, 1, 4000, 1, 1, 0, 1, 1 }, { 4000, 1, 1, 8000, 1, 1, 0, 1, 1 }, { 8000, 1, 1, 16000, 1, 1, 0, 1, 1 },
+    { 16000, 1, 1, 32000, 1, 1, 0, 1, 1 },
+};
+
+
+static bool ReadCases(const char* Path, std::vector<BenchCase>& Cases) {
+    FILE* f = std::fopen(Path, "r");
+    if (!f)
+        return false;
+    char line[256];
+    while (std::fgets(line, sizeof(line), f)) {
+        char* comment = std::strchr(line, '#');
+        if (comment)
+            *comment = 0;
+        BenchCase c;
+        c.Groups = 1;
+        const int n = std::sscanf(line, "%d %d %d %d %d %d %d %d %d", &c.C, &c.H, &c.W, &c.KN, &c.KH, &c.KW, &c.P, &c.S, &c.Groups);
+        if (n >= 8)
+            Cases.push_back(c);
+    }
+    std::fclose(f);
+    return true;
+}
+
+static bool SameName(const std::string& a, const char* b) {
+    if (a.size() != std::strlen(b))
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i]))
+            return false;
+    }
+    return true;
+}
+
+// A comma separated list of ints or names (the index of the name in Names). With Names, the ints index Names too.
+static bool ParseList(const char* Arg, const char** Names, int NameCount, std::vector<int>& List) {
+    List.clear();
+    std::stringstream ss(Arg);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int value = -1;
+        for (int i = 0; i < NameCount; i++) {
+            if (SameName(item, Names[i]))
+                value = i;
+        }
+        if ((value < 0) && !item.empty() && (std::isdigit((unsigned char)item[0])))
+            value = std::atoi(item.c_str());
+        if ((value < 0) || (Names && (value >= NameCount)))
+            return false;
+        List.push_back(value);
+    }
+    return !List.empty();
+}
+
+
+static bool ParseOptions(int argc, char** argv, BenchOptions& Options) {
+    Options.Types = { 0, 1, 2, 3 };
+    Options.Algos = { Algo_Implicit };
+    Options.Batches = { 1 };
+    Options.Threads = { TAB_GetNumThreads() };
+    Options.Warmup = 2;
+    Options.Runs = 10;
+    Options.Flush = false;
+    Options.Autotune = false;
+    Options.Output = Output_Float;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        bool ok = true;
+        if (arg == "--flush")
+            Options.Flush = true;
+        else if (arg == "--autotune")
+            Options.Autotune = true;
+        else if (!value)
+            ok = false;
+        else {
+            i++;
+            if (arg == "--cases")
+                ok = ReadCases(value, Options.Cases);
+            else if (arg == "--types")
+                ok = ParseList(value, TypeNames, Conv_Types, Options.Types);
+            else if (arg == "--algos")
+                ok = ParseList(value, AlgoNames, Conv_Algos, Options.Algos);
+            else if (arg == "--batch")
+                ok = ParseList(value, NULL, 0, Options.Batches);
+            else if (arg == "--threads")
+                ok = ParseList(value, NULL, 0, Options.Threads);
+            else if (arg == "--warmup")
+                Options.Warmup = std::atoi(value);
+            else if (arg == "--runs")
+                Options.Runs = std::max(1, std::atoi(value));
+            else if (arg == "--output") {
+                std::vector<int> output;
+                ok = ParseList(value, OutputNames, 7, output) && (output.size() == 1) && (output[0] <= Output_BFloat16) && OutputNames[output[0]][0];
+                Options.Output = ok ? output[0] : Options.Output;
+            }
+            else if (arg == "--csv")
+                Options.CSV = value;
+            else if (arg == "--json")
+                Options.JSON = value;
+            else if (arg == "--isa") {
+                ok = false;
+                for (int isa = 0; isa < TAB_ISAs; isa++) {
+                    if (std::strcmp(value, TAB_ISAName((TAB_ISA)isa)) == 0) {
+                        TAB_SetISA((TAB_ISA)isa);
+                        ok = true;
+                    }
+                }
+            }
+            else
+                ok = false;
+        }
+        if (!ok) {
+            std::fprintf(stderr, "tab_bench: bad option %s, see the usage at the top of bench/TAB_Bench.cpp\n", arg.c_str());
+            return false;
+        }
+    }
+    if (Options.Cases.empty())
+        Options.Cases.assign(DefaultCases, DefaultCases + sizeof(DefaultCases) / sizeof(DefaultCases[0]));
+    return true;
+}
+
+
+// Evict the caches: write and read a buffer larger than the last level cache
+static void FlushCaches() {
+    static std::vector<int64_t> buffer(64 * 1024 * 1024 / sizeof(int64_t));
+    volatile int64_t sum = 0;
+    for (size_t i = 0; i < buffer.size(); i += 8) {
+        buffer[i] += 1;
+        sum = sum + buffer[i];
+    }
+}
+
+
+// The value at percentile p of the sorted times (nearest rank)
+static double Percentile(const std::vector<double>& Sorted, double p) {
+    const size_t rank = (size_t)std::ceil(p * Sorted.size());
+    return Sorted[(rank > 0) ? (rank - 1) : 0];
+}
+
+static double Median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return Percentile(v, 0.5);
+}
+
+
+static BenchResult RunCase(const BenchOptions& Options, const BenchCase& Case, int TYPE, int Algo, int Batch, int Threads) {
+    BenchResult Result;
+    Result.Case = Case;
+    Result.TYPE = TYPE;
+    Result.Algo = Algo;
+    Result.Batch = Batch;
+    Result.Threads = Threads;
+    Result.Output = Options.Output;
+
+    TabConvPlan Plan = TAB_CreateConvPlan((ConvType)TYPE, Case.P, Case.P, Case.S, Case.S, Batch, Case.C, Case.H, Case.W, Case.KN, Case.KH, Case.KW, (ConvAlgo)Algo, Case.Groups);
+    if (Options.Autotune)
+        TAB_TuneConvPlan(Plan);
+
+    // Random data: the timing does not depend on the values
+    std::mt19937_64 rng(7);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    TabTensor<float> X((size_t)Batch * Case.C * Case.H * Case.W);
+    for (float& v : X)
+        v = uniform(rng);
+    std::vector<float> Q_Threshold(Batch, 0.5f);
+    const int PB = ((TYPE == ConvType::TNN) || (TYPE == ConvType::BTN)) ? BITS : 1;
+    std::vector<int64_t> QW((size_t)Case.KN * Case.KH * Case.KW * Plan.PackedC * PB);
+    for (int64_t& v : QW)
+        v = (int64_t)rng();
+    TabPackedWeights Weights = TAB_PackWeights((ConvType)TYPE, QW.data(), Case.KN, Case.C, Case.KH, Case.KW, Case.Groups);
+    // PReLU as in TAB_Conv(), into the output type of the options
+    GEMMEpilogue Epilogue = GEMMEpilogue();
+    Epilogue.Activation = true;
+    Epilogue.Alpha = 0.1f;
+    Epilogue.Output = (GEMMOutputType)Options.Output;
+    TabTensor<int64_t> y((TAB_ConvPlanOutputBytes(Plan, Epilogue) + sizeof(int64_t) - 1) / sizeof(int64_t));
+
+    for (int r = 0; r < Options.Warmup; r++)
+        TAB_RunConvPlan(Plan, X.data(), Q_Threshold.data(), Weights, Epilogue, y.data());
+
+    std::vector<double> stages[TAB_Stages];
+    for (int r = 0; r < Options.Runs; r++) {
+        if (Options.Flush)
+            FlushCaches();
+        TAB_SetConvPlanProfile(Plan, true);
+        const auto start = std::chrono::steady_clock::now();
+        TAB_RunConvPlan(Plan, X.data(), Q_Threshold.data(), Weights, Epilogue, y.data());
+        Result.Times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        for (int s = 0; s < TAB_Stages; s++)
+            stages[s].push_back(Plan.StageSeconds[s] * 1e3);
+    }
+    std::sort(Result.Times.begin(), Result.Times.end());
+    for (int s = 0; s < TAB_Stages; s++)
+        Result.Stages[s] = Median(stages[s]);
+
+    // One binary multiply-accumulate is 2 ops. The bytes: the float input, the packed weights and the output.
+    const double ms = Percentile(Result.Times, 0.5);
+    const double ops = 2.0 * Batch * Plan.OH * Plan.OW * Case.KN * (Case.C / Plan.Groups) * Case.KH * Case.KW;
+    const double bytes = 4.0 * X.size() + 8.0 * QW.size() + (double)TAB_ConvPlanOutputBytes(Plan, Epilogue);
+    Result.GOPS = ops / (ms * 1e6);
+    Result.GBs = bytes / (ms * 1e6);
+    return Result;
+}
+
+
+static void WriteCSV(const char* Path, const std::vector<BenchResult>& Results) {
+    FILE* f = std::fopen(Path, "w");
+    if (!f)
+        return;
+    std::fprintf(f, "type,algo,isa,output,batch,threads,c,h,w,kn,kh,kw,p,s,groups,runs,median_ms,p90_ms,p99_ms");
+    for (int s = 0; s < TAB_Stages; s++)
+        std::fprintf(f, ",%s_ms", StageNames[s]);
+    std::fprintf(f, ",gops,gbs\n");
+    for (const BenchResult& r : Results) {
+        const BenchCase& c = r.Case;
+        std::fprintf(f, "%s,%s,%s,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.6f,%.6f,%.6f", TypeNames[r.TYPE], AlgoNames[r.Algo], TAB_ISAName(TAB_GetISA()), OutputNames[r.Output],
+            r.Batch, r.Threads, c.C, c.H, c.W, c.KN, c.KH, c.KW, c.P, c.S, c.Groups, (int)r.Times.size(),
+            Percentile(r.Times, 0.5), Percentile(r.Times, 0.9), Percentile(r.Times, 0.99));
+        for (int s = 0; s < TAB_Stages; s++)
+            std::fprintf(f, ",%.6f", r.Stages[s]);
+        std::fprintf(f, ",%.3f,%.3f\n", r.GOPS, r.GBs);
+    }
+    std::fclose(f);
+}
+
+
+static void WriteJSON(const char* Path, const std::vector<BenchResult>& Results) {
+    FILE* f = std::fopen(Path, "w");
+    if (!f)
+        return;
+    std::fprintf(f, "[\n");
+    for (size_t i = 0; i < Results.size(); i++) {
+        const BenchResult& r = Results[i];
+        const BenchCase& c = r.Case;
+        std::fprintf(f, "  {\"type\": \"%s\", \"algo\": \"%s\", \"isa\": \"%s\", \"output\": \"%s\", \"batch\": %d, \"threads\": %d, ", TypeNames[r.TYPE], AlgoNames[r.Algo], TAB_ISAName(TAB_GetISA()),
+            OutputNames[r.Output], r.Batch, r.Threads);
+        std::fprintf(f, "\"c\": %d, \"h\": %d, \"w\": %d, \"kn\": %d, \"kh\": %d, \"kw\": %d, \"p\": %d, \"s\": %d, \"groups\": %d, ", c.C, c.H, c.W, c.KN, c.KH, c.KW, c.P, c.S, c.Groups);
+        std::fprintf(f, "\"runs\": %d, \"median_ms\": %.6f, \"p90_ms\": %.6f, \"p99_ms\": %.6f, ", (int)r.Times.size(), Percentile(r.Times, 0.5), Percentile(r.Times, 0.9), Percentile(r.Times, 0.99));
+        for (int s = 0; s < TAB_Stages; s++)
+            std::fprintf(f, "\"%s_ms\": %.6f, ", StageNames[s], r.Stages[s]);
+        std::fprintf(f, "\"gops\": %.3f, \"gbs\": %.3f}%s\n", r.GOPS, r.GBs, (i + 1 < Results.size()) ? "," : "");
+    }
+    std::fprintf(f, "]\n");
+    std::fclose(f);
+}
+
+
+int main(int argc, char** argv) {
+    BenchOptions Options;
+    if (!ParseOptions(argc, argv, Options))
+        return 1;
+    if (Options.Autotune)
+        TAB_SetAutotune(true);
+
+    std::printf("ISA %s, %s output, %d warmup, %d runs%s\n", TAB_ISAName(TAB_GetISA()), OutputNames[Options.Output], Options.Warmup, Options.Runs, Options.Flush ? ", caches flushed" : "");
+    std::printf("%-4s %-8s %5s %3s %28s %10s %10s %10s | %9s %9s %9s %9s | %9s %8s\n", "type", "algo", "batch", "thr", "c,h,w,kn,kh,kw,p,s,g",
+        "median ms", "p90 ms", "p99 ms", "quantize", "img2row", "gemm", "epilogue", "GOPS", "GB/s");
+    std::vector<BenchResult> Results;
+    for (const BenchCase& Case : Options.Cases) {
+        for (int Threads : Options.Threads) {
+            TAB_SetNumThreads(Threads);
+            for (int Batch : Options.Batches) {
+                for (int TYPE : Options.Types) {
+                    for (int Algo : Options.Algos) {
+                        BenchResult r = RunCase(Options, Case, TYPE, Algo, Batch, TAB_GetNumThreads());
+                        char shape[64];
+                        std::snprintf(shape, sizeof(shape), "%d,%d,%d,%d,%d,%d,%d,%d,%d", Case.C, Case.H, Case.W, Case.KN, Case.KH, Case.KW, Case.P, Case.S, Case.Groups);
+                        std::printf("%-4s %-8s %5d %3d %28s %10.4f %10.4f %10.4f | %9.4f %9.4f %9.4f %9.4f | %9.2f %8.2f\n", TypeNames[TYPE], AlgoNames[Algo], Batch, r.Threads, shape,
+                            Percentile(r.Times, 0.5), Percentile(r.Times, 0.9), Percentile(r.Times, 0.99),
+                            r.Stages[Stage_Quantize], r.Stages[Stage_Img2Row], r.Stages[Stage_GEMM], r.Stages[Stage_Epilogue], r.GOPS, r.GBs);
+                        std::fflush(stdout);
+                        Results.push_back(r);
+                    }
+                }
+            }
+        }
+    }
+    if (!Options.CSV.empty())
+        WriteCSV(Options.CSV.c_str(), Results);
+    if (!Options.JSON.empty())
+        WriteJSON(Options.JSON.c_str(), Results);
+    return 0;
+}
@@ -0,0 +1,695 @@
+// TAB differential tests
+// Runs every conv variant on randomized layer shapes against the direct reference of utility.h
+// (DirectConv2d_FP32(), multithreaded and blocked), and so against each other: the baseline GEMMs, the blocked and
+// implicit GEMMs on every instruction set of the CPU, at several thread counts. The shapes cover all ConvTypes,
+// padding, stride, rectangular kernels, tail channels (C and KN around multiples of 64), batches, FC layers,
+// grouped and depthwise convs. The inputs are sized to each shape. Networks run fused depth first against the same
+// network unfused. Packed max pooling runs against the pooling of the values, and the residual add of the epilogue
+// against the scaled reference.
+// The activations and weights are drawn as ternary / binary values, so the quantization is exact and every result
+// must match the reference exactly.
+//
+// Usage: tab_test [suites] [--iters N] [--seed S]
+//   suites            reference, conv, grouped, plan, network, pool (default: all)
+//   --iters N         random shapes per suite (default: 40)
+//   --seed S          the seed of the shapes and data (default: 1)
+// Prints every mismatch with its shape and returns 1 when there is one.
+#include "common.h"
+#include "Quantize.h"
+#include "TAB_CPU.h"
+#include "Network.h"
+#include "Pooling.h"
+#include "CPUFeatures.h"
+#include "ThreadPool.h"
+#include "utility.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+struct TestShape {
+    int N, C, H, W, KN, KH, KW, P, S, Groups;
+};
+
+static const char* TypeNames[] = { "TNN", "TBN", "BTN", "BNN" };
+static const char* AlgoNames[] = { "baseline", "blocked", "implicit" };
+
+static std::mt19937 Rng;
+static int Fails = 0;
+static int Checks = 0;
+
+static int Random(int lo, int hi) {
+    return lo + (int)(Rng() % (unsigned)(hi - lo + 1));
+}
+
+// Channel counts around the 64-bit words of the packing, or any count
+static int RandomChannels(int Max) {
+    static const int Tails[] = { 1, 63, 64, 65, 127, 128, 129 };
+    if (Rng() % 2)
+        return std::min(Max, Tails[Rng() % 7]);
+    return Random(1, Max);
+}
+
+static int OutH(const TestShape& s) {
+    return (s.H + 2 * s.P - s.KH) / s.S + 1;
+}
+static int OutW(const TestShape& s) {
+    return (s.W + 2 * s.P - s.KW) / s.S + 1;
+}
+
+// A conv layer: small feature maps with any kernel, padding and stride, or an FC layer
+static TestShape RandomShape() {
+    TestShape s;
+    do {
+        s.N = Random(1, 3);
+        s.Groups = 1;
+        if (Rng() % 4 == 0) {
+            s.C = RandomChannels(1100);
+            s.KN = RandomChannels(100);
+            s.H = s.W = s.KH = s.KW = 1;
+            s.P = 0;
+            s.S = 1;
+        }
+        else {
+            s.C = RandomChannels(160);
+            s.KN = RandomChannels(80);
+            s.H = Random(1, 10);
+            s.W = Random(1, 10);
+            s.KH = Random(1, 5);
+            s.KW = Random(1, 5);
+            s.P = Random(0, 2);
+            s.S = Random(1, 3);
+        }
+    } while ((s.H + 2 * s.P < s.KH) || (s.W + 2 * s.P < s.KW));
+    return s;
+}
+
+// Grouped convs, and depthwise ones (Groups == C) with 1 to 3 filters per channel
+static TestShape RandomGroupedShape() {
+    TestShape s = RandomShape();
+    if (Rng() % 2) {
+        s.Groups = Random(2, 4);
+        s.C = s.Groups * RandomChannels(70);
+        s.KN = s.Groups * RandomChannels(40);
+    }
+    else {
+        s.Groups = s.C = Random(1, 100);
+        s.KN = s.C * Random(1, 3);
+    }
+    return s;
+}
+
+static bool TernaryActivations(int TYPE) {
+    return (TYPE == ConvType::TNN) || (TYPE == ConvType::TBN);
+}
+static bool TernaryWeights(int TYPE) {
+    return (TYPE == ConvType::TNN) || (TYPE == ConvType::BTN);
+}
+
+static std::vector<float> RandomValues(size_t Size, bool Ternary) {
+    std::vector<float> x(Size);
+    for (float& v : x)
+        v = Ternary ? (float)Random(-1, 1) : (Rng() % 2 ? 1.0f : -1.0f);
+    return x;
+}
+
+// The data of one layer and conv type: the float and quantized weights, and the reference result
+struct TestLayer {
+    TestShape Shape;
+    int TYPE;
+    float Alpha;
+    std::vector<float> X, Wt, Threshold;
+    TabTensor<int64_t> QW;
+    std::vector<int> CNT1;
+    std::vector<float> Ref;          // with the +1 padding of binary activations
+    std::vector<float> RefZeroPad;   // with an exact zero padding (padding-free plans)
+};
+
+static std::vector<float> Reference(const TestLayer& L, float PadValue) {
+    const TestShape& s = L.Shape;
+    std::vector<float> x(L.X);
+    std::vector<float> px = DirectPad(x.data(), s.P, s.P, s.N, s.C, s.H, s.W, PadValue);
+    std::vector<float> w(L.Wt);
+    std::vector<float> y = DirectConv2d_FP32(px.data(), w.data(), s.S, s.S, s.N, s.C, s.H + 2 * s.P, s.W + 2 * s.P, s.KN, s.KH, s.KW, s.Groups);
+    for (float& v : y) {
+        if (!(v > 0))
+            v *= L.Alpha;
+    }
+    return y;
+}
+
+static TestLayer MakeLayer(const TestShape& s, int TYPE) {
+    TestLayer L;
+    L.Shape = s;
+    L.TYPE = TYPE;
+    L.Alpha = 0.25f;
+    const int Cg = s.C / s.Groups;
+    L.X = RandomValues((size_t)s.N * s.C * s.H * s.W, TernaryActivations(TYPE));
+    L.Wt = RandomValues((size_t)s.KN * Cg * s.KH * s.KW, TernaryWeights(TYPE));
+    L.Threshold = std::vector<float>(std::max(s.N, s.KN), 0.5f);
+    if (TernaryWeights(TYPE)) {
+        L.QW = Ternarize_NCHW_to_NHWCB(L.Wt.data(), 0, 0, L.Threshold.data(), s.KN, Cg, s.KH, s.KW);
+        L.CNT1 = BTN_CNT_W2(L.QW.data(), s.KN, Cg, s.KH, s.KW);
+    }
+    else
+        L.QW = Binarize_NCHW_to_NHWC(L.Wt.data(), 0, 0, s.KN, Cg, s.KH, s.KW);
+    L.Ref = Reference(L, TernaryActivations(TYPE) ? 0.0f : 1.0f);
+    L.RefZeroPad = TernaryActivations(TYPE) ? L.Ref : Reference(L, 0.0f);
+    return L;
+}
+
+// Count a check, and print the first mismatch of a failed one
+template <typename T>
+static void Check(const char* What, const TestLayer& L, const std::vector<T>& y, const std::vector<T>& Ref) {
+    Checks++;
+    size_t bad = 0;
+    while ((bad < y.size()) && (bad < Ref.size()) && (std::memcmp(&y[bad], &Ref[bad], sizeof(T)) == 0))
+        bad++;
+    if ((y.size() == Ref.size()) && (bad == y.size()))
+        return;
+    Fails++;
+    const TestShape& s = L.Shape;
+    std::printf("FAIL %s %s ISA %s, %d threads: n %d c %d h %d w %d kn %d k %dx%d p %d s %d groups %d", What, TypeNames[L.TYPE], TAB_ISAName(TAB_GetISA()),
+        TAB_GetNumThreads(), s.N, s.C, s.H, s.W, s.KN, s.KH, s.KW, s.P, s.S, s.Groups);
+    if (bad < std::min(y.size(), Ref.size()))
+        std::printf(", element %zu: %g, expected %g\n", bad, (double)y[bad], (double)Ref[bad]);
+    else
+        std::printf(", %zu elements, expected %zu\n", y.size(), Ref.size());
+}
+
+
+// The reference itself against a naive 7-deep loop, at several thread counts
+static void TestReference(int Iters) {
+    for (int it = 0; it < Iters; it++) {
+        const TestShape s = (Rng() % 2) ? RandomShape() : RandomGroupedShape();
+        TestLayer L = MakeLayer(s, Random(0, Conv_Types - 1));
+        const int Cg = s.C / s.Groups, KNg = s.KN / s.Groups;
+        const int OH = OutH(s), OW = OutW(s);
+        const float pad = TernaryActivations(L.TYPE) ? 0.0f : 1.0f;
+        std::vector<float> naive((size_t)s.N * OH * OW * s.KN);
+        for (int n = 0; n < s.N; n++) for (int oh = 0; oh < OH; oh++) for (int ow = 0; ow < OW; ow++) for (int k = 0; k < s.KN; k++) {
+            float sum = 0;
+            for (int c = 0; c < Cg; c++) for (int kh = 0; kh < s.KH; kh++) for (int kw = 0; kw < s.KW; kw++) {
+                const int ih = oh * s.S + kh - s.P, iw = ow * s.S + kw - s.P;
+                const bool inside = (ih >= 0) && (ih < s.H) && (iw >= 0) && (iw < s.W);
+                const float x = inside ? L.X[((size_t)(n * s.C + k / KNg * Cg + c) * s.H + ih) * s.W + iw] : pad;
+                sum += x * L.Wt[((size_t)(k * Cg + c) * s.KH + kh) * s.KW + kw];
+            }
+            naive[(((size_t)n * OH + oh) * OW + ow) * s.KN + k] = (sum > 0) ? sum : sum * L.Alpha;
+        }
+        for (int threads : { 1, 3 }) {
+            TAB_SetNumThreads(threads);
+            Check("reference", L, Reference(L, pad), naive);
+        }
+    }
+}
+
+
+// TAB_Conv() with every algorithm, instruction set and thread count, with and without padding-free execution
+static void TestConvs(const TestShape& s, const char* Suite) {
+    for (int TYPE = 0; TYPE < Conv_Types; TYPE++) {
+        TestLayer L = MakeLayer(s, TYPE);
+        for (int isa = 0; isa <= TAB_DetectISA(); isa++) {
+            TAB_SetISA((TAB_ISA)isa);
+            for (int threads : { 1, 4 }) {
+                TAB_SetNumThreads(threads);
+                for (int Algo = 0; Algo < Conv_Algos; Algo++) {
+                    std::vector<float> y = TAB_Conv(L.X.data(), L.Threshold.data(), L.QW.data(), L.CNT1.data(), (ConvType)TYPE, s.P, s.P, s.S, s.S,
+                        s.N, s.C, s.H, s.W, s.KN, s.KH, s.KW, L.Alpha, (ConvAlgo)Algo, s.Groups);
+                    std::string what = std::string(Suite) + " " + AlgoNames[Algo];
+                    Check(what.c_str(), L, y, L.Ref);
+                    if (Algo == Algo_Baseline)
+                        continue;
+                    y = TAB_Conv(L.X.data(), L.Threshold.data(), L.QW.data(), L.CNT1.data(), (ConvType)TYPE, s.P, s.P, s.S, s.S,
+                        s.N, s.C, s.H, s.W, s.KN, s.KH, s.KW, L.Alpha, (ConvAlgo)Algo, s.Groups, true);
+                    what += " padding-free";
+                    Check(what.c_str(), L, y, L.RefZeroPad);
+                }
+            }
+        }
+    }
+}
+
+static void TestConv(int Iters) {
+    for (int it = 0; it < Iters; it++)
+        TestConvs(RandomShape(), "conv");
+}
+
+static void TestGrouped(int Iters) {
+    for (int it = 0; it < Iters; it++)
+        TestConvs(RandomGroupedShape(), "grouped");
+}
+
+
+// The quantized input of a plan, with the padding border of the plan
+static TabTensor<int64_t> QuantizeInput(const TestLayer& L, int Padding) {
+    const TestShape& s = L.Shape;
+    std::vector<float> x(L.X), th(L.Threshold);
+    if (TernaryActivations(L.TYPE))
+        return Ternarize_NCHW_to_NHWCB(x.data(), Padding, Padding, th.data(), s.N, s.C, s.H, s.W);
+    return Binarize_NCHW_to_NHWC(L.X.data(), Padding, Padding, th.data(), s.N, s.C, s.H, s.W);
+}
+
+// Plans with prepacked weights: reuse across thread counts, a shared arena, the batch pipeline, the quantized input
+// and the epilogue outputs, against the conversions of the scaled reference
+static void TestPlan(int Iters) {
+    for (int it = 0; it < Iters; it++) {
+        const TestShape s = (Rng() % 3) ? RandomShape() : RandomGroupedShape();
+        for (int TYPE = 0; TYPE < Conv_Types; TYPE++) {
+            TestLayer L = MakeLayer(s, TYPE);
+            const TabPackedWeights pw = TAB_PackWeights((ConvType)TYPE, L.QW.data(), s.KN, s.C, s.KH, s.KW, s.Groups);
+            TAB_SetISA((TAB_ISA)Random(0, TAB_DetectISA()));
+            const int Algo = Random(Algo_Blocked, Algo_Implicit);
+            TabConvPlan Plan = TAB_CreateConvPlan((ConvType)TYPE, s.P, s.P, s.S, s.S, s.N, s.C, s.H, s.W, s.KN, s.KH, s.KW, (ConvAlgo)Algo, s.Groups);
+            std::vector<float> y(TAB_ConvPlanOutputSize(Plan));
+            std::string what = std::string("plan ") + AlgoNames[Algo];
+
+            // The same plan on 1 to 6 threads
+            for (int r = 0; r < 2; r++) {
+                TAB_SetNumThreads(Random(1, 6));
+                TAB_RunConvPlan(Plan, L.X.data(), L.Threshold.data(), pw, L.Alpha, y.data());
+                Check(what.c_str(), L, y, L.Ref);
+            }
+
+            // In a shared arena, dirty from a previous run
+            std::vector<char> arena(TAB_ConvPlanArenaBytes(Plan) + 64, 0x55);
+            TAB_ShareConvPlanArena(Plan, (void*)(((uintptr_t)arena.data() + 63) & ~(uintptr_t)63), arena.size() - 64);
+            TAB_RunConvPlan(Plan, L.X.data(), L.Threshold.data(), pw, L.Alpha, y.data());
+            Check((what + " shared arena").c_str(), L, y, L.Ref);
+
+            // Pipelined, from the float input and from the quantized input
+            GEMMEpilogue prelu = GEMMEpilogue();
+            prelu.Activation = true;
+            prelu.Alpha = L.Alpha;
+            prelu.Output = Output_Float;
+            if (s.Groups == 1) {
+                TabConvPlan Pipe = TAB_CreateConvPlan((ConvType)TYPE, s.P, s.P, s.S, s.S, s.N, s.C, s.H, s.W, s.KN, s.KH, s.KW, (ConvAlgo)Algo);
+                TAB_SetConvPlanPipeline(Pipe, Random(1, 3));
+                TAB_RunConvPlan(Pipe, L.X.data(), L.Threshold.data(), pw, L.Alpha, y.data());
+                Check((what + " pipelined").c_str(), L, y, L.Ref);
+                TabTensor<int64_t> qx = QuantizeInput(L, s.P);
+                TAB_RunConvPlan(Pipe, qx.data(), pw, prelu, y.data());
+                Check((what + " pipelined qx").c_str(), L, y, L.Ref);
+                // A copy runs on its own producer thread, again after the original is gone
+                TabConvPlan Copy = Pipe;
+                Pipe = TabConvPlan();
+                for (int r = 0; r < 2; r++) {
+                    TAB_RunConvPlan(Copy, L.X.data(), L.Threshold.data(), pw, L.Alpha, y.data());
+                    Check((what + " pipelined copy").c_str(), L, y, L.Ref);
+                }
+            }
+
+            // Padding-free from the quantized input without border (the quantized input of grouped plans is per group)
+            if (s.Groups == 1) {
+                TabConvPlan Free = TAB_CreateConvPlan((ConvType)TYPE, s.P, s.P, s.S, s.S, s.N, s.C, s.H, s.W, s.KN, s.KH, s.KW, (ConvAlgo)Algo);
+                TAB_SetConvPlanPaddingFree(Free, true);
+                TabTensor<int64_t> qx = QuantizeInput(L, 0);
+                TAB_RunConvPlan(Free, qx.data(), pw, prelu, y.data());
+                Check((what + " padding-free qx").c_str(), L, y, L.RefZeroPad);
+
+                // Other weights repacked into the reused plan, freed in between: the correction follows the weights,
+                // also when they get the address of the freed ones
+                for (int r = 0; r < 2; r++) {
+                    const TestLayer L2 = MakeLayer(s, TYPE);
+                    const TabPackedWeights pw2 = TAB_PackWeights((ConvType)TYPE, L2.QW.data(), s.KN, s.C, s.KH, s.KW);
+                    TabTensor<int64_t> qx2 = QuantizeInput(L2, 0);
+                    TAB_RunConvPlan(Free, qx2.data(), pw2, prelu, y.data());
+                    Check((what + " padding-free repacked").c_str(), L2, y, L2.RefZeroPad);
+                }
+            }
+
+            // Per-channel scale, bias and slopes, exact in float, in every output type
+            std::vector<float> scale(s.KN), bias(s.KN), alphas(s.KN);
+            for (int j = 0; j < s.KN; j++) {
+                scale[j] = 0.25f * Random(1, 8);
+                bias[j] = (float)Random(-3, 3);
+                alphas[j] = 0.125f * Random(0, 3);
+            }
+            std::vector<float> conv(L.Ref);
+            for (size_t i = 0; i < conv.size(); i++) {
+                float v = (conv[i] > 0) ? conv[i] : conv[i] / L.Alpha;
+                v = v * scale[i % s.KN] + bias[i % s.KN];
+                conv[i] = (v > 0) ? v : v * alphas[i % s.KN];
+            }
+            GEMMEpilogue ep = prelu;
+            ep.Scale = scale.data();
+            ep.Bias = bias.data();
+            ep.Alphas = alphas.data();
+            const size_t size = conv.size();
+            ep.Output = Output_Float;
+            TAB_RunConvPlan(Plan, L.X.data(), L.Threshold.data(), pw, ep, y.data());
+            Check((what + " float").c_str(), L, y, conv);
+            std::vector<int> i32(size), r32(size);
+            std::vector<int16_t> i16(size), r16(size);
+            std::vector<uint16_t> h16(size), rh(size), b16(size), rb(size);
+            for (size_t i = 0; i < size; i++) {
+                r32[i] = (int)lrintf(conv[i]);
+                r16[i] = (int16_t)std::max(-32768L, std::min(32767L, lrintf(conv[i])));
+                rh[i] = TAB_FloatToHalf(conv[i]);
+                rb[i] = TAB_FloatToBFloat16(conv[i]);
+            }
+            ep.Output = Output_Int32;
+            TAB_RunConvPlan(Plan, L.X.data(), L.Threshold.data(), pw, ep, i32.data());
+            Check((what + " int32").c_str(), L, i32, r32);
+            ep.Output = Output_Int16;
+            TAB_RunConvPlan(Plan, L.X.data(), L.Threshold.data(), pw, ep, i16.data());
+            Check((what + " int16").c_str(), L, i16, r16);
+            ep.Output = Output_Half;
+            TAB_RunConvPlan(Plan, L.X.data(), L.Threshold.data(), pw, ep, h16.data());
+            Check((what + " half").c_str(), L, h16, rh);
+            ep.Output = Output_BFloat16;
+            TAB_RunConvPlan(Plan, L.X.data(), L.Threshold.data(), pw, ep, b16.data());
+            Check((what + " bf16").c_str(), L, b16, rb);
+
+            // A residual add ahead of the epilogue: int values and the packed values of a tensor of the output shape
+            const int OH = OutH(s), OW = OutW(s), rp = Random(0, 1);
+            const bool ternary = (Rng() % 2) != 0;
+            std::vector<float> rv = RandomValues(size, ternary), rth(s.N, 0.5f);
+            TabTensor<int64_t> bits = ternary ? Ternarize_NCHW_to_NHWCB(rv.data(), rp, rp, rth.data(), s.N, s.KN, OH, OW) : Binarize_NCHW_to_NHWC(rv.data(), rp, rp, rth.data(), s.N, s.KN, OH, OW);
+            std::vector<int> res(size);
+            for (int& v : res)
+                v = Random(-5, 5);
+            ep.Residual = res.data();
+            ep.ResidualBits = bits.data();
+            ep.ResidualTernary = ternary;
+            ep.ResidualPaddingH = ep.ResidualPaddingW = rp;
+            ep.ResidualScale = Random(1, 3);
+            std::vector<float> sum(size);
+            for (size_t i = 0; i < size; i++) {
+                const size_t j = i % s.KN, pix = i / s.KN % ((size_t)OH * OW), n = i / s.KN / ((size_t)OH * OW);
+                float v = (L.Ref[i] > 0) ? L.Ref[i] : L.Ref[i] / L.Alpha;
+                v = v + res[i] + ep.ResidualScale * rv[(n * s.KN + j) * OH * OW + pix];
+                v = v * scale[j] + bias[j];
+                sum[i] = (v > 0) ? v : v * alphas[j];
+            }
+            ep.Output = Output_Float;
+            TAB_RunConvPlan(Plan, L.X.data(), L.Threshold.data(), pw, ep, y.data());
+            Check((what + " residual").c_str(), L, y, sum);
+            // Image by image: pipelined from the float input, and in chunks of images from the quantized input
+            if (s.Groups == 1) {
+                TabConvPlan Pipe = TAB_CreateConvPlan((ConvType)TYPE, s.P, s.P, s.S, s.S, s.N, s.C, s.H, s.W, s.KN, s.KH, s.KW, (ConvAlgo)Algo);
+                TAB_SetConvPlanPipeline(Pipe, Random(1, 2));
+                TAB_RunConvPlan(Pipe, L.X.data(), L.Threshold.data(), pw, ep, y.data());
+                Check((what + " residual pipelined").c_str(), L, y, sum);
+                TabTensor<int64_t> qx = QuantizeInput(L, s.P);
+                TAB_RunConvPlan(Pipe, qx.data(), pw, ep, y.data());
+                Check((what + " residual pipelined qx").c_str(), L, y, sum);
+            }
+        }
+    }
+}
+
+
+// Max pooling on the packed activations against the max pooling of the values, quantized again
+static void TestPool(int Iters) {
+    for (int it = 0; it < Iters; it++) {
+        const int N = Random(1, 3), C = RandomChannels(200), H = Random(1, 12), W = Random(1, 12);
+        const int KH = Random(1, std::min(H, 4)), KW = Random(1, std::min(W, 4));
+        const int PH = Random(0, KH - 1), PW = Random(0, KW - 1), SH = Random(1, 3), SW = Random(1, 3), OP = Random(0, 1);
+        const int OH = (H + 2 * PH - KH) / SH + 1, OW = (W + 2 * PW - KW) / SW + 1;
+        for (int t = 0; t < 2; t++) {
+            const bool Ternary = (t == 0);
+            std::vector<float> x = RandomValues((size_t)N * C * H * W, Ternary), th(N, 0.5f);
+            std::vector<float> pooled((size_t)N * C * OH * OW);
+            for (int n = 0; n < N; n++)
+                for (int c = 0; c < C; c++)
+                    for (int oh = 0; oh < OH; oh++)
+                        for (int ow = 0; ow < OW; ow++) {
+                            float v = -2.0f;
+                            for (int h = std::max(oh * SH - PH, 0); h < std::min(oh * SH - PH + KH, H); h++)
+                                for (int w = std::max(ow * SW - PW, 0); w < std::min(ow * SW - PW + KW, W); w++)
+                                    v = std::max(v, x[(((size_t)n * C + c) * H + h) * W + w]);
+                            pooled[(((size_t)n * C + c) * OH + oh) * OW + ow] = v;
+                        }
+            TabTensor<int64_t> qx = Ternary ? Ternarize_NCHW_to_NHWCB(x.data(), 0, 0, th.data(), N, C, H, W) : Binarize_NCHW_to_NHWC(x.data(), 0, 0, th.data(), N, C, H, W);
+            TabTensor<int64_t> ref = Ternary ? Ternarize_NCHW_to_NHWCB(pooled.data(), OP, OP, th.data(), N, C, OH, OW) : Binarize_NCHW_to_NHWC(pooled.data(), OP, OP, th.data(), N, C, OH, OW);
+            TabTensor<int64_t> y(MaxPool_OutputWords(Ternary, N, C, OH, OW, OP, OP), 0x55);
+            TAB_SetNumThreads(Random(1, 6));
+            MaxPool_NHWC(qx.data(), Ternary, N, C, H, W, KH, KW, PH, PW, SH, SW, OP, OP, y.data());
+            Checks++;
+            if (y == ref)
+                continue;
+            Fails++;
+            std::printf("FAIL pool %s, %d threads: n %d c %d h %d w %d k %dx%d p %d,%d s %d,%d out padding %d\n", Ternary ? "ternary" : "binary", TAB_GetNumThreads(),
+                N, C, H, W, KH, KW, PH, PW, SH, SW, OP);
+        }
+    }
+}
+
+
+// Random chains of conv layers, with grouped and padding-free layers and max pooling that split the fused runs,
+// residuals, shortcuts to earlier layers and an FC layer at the end: the network against its layers run one by one
+// (the pooling and the shortcuts on the values), and fused depth first in bands of a few rows and of the default rows
+// against the same network unfused
+static void TestNetwork(int Iters) {
+    for (int it = 0; it < Iters; it++) {
+        const int N = Random(1, 2);
+        const int Layers = Random(2, 5);
+        int C = RandomChannels(100), H = Random(2, 24), W = Random(2, 24);
+        const int C0 = C, H0 = H, W0 = W;
+        std::vector<TabLayer> layers(Layers);
+        std::vector<TabTensor<int64_t>> qw(Layers);
+        std::vector<std::vector<float>> scale(Layers), bias(Layers);
+        std::vector<std::vector<int>> res(Layers);
+        std::vector<TabTensor<int64_t>> rbits(Layers);
+        std::vector<int> oc(Layers), oh(Layers), ow(Layers);  // the output shape of every layer
+        std::string shape;
+        for (int i = 0; i < Layers; i++) {
+            TabLayer& l = layers[i];
+            const bool AfterPool = (i > 0) && (layers[i - 1].Kind == Layer_MaxPool);
+            l.TYPE = (ConvType)Random(0, Conv_Types - 1);
+            // The layer after a pooling reads the activations the pooling was quantized to
+            while (AfterPool && (TernaryActivations(l.TYPE) != TernaryActivations(layers[i - 1].TYPE)))
+                l.TYPE = (ConvType)Random(0, Conv_Types - 1);
+            l.Threshold = 0.5f;
+
+            // Max pooling between two layers
+            if ((i > 0) && (i + 1 < Layers) && (H > 1) && (W > 1) && !AfterPool && (Rng() % 4 == 0)) {
+                l.Kind = Layer_MaxPool;
+                l.C = l.KN = C;
+                l.H = H;
+                l.W = W;
+                l.KH = l.KW = Random(2, std::min(std::min(H, W), 3));
+                l.PaddingH = l.PaddingW = Random(0, 1);
+                l.StrideH = l.StrideW = Random(1, 2);
+                shape += std::string(" ") + TypeNames[l.TYPE] + " " + std::to_string(l.C) + "x" + std::to_string(H) + "x" + std::to_string(W) + " maxpool " +
+                    std::to_string(l.KH) + " p " + std::to_string(l.PaddingH) + " s " + std::to_string(l.StrideH) + ",";
+                H = (H + 2 * l.PaddingH - l.KH) / l.StrideH + 1;
+                W = (W + 2 * l.PaddingW - l.KW) / l.StrideW + 1;
+                oc[i] = C;
+                oh[i] = H;
+                ow[i] = W;
+                continue;
+            }
+
+            l.KN = RandomChannels(80);
+            l.Groups = 1;
+            if ((i + 1 == Layers) && !AfterPool && (Rng() % 3 == 0)) {
+                C = C * H * W;
+                H = W = 1;
+            }
+            l.C = C;
+            l.H = H;
+            l.W = W;
+            l.PaddingH = l.PaddingW = (H > 1) ? Random(0, 1) : 0;
+            l.KH = l.KW = (H > 1) ? Random(1, 3) : 1;
+            if ((H + 2 * l.PaddingH < l.KH) || (W + 2 * l.PaddingW < l.KW))
+                l.KH = l.KW = 1;
+            l.StrideH = l.StrideW = (H > 1) ? Random(1, 2) : 1;
+            if ((i > 0) && (H > 1) && (C % 2 == 0) && (Rng() % 5 == 0)) {
+                l.Groups = 2;
+                l.KN = 2 * Random(1, 40);
+            }
+            l.PaddingFree = (Rng() % 6 == 0);
+            // A shortcut layer keeps the shape of its input, so an earlier output of the same shape can be added
+            const bool Shortcut = (i > 0) && (H > 1) && (l.C == C) && (l.H == H) && (Rng() % 3 == 0);
+            if (Shortcut) {
+                l.KN = C;
+                l.Groups = 1;
+                l.KH = l.KW = (Rng() % 2) ? 3 : 1;
+                l.PaddingH = l.PaddingW = l.KH / 2;
+                l.StrideH = l.StrideW = 1;
+            }
+            scale[i] = std::vector<float>(l.KN);
+            bias[i] = std::vector<float>(l.KN);
+            for (int j = 0; j < l.KN; j++) {
+                scale[i][j] = 0.25f * Random(1, 4);
+                bias[i][j] = (float)Random(-2, 2);
+            }
+            l.Epilogue.Scale = scale[i].data();
+            l.Epilogue.Bias = bias[i].data();
+            l.Epilogue.Activation = true;
+            l.Epilogue.Alpha = 0.25f;
+            std::vector<float> wt = RandomValues((size_t)l.KN * (C / l.Groups) * l.KH * l.KW, TernaryWeights(l.TYPE));
+            std::vector<float> th(l.KN, 0.5f);
+            if (TernaryWeights(l.TYPE))
+                qw[i] = Ternarize_NCHW_to_NHWCB(wt.data(), 0, 0, th.data(), l.KN, C / l.Groups, l.KH, l.KW);
+            else
+                qw[i] = Binarize_NCHW_to_NHWC(wt.data(), 0, 0, l.KN, C / l.Groups, l.KH, l.KW);
+            l.QWeights = qw[i].data();
+            shape += std::string(" ") + TypeNames[l.TYPE] + " " + std::to_string(l.C) + "x" + std::to_string(H) + "x" + std::to_string(W) + " kn " + std::to_string(l.KN) +
+                " k " + std::to_string(l.KH) + " p " + std::to_string(l.PaddingH) + " s " + std::to_string(l.StrideH) + " g " + std::to_string(l.Groups) + (l.PaddingFree ? " free," : ",");
+            C = l.KN;
+            H = (H + 2 * l.PaddingH - l.KH) / l.StrideH + 1;
+            W = (W + 2 * l.PaddingW - l.KW) / l.StrideW + 1;
+            oc[i] = C;
+            oh[i] = H;
+            ow[i] = W;
+
+            // The shortcut from an earlier output of the same shape, or a residual on some layers: int values, and the
+            // packed values of a tensor of the output shape
+            std::vector<int> sources;
+            for (int j = 0; Shortcut && (j < i); j++)
+                if ((oc[j] == C) && (oh[j] == H) && (ow[j] == W))
+                    sources.push_back(j);
+            if (!sources.empty()) {
+                l.Shortcut = i - sources[Rng() % sources.size()];
+                l.Epilogue.ResidualScale = Random(1, 2);
+                shape += " shortcut " + std::to_string(l.Shortcut) + ",";
+            }
+            else if (Rng() % 2) {
+                const int rp = Random(0, 1);
+                const bool ternary = (Rng() % 2) != 0;
+                std::vector<float> rv = RandomValues((size_t)N * C * H * W, ternary), rth(N, 0.5f);
+                rbits[i] = ternary ? Ternarize_NCHW_to_NHWCB(rv.data(), rp, rp, rth.data(), N, C, H, W) : Binarize_NCHW_to_NHWC(rv.data(), rp, rp, rth.data(), N, C, H, W);
+                res[i] = std::vector<int>((size_t)N * H * W * C);
+                for (int& v : res[i])
+                    v = Random(-3, 3);
+                l.Epilogue.Residual = res[i].data();
+                l.Epilogue.ResidualBits = rbits[i].data();
+                l.Epilogue.ResidualTernary = ternary;
+                l.Epilogue.ResidualPaddingH = l.Epilogue.ResidualPaddingW = rp;
+                l.Epilogue.ResidualScale = Random(1, 2);
+                shape += " residual,";
+            }
+        }
+        const std::vector<float> x = RandomValues((size_t)N * C0 * H0 * W0, true);
+        std::vector<float> q(N, 0.5f);
+
+        TAB_SetISA((TAB_ISA)Random(0, TAB_DetectISA()));
+        const int Algo = Random(Algo_Blocked, Algo_Implicit);
+
+        // The reference: a plan per layer with a float output, which the next plan quantizes again (in NCHW). The pooling
+        // of the values, and the shortcuts quantized like the input of the layer after their source.
+        std::vector<float> chain(x), out;
+        std::vector<std::vector<float>> outs(Layers);
+        for (int i = 0; i < Layers; i++) {
+            const TabLayer& l = layers[i];
+            if (l.Kind == Layer_MaxPool) {
+                std::vector<float> pooled((size_t)N * l.C * oh[i] * ow[i]);
+                for (int n = 0; n < N; n++)
+                    for (int c = 0; c < l.C; c++)
+                        for (int ph = 0; ph < oh[i]; ph++)
+                            for (int pw = 0; pw < ow[i]; pw++) {
+                                const int h0 = std::max(ph * l.StrideH - l.PaddingH, 0), w0 = std::max(pw * l.StrideW - l.PaddingW, 0);
+                                float v = chain[(((size_t)n * l.C + c) * l.H + h0) * l.W + w0];
+                                for (int h = h0; h < std::min(ph * l.StrideH - l.PaddingH + l.KH, l.H); h++)
+                                    for (int w = w0; w < std::min(pw * l.StrideW - l.PaddingW + l.KW, l.W); w++)
+                                        v = std::max(v, chain[(((size_t)n * l.C + c) * l.H + h) * l.W + w]);
+                                pooled[(((size_t)n * l.C + c) * oh[i] + ph) * ow[i] + pw] = v;
+                            }
+                chain = pooled;
+                outs[i] = chain;
+                continue;
+            }
+            TabConvPlan Plan = TAB_CreateConvPlan(l.TYPE, l.PaddingH, l.PaddingW, l.StrideH, l.StrideW, N, l.C, l.H, l.W, l.KN, l.KH, l.KW, (ConvAlgo)Algo, l.Groups);
+            TAB_SetConvPlanPaddingFree(Plan, l.PaddingFree);
+            const TabPackedWeights pw = TAB_PackWeights(l.TYPE, l.QWeights, l.KN, l.C, l.KH, l.KW, l.Groups);
+            GEMMEpilogue ep = l.Epilogue;
+            ep.Output = Output_Float;
+            TabTensor<int64_t> shortcut;
+            if (l.Shortcut > 0) {
+                const int j = i - l.Shortcut;
+                std::vector<float> src(outs[j]), th(N, layers[j + 1].Threshold);
+                ep.ResidualTernary = TernaryActivations(layers[j + 1].TYPE);
+                shortcut = ep.ResidualTernary ? Ternarize_NCHW_to_NHWCB(src.data(), 0, 0, th.data(), N, oc[j], oh[j], ow[j]) :
+                    Binarize_NCHW_to_NHWC(src.data(), 0, 0, th.data(), N, oc[j], oh[j], ow[j]);
+                ep.ResidualBits = shortcut.data();
+                ep.ResidualPaddingH = ep.ResidualPaddingW = 0;
+            }
+            out = std::vector<float>(TAB_ConvPlanOutputSize(Plan));
+            TAB_RunConvPlan(Plan, chain.data(), q.data(), pw, ep, out.data());
+            const int P = Plan.OH * Plan.OW;
+            chain = out;
+            for (int n = 0; n < N; n++)
+                for (int p = 0; p < P; p++)
+                    for (int j = 0; j < l.KN; j++)
+                        chain[((size_t)n * l.KN + j) * P + p] = out[((size_t)n * P + p) * l.KN + j];
+            outs[i] = chain;
+            if ((i + 1 < Layers) && (layers[i + 1].C != l.KN))
+                chain = out;  // a flatten into the FC layer, in OH_OW_KN order
+        }
+
+        TabNetwork Net = TAB_CreateNetwork(layers, N, (ConvAlgo)Algo);
+        std::vector<float> ref(TAB_NetworkOutputSize(Net)), y(ref.size());
+        TAB_RunNetwork(Net, x.data(), q.data(), ref.data());
+        Checks++;
+        if (ref != out) {
+            Fails++;
+            std::printf("FAIL network %s ISA %s, %d threads, unfused against the layers: n %d,%s\n", AlgoNames[Algo], TAB_ISAName(TAB_GetISA()), TAB_GetNumThreads(), N, shape.c_str());
+        }
+        for (int BandRows : { Random(1, 4), -1 }) {
+            TAB_SetNetworkFusion(Net, BandRows);
+            TAB_SetNumThreads(Random(1, 6));
+            std::fill(y.begin(), y.end(), -99.0f);
+            TAB_RunNetwork(Net, x.data(), q.data(), y.data());
+            Checks++;
+            size_t bad = 0;
+            while ((bad < y.size()) && (y[bad] == ref[bad]))
+                bad++;
+            if (bad == y.size())
+                continue;
+            Fails++;
+            std::printf("FAIL network %s ISA %s, %d threads, band rows %d, %zu runs: n %d,%s element %zu: %g, expected %g\n", AlgoNames[Algo], TAB_ISAName(TAB_GetISA()),
+                TAB_GetNumThreads(), BandRows, Net.Runs.size(), N, shape.c_str(), bad, (double)y[bad], (double)ref[bad]);
+        }
+    }
+}
+
+
+int main(int argc, char** argv) {
+    std::vector<std::string> Suites;
+    int Iters = 40;
+    unsigned Seed = 1;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if ((arg == "--iters") && (i + 1 < argc))
+            Iters = std::atoi(argv[++i]);
+        else if ((arg == "--seed") && (i + 1 < argc))
+            Seed = (unsigned)std::strtoul(argv[++i], NULL, 10);
+        else if ((arg == "reference") || (arg == "conv") || (arg == "grouped") || (arg == "plan") || (arg == "network") || (arg == "pool"))
+            Suites.push_back(arg);
+        else {
+            std::fprintf(stderr, "tab_test: bad option %s, see the usage at the top of test/TAB_Test.cpp\n", arg.c_str());
+            return 1;
+        }
+    }
+    if (Suites.empty())
+        Suites = { "reference", "conv", "grouped", "plan", "network", "pool" };
+
+    const TAB_ISA isa = TAB_GetISA();
+    const int threads = TAB_GetNumThreads();
+    for (const std::string& suite : Suites) {
+        Rng.seed(Seed);
+        const int fails = Fails, checks = Checks;
+        if (suite == "reference")
+            TestReference(Iters);
+        else if (suite == "conv")
+            TestConv(Iters);
+        else if (suite == "grouped")
+            TestGrouped(Iters);
+        else if (suite == "plan")
+            TestPlan(Iters);
+        else if (suite == "network")
+            TestNetwork(Iters);
+        else
+            TestPool(Iters);
+        std::printf("%-10s %6d checks, %d failed (seed %u, up to %s)\n", suite.c_str(), Checks - checks, Fails - fails, Seed, TAB_ISAName(TAB_DetectISA()));
+        TAB_SetISA(isa);
+        TAB_SetNumThreads(threads);
+    }
+    return (Fails > 0) ? 1 : 0;
+}